@@ -4,12 +4,36 @@
 
 #include <future>
 #include <atomic>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
 #include "basic_socket.h"
+#include "server.h"
+#include "handoff_queue.h"
 
 using namespace std;
 using namespace async_net;
 
-class AsyncClient : public basic_socket
+/**
+ * @brief Write to a stream under a lock, so what several reactor threads log does not interleave.
+ * @param strm The stream, cout or cerr
+ * @param args The values to write, formatted together before the lock is taken
+ */
+template <typename... Args>
+static void logTo(ostream &strm, Args &&... args) {
+    static mutex logMutex;
+    ostringstream text;
+    (text << ... << args);
+    lock_guard<mutex> lock{logMutex};
+    strm << text.str() << flush;
+}
+
+class AsyncClient : public eznet::Socket
 {
 public:
 
@@ -18,7 +42,7 @@ public:
     AsyncClient(int fd,                     ///< The accepted connection file descriptor
                  struct sockaddr *addr,      ///< The peer address
                  socklen_t len               ///< The size of the peer address
-    ) : basic_socket (fd, addr, len)
+    ) : eznet::Socket (fd, addr, len)
     {}
 
 
@@ -31,7 +55,8 @@ public:
 
     AsyncServer(const string &host, const string &port) :
             local_socket(host, port),
-            run_server{false}
+            run_server{false},
+            listening{0}
     {}
 
     future<int> start() {
@@ -39,34 +64,347 @@ public:
         return async(launch::async, &AsyncServer::run, this);
     }
 
+
+    /**
+     * @brief Start the server as a set of independent reactors, one per thread.
+     * @param reactors The number of reactor threads to start
+     * @param pinReactors When true reactor n is pinned to cpu n modulo the number of cpus
+     * @param backlog The listen backlog for each reactor's listen socket
+     * @return A future for each reactor, the value is the number of connections it served or -1 on error
+     * @details Each reactor owns a listen socket bound to the server host and port with SO_REUSEPORT,
+     * its own event loop and its own connections. The kernel spreads incoming connections across the
+     * listen sockets so accept and I/O scale across cores without any shared lock. The server must not
+     * also be listening with listen().
+     */
+    vector<future<int>> start(unsigned reactors, bool pinReactors = false, int backlog = 10) {
+        vector<future<int>> futures{};
+        run_server = true;
+        for (unsigned i = 0; i < reactors; ++i)
+            futures.push_back(async(launch::async, &AsyncServer::runReactor, this, i, pinReactors, backlog));
+        return futures;
+    }
+
+
+    /**
+     * @brief Start the server with a single acceptor and a set of worker reactors.
+     * @param workers The number of worker reactor threads to start
+     * @param pinWorkers When true worker n is pinned to cpu n modulo the number of cpus
+     * @param queueDepth The capacity of each worker's handoff queue
+     * @return The future of the acceptor, the value is the number of connections the workers served
+     * @details The server must be listening. The acceptor hands each accepted connection to the workers
+     * in turn through a lock free queue and wakes the worker with an eventfd. A connection is closed if
+     * every worker queue is full.
+     */
+    future<int> startWorkers(unsigned workers, bool pinWorkers = false, size_t queueDepth = 1024) {
+        run_server = true;
+        // Every queue exists before any worker starts, so workerQueues is never reallocated under a worker.
+        for (unsigned i = 0; i < workers; ++i)
+            workerQueues.push_back(make_unique<HandoffQueue<unique_ptr<AsyncClient>>>(queueDepth));
+        for (unsigned i = 0; i < workers; ++i)
+            workerFutures.push_back(async(launch::async, &AsyncServer::runWorker, this, i,
+                                          std::ref(*workerQueues[i]), pinWorkers));
+        return async(launch::async, &AsyncServer::run, this);
+    }
+
+
+    /**
+     * @brief Ask the server and all reactors to stop.
+     */
+    void stop() { run_server = false; }
+
+
+    /**
+     * @brief Get the number of reactors started by start(reactors) that are listening
+     * @return the number of reactors
+     */
+    unsigned reactorsListening() const { return listening; }
+
 protected:
     int run() {
-        cout << "Server " << this->getPeerName() << " started." << endl;
+        logTo(cout, "Server ", this->getPeerName(), " started.\n");
         while (run_server) {
-            int s = select();
-            if (s > 0) {
+            int s = select(chrono::milliseconds(250));
+            if (s > 0 && workerQueues.empty()) {
                 auto newSock = accept<AsyncClient>();
                 if (*newSock) {
-                    // ToDo: Hand the new socket off to some sort of manager.
-                    cout << "Connection from " << newSock->getPeerName() << endl;
+                    logTo(cout, "Connection from ", newSock->getPeerName(), '\n');
                     run_server = false;
                 }
+            } else if (s > 0) {
+                for (auto &newSock: acceptAll<AsyncClient>()) {
+                    logTo(cout, "Connection from ", newSock->getPeerName(), '\n');
+                    handOff(std::move(newSock));
+                }
+            }
+        }
+
+        int served = 0;
+        for (auto &f: workerFutures)
+            served += f.get();
+        return served;
+    }
+
+
+    /**
+     * @brief Pass an accepted connection to the next worker that has room for it.
+     * @param client The connection
+     */
+    void handOff(unique_ptr<AsyncClient> &&client) {
+        for (size_t i = 0; i < workerQueues.size(); ++i) {
+            auto &queue = workerQueues[nextWorker++ % workerQueues.size()];
+            if (queue->push(std::move(client)))
+                return;
+        }
+        logTo(cerr, "Workers busy, dropping ", client->getPeerName(), '\n');
+    }
+
+
+    /**
+     * @brief Pin the calling thread to a cpu
+     * @param index The reactor number, the cpu is the reactor number modulo the number of cpus
+     */
+    static void pinThread(unsigned index) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(index % max(thread::hardware_concurrency(), 1u), &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+            logTo(cerr, "Reactor ", index, " could not be pinned.\n");
+    }
+
+
+    /**
+     * @brief Service a connection selected by a reactor, logging what it sends and echoing it back
+     * @param index The reactor number
+     * @param sock The connection
+     * @param events The selections
+     */
+    static void serviceClient(unsigned index, unique_ptr<eznet::Socket> &sock, eznet::SelectClients events) {
+        if (events & eznet::SC_Read) {
+            char buf[BUFSIZ];
+            ssize_t n = sock->iostrm().readsome(buf, sizeof(buf));
+            if (n > 0) {
+                logTo(cout, string_view{buf, static_cast<size_t>(n)});
+                sock->iostrm().write(buf, n).flush();
+            } else {
+                logTo(cout, "Reactor ", index, " client ", sock->getPeerName(), " disconnected.\n");
+                sock->close();
             }
         }
-        return 0;
+    }
+
+
+    /**
+     * @brief The event loop of one worker reactor fed by the acceptor.
+     * @param index The worker number
+     * @param inbox The worker's handoff queue
+     * @param pin When true pin the worker thread to a cpu
+     * @return The number of connections served
+     */
+    int runWorker(unsigned index, HandoffQueue<unique_ptr<AsyncClient>> &inbox, bool pin) {
+        if (pin)
+            pinThread(index);
+
+        eznet::Server<eznet::EPollServerPolicy<unique_ptr<eznet::Socket>>> server{};
+        server.watch(inbox.fd());
+
+        int served = 0;
+        while (run_server) {
+            server.select(chrono::milliseconds(250));
+
+            if (server.isReady(inbox.fd())) {
+                served += inbox.drain([&](unique_ptr<AsyncClient> &&client) {
+                    logTo(cout, "Reactor ", index, " connection from ", client->getPeerName(), '\n');
+                    client->setStreamBuffer(make_unique<socket_streambuf>(client->fd()));
+                    client->selectClients = eznet::SC_Read;
+                    server.push_front(std::move(client));
+                });
+            }
+
+            server.poll_ready([&](auto &sock, eznet::SelectClients events) {
+                serviceClient(index, sock, events);
+            });
+        }
+
+        return served;
+    }
+
+
+    /**
+     * @brief The event loop of one reactor.
+     * @param index The reactor number
+     * @param pin When true pin the reactor thread to a cpu
+     * @param backlog The listen backlog
+     * @return The number of connections served or -1 on error
+     */
+    int runReactor(unsigned index, bool pin, int backlog) {
+        if (pin)
+            pinThread(index);
+
+        eznet::Server<eznet::EPollServerPolicy<unique_ptr<eznet::Socket>>> server{};
+
+        auto listener = server.push_front(make_unique<eznet::Socket>(peer_host, peer_port));
+        (*listener)->reusePort(true);
+        (*listener)->selectClients = eznet::SC_Read;
+
+        if ((*listener)->listen(backlog, AF_INET6) < 0) {
+            logTo(cerr, "Reactor ", index, " listen error: ", strerror(errno), '\n');
+            return -1;
+        }
+
+        logTo(cout, "Reactor ", index, ' ', (*listener)->getPeerName(), " started.\n");
+        ++listening;
+
+        int served = 0;
+        while (run_server) {
+            server.select(chrono::milliseconds(250));
+            server.poll_ready([&](auto &sock, eznet::SelectClients events) {
+                if (server.isConnectRequest(sock)) {
+                    for (auto &newSock: server.acceptAll(sock)) {
+                        logTo(cout, "Reactor ", index, " connection from ", (*newSock)->getPeerName(), '\n');
+                        (*newSock)->openStream();
+                        (*newSock)->selectClients = eznet::SC_Read;
+                        ++served;
+                    }
+                } else {
+                    serviceClient(index, sock, events);
+                }
+            });
+        }
+
+        return served;
     }
 
     atomic_bool run_server;
+    atomic<unsigned> listening;                                             ///< Reactors listening
+
+    vector<unique_ptr<HandoffQueue<unique_ptr<AsyncClient>>>> workerQueues;  ///< A handoff queue for each worker
+    vector<future<int>> workerFutures;                                      ///< A future for each worker
+    size_t nextWorker{0};                                                   ///< The next worker to hand off to
 };
 
 
+/**
+ * @brief Connect to a server, send a line and check it is echoed back.
+ * @param port The server port on localhost
+ * @return true if the line came back
+ */
+static bool echoOnce(const string &port) {
+    eznet::Socket client{"localhost", port};
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+    while (client.connect(AF_INET6, AF_INET) < 0) {
+        if (chrono::steady_clock::now() > deadline)
+            return false;
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    string line{"echo " + client.getPeerName() + "\n"}, received{};
+    client.write(as_bytes(span{line}));
+    array<byte, 256> buf{};
+    while (received.size() < line.size()) {
+        auto r = client.read(buf);
+        if (!r)
+            break;
+        received.append(reinterpret_cast<const char *>(buf.data()), r.bytes);
+    }
+    return received == line;
+}
+
+/**
+ * @brief Check that every reactor started with SO_REUSEPORT accepts and serves connections.
+ * @param reactors The number of reactors
+ * @return 0 if the check passed
+ */
+static int checkReactors(unsigned reactors) {
+    // Hold a free port with SO_REUSEPORT so the reactors can all bind it.
+    int holder = ::socket(AF_INET6, SOCK_STREAM, 0), on = 1;
+    ::setsockopt(holder, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    ::setsockopt(holder, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    struct sockaddr_in6 addr{};
+    addr.sin6_family = AF_INET6;
+    socklen_t len = sizeof(addr);
+    ::bind(holder, reinterpret_cast<struct sockaddr *>(&addr), len);
+    ::getsockname(holder, reinterpret_cast<struct sockaddr *>(&addr), &len);
+    string port = to_string(ntohs(addr.sin6_port));
+
+    AsyncServer asyncServer{"", port};
+    auto futures = asyncServer.start(reactors);
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+    while (asyncServer.reactorsListening() < reactors && chrono::steady_clock::now() < deadline)
+        this_thread::sleep_for(chrono::milliseconds(10));
+
+    unsigned connections = 16 * reactors, echoed = 0;
+    for (unsigned i = 0; i < connections; ++i)
+        echoed += echoOnce(port);
+    asyncServer.stop();
+    ::close(holder);
+
+    bool everyReactor = true;
+    int served = 0;
+    for (auto &f: futures) {
+        int n = f.get();
+        everyReactor = everyReactor && n > 0;
+        served += max(n, 0);
+    }
+
+    logTo(cout, "echoed ", echoed, " of ", connections, ", served ", served, ", every reactor served: ",
+          everyReactor ? "yes" : "no", '\n');
+    return echoed == connections && served == static_cast<int>(connections) && everyReactor ? 0 : 1;
+}
+
+/**
+ * @brief Check that an acceptor hands connections to worker reactors that serve them.
+ * @param workers The number of workers
+ * @return 0 if the check passed
+ */
+static int checkWorkers(unsigned workers) {
+    AsyncServer asyncServer{"", "0"};
+    if (asyncServer.listen(10, AF_INET6) < 0) {
+        logTo(cerr, "listen error: ", strerror(errno), '\n');
+        return 1;
+    }
+    struct sockaddr_in6 addr{};
+    socklen_t len = sizeof(addr);
+    ::getsockname(asyncServer.fd(), reinterpret_cast<struct sockaddr *>(&addr), &len);
+    string port = to_string(ntohs(addr.sin6_port));
+
+    auto acceptor = asyncServer.startWorkers(workers);
+    unsigned connections = 16 * workers, echoed = 0;
+    for (unsigned i = 0; i < connections; ++i)
+        echoed += echoOnce(port);
+    asyncServer.stop();
+    int served = acceptor.get();
+
+    logTo(cout, "echoed ", echoed, " of ", connections, ", workers served ", served, '\n');
+    return echoed == connections && served == static_cast<int>(connections) ? 0 : 1;
+}
+
+
 int main(int argc, char **argv) {
 
+    if (argc > 2 && string{argv[1]} == "--check")
+        // AsyncNet --check <reactors>
+        return checkReactors(static_cast<unsigned>(stoul(argv[2])));
+
+    if (argc > 2 && string{argv[1]} == "--check-workers")
+        // AsyncNet --check-workers <workers>
+        return checkWorkers(static_cast<unsigned>(stoul(argv[2])));
+
     AsyncServer asyncServer{"", "8000"};
+
+    if (argc > 1 && string{argv[1]} != "-w") {
+        // AsyncNet <reactors> [pin]
+        auto reactors = asyncServer.start(static_cast<unsigned>(stoul(argv[1])), argc > 2);
+        for (auto &f: reactors)
+            logTo(cout, f.get(), '\n');
+        return 0;
+    }
+
     asyncServer.listen(10, AF_INET6);
-    future<int> f = asyncServer.start();
 
-    cout << f.get() << endl;
+    // AsyncNet -w <workers> [pin]
+    future<int> f = argc > 2 ? asyncServer.startWorkers(static_cast<unsigned>(stoul(argv[2])), argc > 3)
+                             : asyncServer.start();
+
+    logTo(cout, f.get(), '\n');
 
     return 0;
-}
\ No newline at end of file
+}
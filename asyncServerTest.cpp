@@ -7,6 +7,8 @@
 #include <iomanip>
 #include <future>
 #include <chrono>
+#include <array>
+#include <cstddef>
 #include "name_that_type.h"
 #include "server.h"
 #include "iomanip.h"
@@ -14,16 +16,29 @@
 using namespace std;
 using namespace eznet;
 
-int doClient(std::unique_ptr<eznet::Socket>::pointer sock) {
-    int c;
-    while ((c = sock->iostrm().get()) != EOF) {
-        cout.put(c);
+Task doClient(eznet::Socket *sock) {
+    std::array<std::byte, 1024> buffer{};
+    ssize_t n;
+    while ((n = co_await sock->readAsync(buffer)) > 0) {
+        cout.write(reinterpret_cast<const char *>(buffer.data()), n);
     }
 
     cout << "Client " << sock->getPeerName() << " disconnected." << endl;
     sock->close();
+}
 
-    return 0;
+
+Task doAccept(Server<> &server, std::unique_ptr<eznet::Socket> &listener) {
+    for (;;) {
+        eznet::Socket *client = co_await server.acceptAsync(listener);
+        if (client) {
+            cout << "New connection " << client->getPeerName() << endl;
+            doClient(client);
+        } else {
+            cerr << "Accept error: " << strerror(errno) << endl;
+            co_await server.sleepFor(chrono::milliseconds(100));
+        }
+    }
 }
 
 int main(int argc, char ** argv) {
@@ -33,6 +48,7 @@ int main(int argc, char ** argv) {
 
     // Make a socket to bind to any address at port 8000 and add it to the server
     auto serverListen = server.push_front(make_unique<Socket>("", "8000"));
+    (*serverListen)->selectClients = SC_Read;
 
     // Listen to IPV6 which will also listen to IPV4
     if ((*serverListen)->listen(10, AF_INET6) < 0) {
@@ -42,9 +58,11 @@ int main(int argc, char ** argv) {
 
     cout << "Server connection " << (*serverListen)->getPeerName() << endl;
 
-    bool run = true;
+    // The listener is selected while doAccept waits on it, and each client while doClient waits on it.
+    (*serverListen)->selectClients = SC_None;
+    doAccept(server, *serverListen);
 
-    while (run) {
+    while (true) {
         chrono::seconds timeOut(10);
         int s = server.select(timeOut);
 
@@ -54,20 +72,7 @@ int main(int argc, char ** argv) {
         cerr << "\n" << now << " select => " << s << endl;
 
         if (s > 0) {
-            for (auto &&sock: server.sockets) {
-                if (server.isConnectRequest(sock)) {
-                    auto newSock = server.accept(sock);
-                    if ((*newSock)->fd() >= 0) {
-                        cout << "New connection " << (*newSock)->getPeerName() << endl;
-                        (*newSock)->selectClients = SC_None;
-                        run = (*newSock)->setStreamBuffer(make_unique<socket_streambuf>((*newSock)->fd()));
-                        (*newSock)->sock_future = std::async(doClient, (*newSock).get());
-                    }
-                    --s;
-                    if (s == 0)
-                        break;
-                }
-            }
+            server.poll_ready([&](auto &, SelectClients) {});
         }
     }
 
@@ -0,0 +1,112 @@
+//
+// Created by richard on 16/10/26.
+//
+
+#ifndef EZNETWORK_AWAITABLE_H
+#define EZNETWORK_AWAITABLE_H
+
+#include <coroutine>
+#include <exception>
+#include <chrono>
+#include <cerrno>
+#include "socket.h"
+#include "timer_wheel.h"
+
+using namespace std;
+
+namespace eznet {
+
+    /**
+     * @brief The return type of a coroutine run by a Server's event loop.
+     * @details A Task starts at once, runs until its first co_await that has to wait, and is then resumed by
+     * Server::select() or Server::poll_ready() until it finishes, when its frame is freed. Nothing waits
+     * for a Task. As with a std::thread, an exception escaping a Task terminates the program.
+     *
+     * A Task's parameters are copied into its frame, so pass sockets and the server by pointer or reference
+     * and everything else by value.
+     */
+    class Task {
+    public:
+        struct promise_type {
+            Task get_return_object() noexcept { return {}; }
+
+            suspend_never initial_suspend() noexcept { return {}; }
+
+            suspend_never final_suspend() noexcept { return {}; }
+
+            void return_void() noexcept {}
+
+            void unhandled_exception() noexcept { terminate(); }
+        };
+    };
+
+
+    /**
+     * @brief Await a delay on a timer wheel, see Server::sleepFor()
+     */
+    class SleepAwaiter {
+    public:
+        SleepAwaiter(TimerWheel &wheel, chrono::milliseconds delay) : wheel{wheel}, delay{delay}, timer{} {}
+
+        bool await_ready() const { return delay.count() <= 0; }
+
+        void await_suspend(coroutine_handle<> h) {
+            wheel.schedule(timer, delay, [h] { h.resume(); });
+        }
+
+        void await_resume() const {}
+
+    protected:
+        TimerWheel &wheel;              ///< The wheel the timer is scheduled on
+        chrono::milliseconds delay;     ///< How long to sleep
+        Timer timer;                    ///< Resumes the coroutine, cancelled if the coroutine is destroyed
+    };
+
+
+    /**
+     * @brief Await a connection on a listen socket, see Server::acceptAsync()
+     * @tparam Server_t The Server type
+     * @tparam SocketPtr The Server's socket pointer type
+     */
+    template <class Server_t, class SocketPtr>
+    class AcceptAwaiter : public SocketAwaiter {
+    public:
+        AcceptAwaiter(Server_t &server, SocketPtr &listener) :
+                server{server}, listener{listener}, result{nullptr}, error{0} {}
+
+        bool await_ready() { return complete(SC_Read); }
+
+        void await_suspend(coroutine_handle<> h) { suspend(*listener, listener->awaiter, h, SC_Read); }
+
+        /**
+         * @return the accepted Socket, owned by the Server, or nullptr with errno set
+         */
+        Socket *await_resume() const {
+            if (!result)
+                errno = error;
+            return result;
+        }
+
+        bool complete(SelectClients) override {
+            auto &accepted = server.acceptAll(listener, 1);
+            if (!accepted.empty()) {
+                result = accepted.front()->get();
+                return true;
+            }
+            error = errno;
+            return error != EAGAIN && error != EWOULDBLOCK;
+        }
+
+        void cancel() override {
+            error = ECANCELED;
+        }
+
+    protected:
+        Server_t &server;           ///< The server accepting the connection
+        SocketPtr &listener;        ///< The listen socket
+        Socket *result;             ///< The accepted socket or nullptr
+        int error;                  ///< The error when result is nullptr
+    };
+}
+
+#endif //EZNETWORK_AWAITABLE_H
@@ -13,12 +13,21 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <list>
+#include <vector>
 #include <utility>
+#include <span>
+#include <cstddef>
+#include <cerrno>
+#include <csignal>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include "resolver.h"
+#include "happy_eyeballs.h"
 
 using namespace std;
 
@@ -44,6 +53,72 @@ namespace async_net {
     };
 
 
+    /**
+     * @brief The outcome of a raw read or write on a socket
+     */
+    enum IoStatus {
+        IoOk,           ///< Bytes were transferred
+        IoWouldBlock,   ///< Nothing could be transferred without blocking
+        IoEof,          ///< The peer has closed its side of the connection, reads only
+        IoError,        ///< The operation failed, see io_result::error
+    };
+
+
+    /**
+     * @brief The result of a raw read or write on a socket
+     */
+    struct io_result {
+        size_t bytes;       ///< The number of bytes transferred
+        IoStatus status;    ///< The outcome
+        int error;          ///< The errno value when status is IoError, otherwise 0
+
+        /**
+         * @brief Determine if bytes were transferred
+         * @return true if status is IoOk
+         */
+        explicit operator bool() const { return status == IoOk; }
+    };
+
+
+    /**
+     * @brief Block SIGPIPE on the calling thread while the guard exists, discarding a SIGPIPE raised meanwhile.
+     * @details For calls that write to a socket and have no MSG_NOSIGNAL flag, such as sendfile(2) and
+     * splice(2), so a peer that has reset the connection makes them fail with EPIPE instead of killing the
+     * process. A SIGPIPE that was already pending is left pending.
+     */
+    class SigPipeGuard {
+    public:
+        SigPipeGuard() : pipeSet{}, saved{}, wasPending{false} {
+            sigset_t pending;
+            sigemptyset(&pipeSet);
+            sigaddset(&pipeSet, SIGPIPE);
+            sigpending(&pending);
+            wasPending = sigismember(&pending, SIGPIPE) == 1;
+            pthread_sigmask(SIG_BLOCK, &pipeSet, &saved);
+        }
+
+        SigPipeGuard(const SigPipeGuard &) = delete;
+
+        SigPipeGuard &operator=(const SigPipeGuard &) = delete;
+
+        ~SigPipeGuard() {
+            int err = errno;
+            sigset_t pending;
+            if (!wasPending && sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE) == 1) {
+                struct timespec zero{};
+                sigtimedwait(&pipeSet, nullptr, &zero);
+            }
+            pthread_sigmask(SIG_SETMASK, &saved, nullptr);
+            errno = err;
+        }
+
+    protected:
+        sigset_t pipeSet;       ///< A set holding SIGPIPE
+        sigset_t saved;         ///< The signal mask to restore
+        bool wasPending;        ///< SIGPIPE was pending before the guard
+    };
+
+
     class basic_socket {
     protected:
         string peer_host,       ///< The user provided peer host name or address.
@@ -62,18 +137,24 @@ namespace async_net {
                 peer_host{std::move(host)},
                 peer_port{std::move(port)},
                 sock_fd{-1},
-                socket_type{SockUnknown},
                 status{0},
                 af_type{AF_UNSPEC},
+                socket_type{SockUnknown},
                 peer_addr{},
                 peer_len{sizeof(peer_addr)} {}
 
     public:
 
-        ~basic_socket() {
+        virtual ~basic_socket() {
             close();
         }
 
+        /**
+         * @brief Called when what the socket should be selected for may have changed, such as when its file
+         * descriptor changes. A Socket uses it to have its Server update the socket's registration.
+         */
+        virtual void selectionChanged() {}
+
         /**
          * @brief Create a socket object to hold an accepted connection.
          */
@@ -84,26 +165,50 @@ namespace async_net {
                 peer_host{},
                 peer_port{},
                 sock_fd{fd},
-                socket_type{SockAccept},
                 status{},
                 af_type{addr->sa_family},
+                socket_type{SockAccept},
                 peer_addr{},
                 peer_len{} {
             memcpy(&peer_addr, addr, len);
             peer_len = len;
         }
 
+        basic_socket(const basic_socket &) = delete;
+
+        /**
+         * @brief (move constructor) Take the file descriptor of another socket, leaving it closed.
+         */
+        basic_socket(basic_socket &&other) noexcept :
+                peer_host{std::move(other.peer_host)},
+                peer_port{std::move(other.peer_port)},
+                sock_fd{exchange(other.sock_fd, -1)},
+                status{other.status},
+                af_type{exchange(other.af_type, AF_UNSPEC)},
+                socket_type{other.socket_type},
+                peer_addr{},
+                peer_len{other.peer_len} {
+            memcpy(&peer_addr, &other.peer_addr, peer_len);
+        }
+
         basic_socket &operator=(const basic_socket &) = delete;
 
+        /**
+         * @brief (move assignment) Close this socket and take the file descriptor of another, leaving it closed.
+         */
         basic_socket &operator=(basic_socket &&other) noexcept {
-            peer_host = std::move(other.peer_host);
-            peer_port = std::move(other.peer_port);
-            sock_fd = other.sock_fd;
-            other.sock_fd = -1;
-            af_type = other.af_type;
-            other.af_type = AF_UNSPEC;
-            peer_len = other.peer_len;
-            memcpy(&peer_addr, &other.peer_addr, peer_len);
+            if (this != &other) {
+                close();
+                peer_host = std::move(other.peer_host);
+                peer_port = std::move(other.peer_port);
+                sock_fd = exchange(other.sock_fd, -1);
+                status = other.status;
+                af_type = exchange(other.af_type, AF_UNSPEC);
+                socket_type = other.socket_type;
+                peer_len = other.peer_len;
+                memcpy(&peer_addr, &other.peer_addr, peer_len);
+            }
+            return *this;
         }
 
         /**
@@ -207,6 +312,112 @@ namespace async_net {
         }
 
 
+        /**
+         * @brief Read from the socket, bypassing any stream buffer
+         * @param buffer Where to put the data
+         * @param flags recv(2) flags, MSG_DONTWAIT makes a single read non-blocking
+         * @return the bytes read, or IoWouldBlock, IoEof or IoError
+         */
+        io_result read(span<byte> buffer, int flags = 0) {
+            ssize_t n;
+            do {
+                n = ::recv(sock_fd, buffer.data(), buffer.size(), flags);
+            } while (n < 0 && errno == EINTR);
+            return ioResult(n, !buffer.empty());
+        }
+
+
+        /**
+         * @brief Write to the socket, bypassing any stream buffer. SIGPIPE is never raised.
+         * @param buffer The data to send
+         * @param flags send(2) flags, MSG_DONTWAIT makes a single write non-blocking
+         * @return the bytes written, which may be fewer than the buffer holds, or IoWouldBlock or IoError
+         */
+        io_result write(span<const byte> buffer, int flags = 0) {
+            ssize_t n;
+            do {
+                n = ::send(sock_fd, buffer.data(), buffer.size(), flags | MSG_NOSIGNAL);
+            } while (n < 0 && errno == EINTR);
+            return ioResult(n, false);
+        }
+
+
+        /**
+         * @brief Scatter read from the socket into several buffers
+         * @param buffers The buffers, filled in order
+         * @param flags recvmsg(2) flags
+         * @return the total bytes read, or IoWouldBlock, IoEof or IoError
+         */
+        io_result readv(span<const iovec> buffers, int flags = 0) {
+            struct msghdr msg{};
+            msg.msg_iov = const_cast<iovec *>(buffers.data());
+            msg.msg_iovlen = buffers.size();
+            return recvmsg(msg, flags);
+        }
+
+
+        /**
+         * @brief Gather write to the socket from several buffers. SIGPIPE is never raised.
+         * @param buffers The buffers, sent in order
+         * @param flags sendmsg(2) flags
+         * @return the total bytes written, which may be fewer than the buffers hold, or IoWouldBlock or IoError
+         */
+        io_result writev(span<const iovec> buffers, int flags = 0) {
+            struct msghdr msg{};
+            msg.msg_iov = const_cast<iovec *>(buffers.data());
+            msg.msg_iovlen = buffers.size();
+            return sendmsg(msg, flags);
+        }
+
+
+        /**
+         * @brief Receive a message, with ancillary data, from the socket
+         * @param msg The message header, as for recvmsg(2); msg_flags and msg_controllen are updated
+         * @param flags recvmsg(2) flags
+         * @return the bytes read, or IoWouldBlock, IoEof or IoError
+         */
+        io_result recvmsg(struct msghdr &msg, int flags = 0) {
+            size_t capacity = 0;
+            for (size_t i = 0; i < msg.msg_iovlen; ++i)
+                capacity += msg.msg_iov[i].iov_len;
+
+            ssize_t n;
+            do {
+                n = ::recvmsg(sock_fd, &msg, flags);
+            } while (n < 0 && errno == EINTR);
+            return ioResult(n, capacity != 0);
+        }
+
+
+        /**
+         * @brief Send a message, with ancillary data, on the socket. SIGPIPE is never raised.
+         * @param msg The message header, as for sendmsg(2)
+         * @param flags sendmsg(2) flags
+         * @return the bytes written, or IoWouldBlock or IoError
+         */
+        io_result sendmsg(const struct msghdr &msg, int flags = 0) {
+            ssize_t n;
+            do {
+                n = ::sendmsg(sock_fd, &msg, flags | MSG_NOSIGNAL);
+            } while (n < 0 && errno == EINTR);
+            return ioResult(n, false);
+        }
+
+
+        /**
+         * @brief Get the host name or address the socket was created to connect or bind to
+         * @return the host, empty for an accepted connection
+         */
+        const string &host() const { return peer_host; }
+
+
+        /**
+         * @brief Get the port number or service name the socket was created to connect or bind to
+         * @return the port, empty for an accepted connection
+         */
+        const string &port() const { return peer_port; }
+
+
         /**
          * @brief Get the type of the socket
          * @return A SocketType value
@@ -234,17 +445,111 @@ namespace async_net {
          */
         void setStatus(int s) { status = s; }
 
+    protected:
+        /**
+         * @brief Convert a system call return value to an io_result
+         * @param n the return value, errno holds the error when it is negative
+         * @param read true if 0 bytes means the peer has closed the connection
+         * @return the result
+         */
+        static io_result ioResult(ssize_t n, bool read) {
+            if (n > 0)
+                return io_result{static_cast<size_t>(n), IoOk, 0};
+            if (n == 0)
+                return io_result{0, read ? IoEof : IoOk, 0};
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return io_result{0, IoWouldBlock, 0};
+            return io_result{0, IoError, errno};
+        }
+
+        /**
+         * @brief Reuse the object for an accepted connection, as the accepted connection constructor would
+         * @param fd The accepted connection file descriptor
+         * @param addr The peer address
+         * @param len The size of the peer address
+         */
+        void reset(int fd, struct sockaddr *addr, socklen_t len) {
+            peer_host.clear();
+            peer_port.clear();
+            sock_fd = fd;
+            socket_type = SockAccept;
+            status = 0;
+            af_type = addr->sa_family;
+            memcpy(&peer_addr, addr, len);
+            peer_len = len;
+        }
     };
 
     class local_socket : public basic_socket {
     public:
-        local_socket(int fd, struct sockaddr *addr, socklen_t addr_len) : basic_socket(fd, addr, addr_len) {}
+        local_socket(int fd, struct sockaddr *addr, socklen_t addr_len) :
+                basic_socket(fd, addr, addr_len),
+                reuse_port{false},
+                race{} {}
 
         local_socket(const string &host, const string &port) :
-                basic_socket{host, port} {
+                basic_socket{host, port},
+                reuse_port{false},
+                race{} {
+        }
+
+        local_socket(local_socket &&other) noexcept :
+                basic_socket(std::move(other)),
+                reuse_port{other.reuse_port},
+                race{std::move(other.race)} {}
+
+        local_socket &operator=(local_socket &&other) noexcept {
+            if (this != &other) {
+                close();
+                basic_socket::operator=(std::move(other));
+                reuse_port = other.reuse_port;
+                race = std::move(other.race);
+            }
+            return *this;
+        }
+
+        ~local_socket() override {
+            close();
         }
 
 
+        /**
+         * @brief Close the socket and reuse the object for an accepted connection
+         * @param fd The accepted connection file descriptor
+         * @param addr The peer address
+         * @param len The size of the peer address
+         */
+        void reset(int fd, struct sockaddr *addr, socklen_t len) {
+            close();
+            basic_socket::reset(fd, addr, len);
+            reuse_port = false;
+        }
+
+
+        /**
+         * @brief Close a socket, abandoning any connection attempts, and set the internal file descriptor to -1
+         * @return the return value from ::close(2)
+         */
+        int close() {
+            if (race) {
+                race.reset();
+                sock_fd = -1;
+                return 0;
+            }
+            return basic_socket::close();
+        }
+
+
+        /**
+         * @brief Set or clear SO_REUSEPORT on a listen socket.
+         * @param on When true the option is set when the socket is bound by listen().
+         * @details With SO_REUSEPORT several sockets, usually one per thread, may listen to the same
+         * address and port and the kernel distributes incoming connections between them. This must be
+         * called before listen().
+         */
+        void reusePort(bool on) { reuse_port = on; }
+
+
         /**
          * @brief Complete a socket as a connection or client socket
          * @tparam AiFamilyPrefs A template parameter pack for a list of AF families
@@ -263,6 +568,74 @@ namespace async_net {
         }
 
 
+        /**
+         * @brief Start completing a socket as a connection socket without blocking.
+         * @tparam Duration template parameter for duration of timeout
+         * @tparam AiFamilyPrefs A template parameter pack for a list of AF families
+         * @param timeout How long to try to connect before giving up
+         * @param familyPrefs A list of AF family values AF_INET6, AF_INET, AF_UNSPEC
+         * @return 1 if connected, 0 while connecting, -1 on error
+         * @details The addresses of the host are raced as RFC 8305 describes: interleaved by family in the
+         * order of familyPrefs, with a new attempt started every 250 ms until one connects. While connecting
+         * fd() is a file descriptor that is readable whenever connectProgress() should be called; a Server
+         * selects it and calls connectProgress() itself. A host not in AddressCache::global() is resolved on
+         * Resolver::local() without blocking; a host that does not resolve fails like a refused connection.
+         */
+        template<typename Duration, typename... AiFamilyPrefs>
+        int connectAsync(Duration timeout, AiFamilyPrefs... familyPrefs) {
+            list<int> prefsList{};
+            (prefsList.push_back(familyPrefs), ...);
+
+            close();
+            race = make_unique<HappyEyeballs>(peer_host, peer_port, std::move(prefsList),
+                                              HappyEyeballs::clock::now() +
+                                              chrono::duration_cast<HappyEyeballs::clock::duration>(timeout));
+            sock_fd = race->fd();
+            socket_type = SockConnect;
+            selectionChanged();
+            return connectProgress();
+        }
+
+
+        /**
+         * @brief Advance a connection started by connectAsync(), call when fd() is readable.
+         * @return 1 when connected, 0 while connecting, -1 when every address failed or the timeout passed,
+         * errno is set to the reason and the socket is closed. getStatus() is the getaddrinfo(3) error when the
+         * host did not resolve.
+         * @details When connected fd() is the connected socket, in blocking mode as connect() leaves it.
+         */
+        int connectProgress() {
+            if (!race)
+                return sock_fd >= 0 ? 1 : -1;
+
+            int result = race->progress();
+            if (result == 0)
+                return 0;
+
+            resolved_address peer{};
+            int fd = result > 0 ? race->take(peer) : -1;
+            int err = errno;
+            status = race->resolveStatus();
+            race.reset();
+            sock_fd = fd;
+            if (fd >= 0) {
+                memcpy(&peer_addr, &peer.addr, peer.len);
+                peer_len = peer.len;
+                af_type = peer.family;
+            }
+            selectionChanged();
+            errno = err;
+            return result;
+        }
+
+
+        /**
+         * @brief Determine if a connection started by connectAsync() is still in progress
+         * @return true while connecting
+         */
+        bool connecting() const { return race != nullptr; }
+
+
         /**
          * @brief Complet a socket as a listen or server socket
          * @tparam AiFamilyPrefs A template parameter pack for a list of AF families
@@ -290,12 +663,6 @@ namespace async_net {
 
                 socket_type = SockListen;
 
-                /**
-                 * Allow socket reuse.
-                 */
-                int on{1};
-                status = setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, (void *) &on, sizeof(on));
-
                 return std::min(socketFlags(true, socketFlagSet), closeOnExec(closeExec));
             }
 
@@ -304,27 +671,34 @@ namespace async_net {
 
 
     protected:
+        bool reuse_port;        ///< Set SO_REUSEPORT when binding a listen socket
+        unique_ptr<HappyEyeballs> race;     ///< The connection attempts of connectAsync()
+
+        /**
+         * @brief Set the options a listen socket needs before it is bound.
+         * @details Allow socket reuse with SO_REUSEADDR, and SO_REUSEPORT if requested by reusePort().
+         */
+        void bindOptions() {
+            int on{1};
+            status = setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, (void *) &on, sizeof(on));
+            if (reuse_port)
+                status = setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, (void *) &on, sizeof(on));
+        }
+
         /**
          * @brief This method does the bulk of the work to complete realization of a socket.
          * @param bind_connect either ::bind() for a server or ::connect() for a client.
          * @param ai_family_preference the preferred address family AF_INET, AF_INET6 or AF_UNSPEC
+         * @details The host and port are resolved through AddressCache::global(), so only the first
+         * connect() or listen() to a name, or the first after its entry expires, waits for getaddrinfo(3).
+         * Use a Resolver to resolve a name without blocking an event loop.
          */
         void findPeerInfo(int (*bind_connect)(int, const struct sockaddr *, socklen_t),
                           list<int> &ai_family_preference) {
 
-            struct addrinfo hints{};
-            struct addrinfo *peer_info{nullptr};
-            memset(&hints, 0, sizeof(hints));
+            address_list peer_info{};
 
-            hints.ai_flags = AF_UNSPEC;
-            hints.ai_socktype = SOCK_STREAM;
-            hints.ai_flags = AI_PASSIVE;
-
-            if ((status = getaddrinfo((peer_host.length() ? peer_host.c_str() : nullptr),
-                                      peer_port.c_str(), &hints, &peer_info))) {
-                freeaddrinfo(peer_info);
-                peer_info = nullptr;
-                memset(&hints, 0, sizeof(hints));
+            if ((status = AddressCache::global().resolve(peer_host, peer_port, AF_UNSPEC, peer_info))) {
                 throw logic_error(string{"getaddrinfo error: "} + gai_strerror(status));
             }
 
@@ -334,28 +708,31 @@ namespace async_net {
             // Loop over preferences
             for (auto pref: ai_family_preference) {
                 // And each discovered connection possibility
-                for (struct addrinfo *peer = peer_info; peer != nullptr; peer = peer->ai_next) {
+                for (auto &peer: peer_info) {
                     // Apply preference
-                    if (pref == AF_UNSPEC || pref == peer->ai_family) {
+                    if (pref == AF_UNSPEC || pref == peer.family) {
 
                         // Create a compatible socket
-                        sock_fd = ::socket(peer->ai_family, peer->ai_socktype, peer->ai_protocol);
+                        sock_fd = ::socket(peer.family, peer.socktype, peer.protocol);
+
+                        if (sock_fd >= 0 && bind_connect == ::bind)
+                            bindOptions();
 
                         /**
                          * Either bind or connect the socket. On error collect the message,
                          * close the socket and set it to error condition. Try the next
                          * connection or return error.
                          */
-                        if (bind_connect(sock_fd, peer->ai_addr, peer->ai_addrlen)) {
+                        if (bind_connect(sock_fd, (struct sockaddr *) &peer.addr, peer.len)) {
                             ::close(sock_fd);
                             sock_fd = -1;
                         } else {
                             /**
                              * Store the selected peer address
                              */
-                            memcpy(&peer_addr, peer->ai_addr, peer->ai_addrlen);
-                            peer_len = peer->ai_addrlen;
-                            af_type = peer->ai_family;
+                            memcpy(&peer_addr, &peer.addr, peer.len);
+                            peer_len = peer.len;
+                            af_type = peer.family;
 
                             break;
                         }
@@ -366,8 +743,7 @@ namespace async_net {
                     break;
             }
 
-            freeaddrinfo(peer_info);
-            peer_info = nullptr;
+            selectionChanged();
         }
 
 
@@ -428,6 +804,37 @@ namespace async_net {
         }
 
 
+        /**
+         * @brief Accept every pending connection request on a listener socket, up to a budget.
+         * @param budget The most connections to accept
+         * @param acceptFlags Socket flags to set on accept see accept4(), such as SOCK_NONBLOCK
+         * @return the accepted connections, empty if there were no connection requests
+         * @details Accepting stops when the listen queue is empty, the budget is spent or accept4(2) fails
+         * for want of resources. The listen socket is non-blocking so this never waits.
+         */
+        template <class Socket_t>
+        vector<unique_ptr<Socket_t>> acceptAll(size_t budget = 64, int acceptFlags = SOCK_CLOEXEC) {
+            if (socketType() != SockListen)
+                throw logic_error("Accept on a non-listening socket.");
+
+            vector<unique_ptr<Socket_t>> accepted{};
+            while (accepted.size() < budget) {
+                struct sockaddr_storage client_addr{};
+                socklen_t length = sizeof(client_addr);
+
+                int clientfd = ::accept4(sock_fd, (struct sockaddr *) &client_addr, &length, acceptFlags);
+                if (clientfd < 0) {
+                    if (errno == EINTR || errno == ECONNABORTED)
+                        continue;
+                    break;
+                }
+                accepted.push_back(std::make_unique<Socket_t>(clientfd, (struct sockaddr *) &client_addr, length));
+            }
+
+            return accepted;
+        }
+
+
     };
 }
 
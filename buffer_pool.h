@@ -0,0 +1,156 @@
+//
+// Created by richard on 16/10/26.
+//
+
+#ifndef EZNETWORK_BUFFER_POOL_H
+#define EZNETWORK_BUFFER_POOL_H
+
+#include <cstddef>
+#include <array>
+
+using namespace std;
+
+namespace async_net {
+
+    /**
+     * @brief A per thread pool of I/O buffers in power of two size classes.
+     * @details Stream buffers check buffers out of the pool of the thread they run on when they need them
+     * and return them when they are empty, so an idle connection holds no buffer memory. Each thread, and so
+     * each reactor, has its own pool and no locks are taken. Free buffers are kept on an intrusive list in
+     * the buffers themselves, so checking a buffer in or out never allocates once the pool is warm.
+     */
+    class BufferPool {
+    public:
+        constexpr static size_t min_shift = 12;         ///< The smallest size class is 4 KiB
+        constexpr static size_t class_count = 6;        ///< Size classes are 4 KiB to 128 KiB
+        constexpr static size_t max_size = size_t{1} << (min_shift + class_count - 1);  ///< The largest class
+
+        /**
+         * @brief Get the pool of the calling thread.
+         * @return the pool, or nullptr while the thread is exiting and its pool has been destroyed.
+         */
+        static BufferPool *local() {
+            thread_local BufferPool pool{};
+            return destroyed() ? nullptr : &pool;
+        }
+
+
+        /**
+         * @brief Check a buffer out of the pool of the calling thread.
+         * @param size The minimum size of the buffer
+         * @return the buffer, its size is classSize(size)
+         */
+        static char *acquire(size_t size) {
+            BufferPool *pool = local();
+            return pool ? pool->get(size) : new char[classSize(size)];
+        }
+
+
+        /**
+         * @brief Check a buffer into the pool of the calling thread.
+         * @param buf The buffer, may be nullptr
+         * @param size The size the buffer was acquired with
+         */
+        static void release(char *buf, size_t size) {
+            if (buf) {
+                BufferPool *pool = local();
+                if (pool)
+                    pool->put(buf, size);
+                else
+                    delete[] buf;
+            }
+        }
+
+
+        /**
+         * @brief Get the size of the class that holds a size
+         * @param size the size
+         * @return the size of buffers of the class
+         */
+        constexpr static size_t classSize(size_t size) {
+            return size_t{1} << (min_shift + classOf(size));
+        }
+
+
+        /**
+         * @brief Set the number of free buffers kept in each size class, beyond which buffers are freed.
+         * @param n the number of buffers
+         */
+        void setMaxCached(size_t n) { max_cached = n; }
+
+        size_t outstanding() const { return checked_out; }  ///< The number of buffers checked out of this pool
+
+        size_t cached() const {                             ///< The number of free buffers held by this pool
+            size_t n = 0;
+            for (auto c: free_count)
+                n += c;
+            return n;
+        }
+
+        BufferPool(const BufferPool &) = delete;
+
+        BufferPool &operator=(const BufferPool &) = delete;
+
+        ~BufferPool() {
+            for (auto head: free_list) {
+                while (head) {
+                    Free *next = head->next;
+                    delete[] reinterpret_cast<char *>(head);
+                    head = next;
+                }
+            }
+            destroyed() = true;
+        }
+
+    protected:
+        struct Free {
+            Free *next;     ///< The next free buffer of the same class
+        };
+
+        array<Free *, class_count> free_list;      ///< The free buffers of each size class
+        array<size_t, class_count> free_count;     ///< The number of free buffers of each size class
+        size_t max_cached;                          ///< The maximum number of free buffers in a class
+        size_t checked_out;                         ///< The number of buffers checked out
+
+        BufferPool() : free_list{}, free_count{}, max_cached{1024}, checked_out{0} {}
+
+        static bool &destroyed() {
+            thread_local bool flag{false};
+            return flag;
+        }
+
+        constexpr static size_t classOf(size_t size) {
+            size_t c = 0;
+            while (c + 1 < class_count && (size_t{1} << (min_shift + c)) < size)
+                ++c;
+            return c;
+        }
+
+        char *get(size_t size) {
+            size_t c = classOf(size);
+            ++checked_out;
+            if (Free *head = free_list[c]) {
+                free_list[c] = head->next;
+                --free_count[c];
+                return reinterpret_cast<char *>(head);
+            }
+            return new char[classSize(size)];
+        }
+
+        void put(char *buf, size_t size) {
+            size_t c = classOf(size);
+            if (checked_out)
+                --checked_out;
+            if (free_count[c] >= max_cached) {
+                delete[] buf;
+                return;
+            }
+            auto f = reinterpret_cast<Free *>(buf);
+            f->next = free_list[c];
+            free_list[c] = f;
+            ++free_count[c];
+        }
+    };
+}
+
+#endif //EZNETWORK_BUFFER_POOL_H
@@ -0,0 +1,195 @@
+//
+// Created by richard on 16/10/26.
+//
+
+#ifndef EZNETWORK_BYTE_SWAP_H
+#define EZNETWORK_BYTE_SWAP_H
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define EZNETWORK_BYTE_SWAP_X86 1
+#endif
+
+using namespace std;
+
+namespace async_net {
+
+    /**
+     * @brief The unsigned integer type the same size as T, the type its bytes are swapped as.
+     */
+    template <size_t Size>
+    struct swap_word {};
+
+    template <> struct swap_word<1> { using type = uint8_t; };
+    template <> struct swap_word<2> { using type = uint16_t; };
+    template <> struct swap_word<4> { using type = uint32_t; };
+    template <> struct swap_word<8> { using type = uint64_t; };
+
+    /**
+     * @brief True for the types whose byte order can be swapped: integers, enums and floating point
+     * values of one, two, four or eight bytes.
+     */
+    template <typename T>
+    constexpr bool is_byte_swappable_v = (is_arithmetic_v<T> || is_enum_v<T>) &&
+            (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8);
+
+    /**
+     * @brief Reverse the byte order of a value.
+     * @tparam T the type of the value, one of is_byte_swappable_v
+     * @param v the value
+     * @return the value with its bytes reversed
+     */
+    template <typename T>
+    constexpr T byteSwap(T v) noexcept {
+        static_assert(is_byte_swappable_v<T>, "No implementation of byteSwap for type.");
+        using word_t = typename swap_word<sizeof(T)>::type;
+        auto w = bit_cast<word_t>(v);
+        if constexpr (sizeof(T) == 2)
+            w = __builtin_bswap16(w);
+        else if constexpr (sizeof(T) == 4)
+            w = __builtin_bswap32(w);
+        else if constexpr (sizeof(T) == 8)
+            w = __builtin_bswap64(w);
+        return bit_cast<T>(w);
+    }
+
+    /**
+     * @brief The byte swap kernels, each swaps count elements of Size bytes from src to dst.
+     * @details src and dst may be the same to swap in place but must not otherwise overlap. Neither needs
+     * to be aligned. The SIMD kernels reverse the bytes of every element in a register with one pshufb
+     * and finish the tail with the scalar kernel.
+     */
+    template <size_t Size>
+    struct ByteSwapKernels {
+        using word_t = typename swap_word<Size>::type;
+        using kernel_t = void (*)(const void *src, void *dst, size_t count);
+
+        static void scalar(const void *src, void *dst, size_t count) {
+            auto s = static_cast<const char *>(src);
+            auto d = static_cast<char *>(dst);
+            for (size_t i = 0; i < count; ++i) {
+                word_t w;
+                memcpy(&w, s + i * Size, Size);
+                w = byteSwap(w);
+                memcpy(d + i * Size, &w, Size);
+            }
+        }
+
+#ifdef EZNETWORK_BYTE_SWAP_X86
+        /**
+         * @brief Get the pshufb control that reverses each Size byte element of a 16 byte lane.
+         */
+        constexpr static char shuffle(int i) {
+            return static_cast<char>((i / Size) * Size + (Size - 1 - i % Size));
+        }
+
+        __attribute__((target("ssse3")))
+        static void ssse3(const void *src, void *dst, size_t count) {
+            auto s = static_cast<const char *>(src);
+            auto d = static_cast<char *>(dst);
+            size_t bytes = count * Size, i = 0;
+            const __m128i mask = _mm_setr_epi8(shuffle(0), shuffle(1), shuffle(2), shuffle(3),
+                                               shuffle(4), shuffle(5), shuffle(6), shuffle(7),
+                                               shuffle(8), shuffle(9), shuffle(10), shuffle(11),
+                                               shuffle(12), shuffle(13), shuffle(14), shuffle(15));
+            for (; i + 16 <= bytes; i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i), _mm_shuffle_epi8(v, mask));
+            }
+            scalar(s + i, d + i, (bytes - i) / Size);
+        }
+
+        __attribute__((target("avx2")))
+        static void avx2(const void *src, void *dst, size_t count) {
+            auto s = static_cast<const char *>(src);
+            auto d = static_cast<char *>(dst);
+            size_t bytes = count * Size, i = 0;
+            // vpshufb shuffles within each 16 byte lane, so both lanes take the same control.
+            const __m256i mask = _mm256_setr_epi8(shuffle(0), shuffle(1), shuffle(2), shuffle(3),
+                                                  shuffle(4), shuffle(5), shuffle(6), shuffle(7),
+                                                  shuffle(8), shuffle(9), shuffle(10), shuffle(11),
+                                                  shuffle(12), shuffle(13), shuffle(14), shuffle(15),
+                                                  shuffle(0), shuffle(1), shuffle(2), shuffle(3),
+                                                  shuffle(4), shuffle(5), shuffle(6), shuffle(7),
+                                                  shuffle(8), shuffle(9), shuffle(10), shuffle(11),
+                                                  shuffle(12), shuffle(13), shuffle(14), shuffle(15));
+            for (; i + 64 <= bytes; i += 64) {
+                __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+                __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i + 32));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i), _mm256_shuffle_epi8(v0, mask));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i + 32), _mm256_shuffle_epi8(v1, mask));
+            }
+            for (; i + 32 <= bytes; i += 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i), _mm256_shuffle_epi8(v, mask));
+            }
+            scalar(s + i, d + i, (bytes - i) / Size);
+        }
+#endif
+
+        /**
+         * @brief Choose the best kernel the processor supports.
+         */
+        static kernel_t select() {
+#ifdef EZNETWORK_BYTE_SWAP_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return avx2;
+            if (__builtin_cpu_supports("ssse3"))
+                return ssse3;
+#endif
+            return scalar;
+        }
+
+        /**
+         * @brief Get the kernel in use, chosen the first time it is asked for.
+         */
+        static kernel_t kernel() {
+            static const kernel_t chosen = select();
+            return chosen;
+        }
+    };
+
+
+    /**
+     * @brief Get the name of the byte swap kernel chosen for this processor.
+     * @return "avx2", "ssse3" or "scalar"
+     */
+    inline const char *byteSwapKernelName() {
+        auto k = ByteSwapKernels<4>::kernel();
+#ifdef EZNETWORK_BYTE_SWAP_X86
+        if (k == ByteSwapKernels<4>::avx2)
+            return "avx2";
+        if (k == ByteSwapKernels<4>::ssse3)
+            return "ssse3";
+#endif
+        return "scalar";
+    }
+
+
+    /**
+     * @brief Reverse the byte order of each element of an array.
+     * @tparam T the element type, one of is_byte_swappable_v
+     * @param src the elements to swap, need not be aligned for T
+     * @param dst where to put the swapped elements, may be src, need not be aligned for T
+     * @param count the number of elements
+     */
+    template <typename T>
+    void byteSwapRange(const void *src, void *dst, size_t count) {
+        static_assert(is_byte_swappable_v<T>, "No implementation of byteSwapRange for type.");
+        if constexpr (sizeof(T) == 1) {
+            if (src != dst && count)
+                memcpy(dst, src, count);
+        } else if (count) {
+            ByteSwapKernels<sizeof(T)>::kernel()(src, dst, count);
+        }
+    }
+}
+
+#endif //EZNETWORK_BYTE_SWAP_H
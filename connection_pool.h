@@ -0,0 +1,208 @@
+//
+// Created by richard on 16/10/26.
+//
+
+#ifndef EZNETWORK_CONNECTION_POOL_H
+#define EZNETWORK_CONNECTION_POOL_H
+
+#include <map>
+#include <deque>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <utility>
+#include <cerrno>
+#include <sys/socket.h>
+#include "socket.h"
+
+using namespace std;
+
+namespace eznet {
+
+    /**
+     * @brief A pool of connected client Sockets keyed by host and port, so repeated requests to an upstream
+     * reuse a connection instead of paying for name resolution and a TCP handshake each time.
+     * @details checkout() hands out the most recently returned idle connection to the host and port that
+     * is still healthy, or connects a new one. A connection is healthy if a non-blocking MSG_PEEK finds
+     * nothing to read: the peer has not closed it and there is no stray data on it. checkin() returns a
+     * connection for reuse. The pool bounds the idle connections and all connections, idle and checked out,
+     * for each key, and evictIdle() closes connections that have been idle too long.
+     *
+     * A pool is not thread safe, give each reactor its own.
+     * @tparam Socket_t The Socket type, it must be constructible from a host and port string.
+     */
+    template <class Socket_t = Socket>
+    class ConnectionPool {
+    public:
+        using clock = chrono::steady_clock;
+
+        /**
+         * @brief (constructor)
+         * @param maxIdle The most idle connections kept for each host and port
+         * @param maxConnections The most connections, idle and checked out, for each host and port
+         * @param idleTimeout How long a connection may be idle before evictIdle() closes it
+         */
+        explicit ConnectionPool(size_t maxIdle = 8, size_t maxConnections = 64,
+                                clock::duration idleTimeout = chrono::seconds(60)) :
+                pools{},
+                max_idle{maxIdle},
+                max_connections{maxConnections},
+                idle_timeout{idleTimeout},
+                hit_count{0},
+                miss_count{0},
+                eviction_count{0} {}
+
+        ConnectionPool(const ConnectionPool &) = delete;
+
+        ConnectionPool &operator=(const ConnectionPool &) = delete;
+
+
+        /**
+         * @brief Get a connection to a host and port
+         * @param host The host name or address
+         * @param port The port number or service name
+         * @return a connected Socket, or nullptr with errno set if the connection limit has been reached
+         * (EAGAIN) or a new connection failed
+         * @details A new connection is made with a blocking connect() preferring IPv6.
+         */
+        unique_ptr<Socket_t> checkout(const string &host, const string &port) {
+            auto &pool = pools[key_t{host, port}];
+
+            while (!pool.idle.empty()) {
+                unique_ptr<Socket_t> sock = std::move(pool.idle.back().sock);
+                pool.idle.pop_back();
+                if (healthy(*sock)) {
+                    ++hit_count;
+                    return sock;
+                }
+                --pool.count;
+                ++eviction_count;
+            }
+
+            ++miss_count;
+            if (pool.count >= max_connections) {
+                errno = EAGAIN;
+                return nullptr;
+            }
+
+            auto sock = make_unique<Socket_t>(host, port);
+            if (sock->connect(AF_INET6, AF_INET) < 0)
+                return nullptr;
+
+            ++pool.count;
+            return sock;
+        }
+
+
+        /**
+         * @brief Return a connection from checkout() for reuse.
+         * @param sock The connection, it is closed instead if it is closed, has queued output, or the host and
+         * port already have the most idle connections allowed
+         */
+        void checkin(unique_ptr<Socket_t> &&sock) {
+            if (!sock)
+                return;
+
+            auto &pool = pools[key_t{sock->host(), sock->port()}];
+            if (sock->fd() < 0 || sock->outputQueued() || pool.idle.size() >= max_idle) {
+                if (pool.count)
+                    --pool.count;
+                sock.reset();
+                return;
+            }
+
+            pool.idle.push_back(Idle{std::move(sock), clock::now()});
+        }
+
+
+        /**
+         * @brief Discard a connection from checkout() that can not be reused, such as one with a protocol error.
+         * @param sock The connection, it is closed
+         */
+        void discard(unique_ptr<Socket_t> &&sock) {
+            if (!sock)
+                return;
+
+            auto &pool = pools[key_t{sock->host(), sock->port()}];
+            if (pool.count)
+                --pool.count;
+            sock.reset();
+        }
+
+
+        /**
+         * @brief Close the connections that have been idle longer than the idle timeout, call periodically.
+         * @return the number of connections closed
+         */
+        size_t evictIdle() {
+            size_t evicted = 0;
+            auto expired = clock::now() - idle_timeout;
+            for (auto pool = pools.begin(); pool != pools.end();) {
+                auto &idle = pool->second.idle;
+                while (!idle.empty() && idle.front().since <= expired) {
+                    idle.pop_front();
+                    --pool->second.count;
+                    ++evicted;
+                }
+                if (pool->second.count == 0)
+                    pool = pools.erase(pool);
+                else
+                    ++pool;
+            }
+            eviction_count += evicted;
+            return evicted;
+        }
+
+
+        /**
+         * @brief Get the number of idle connections to a host and port
+         * @param host The host name or address
+         * @param port The port number or service name
+         * @return the number of connections
+         */
+        size_t idle(const string &host, const string &port) const {
+            auto pool = pools.find(key_t{host, port});
+            return pool == pools.end() ? 0 : pool->second.idle.size();
+        }
+
+        size_t hits() const { return hit_count; }             ///< Checkouts answered with an idle connection
+        size_t misses() const { return miss_count; }          ///< Checkouts that had to connect, or failed
+        size_t evictions() const { return eviction_count; }   ///< Idle connections closed as unhealthy or expired
+
+    protected:
+        using key_t = pair<string, string>;
+
+        struct Idle {
+            unique_ptr<Socket_t> sock;      ///< The connection
+            clock::time_point since;        ///< When it was returned
+        };
+
+        struct Pool {
+            deque<Idle> idle{};             ///< Idle connections, oldest first
+            size_t count{0};                ///< Idle and checked out connections
+        };
+
+        map<key_t, Pool> pools;             ///< The connections of each host and port
+        size_t max_idle;                    ///< The most idle connections for each key
+        size_t max_connections;             ///< The most connections for each key
+        clock::duration idle_timeout;       ///< How long a connection may stay idle
+        size_t hit_count;                   ///< Checkouts answered from the pool
+        size_t miss_count;                  ///< Checkouts not answered from the pool
+        size_t eviction_count;              ///< Idle connections closed
+
+        /**
+         * @brief Check that an idle connection is still open and has nothing waiting to be read
+         * @param sock the connection
+         * @return true if the connection can be reused
+         */
+        static bool healthy(Socket_t &sock) {
+            if (sock.fd() < 0)
+                return false;
+            char c;
+            ssize_t n = ::recv(sock.fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    };
+}
+
+#endif //EZNETWORK_CONNECTION_POOL_H
@@ -0,0 +1,291 @@
+//
+// Created by richard on 16/10/26.
+//
+
+#ifndef EZNETWORK_EPOLL_SET_H
+#define EZNETWORK_EPOLL_SET_H
+
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include "socket.h"
+
+using namespace std;
+
+namespace eznet {
+
+    /**
+     * @brief A readiness engine using epoll(7) with the same interface as FD_Set.
+     * @details Interest is registered with the kernel once per socket and only updated when the
+     * socket's selectClients value changes, so the cost of select() does not grow with the number of
+     * idle sockets and there is no FD_SETSIZE limit on file descriptor values. The registered state is
+     * kept in the Socket (interestFd, interest) so a new Socket reusing a closed file descriptor is
+     * always registered afresh. A socket whose selectClients includes SC_Edge is registered
+     * edge-triggered, its handler must then read and write until the socket would block.
+     * @tparam SocketContainer The container type holding the sockets
+     * @tparam SocketPtr The pointer type stored in the container
+     */
+    template <class SocketContainer, class SocketPtr>
+    class EPoll_Set {
+    protected:
+        int epfd;                               ///< The epoll file descriptor
+
+        vector<struct epoll_event> events;      ///< Storage for events returned by epoll_wait(2)
+
+        vector<uint32_t> ready;                 ///< The events from the last wait indexed by file descriptor
+
+        vector<int> readyFds;                   ///< The file descriptors set in ready by the last wait
+
+        vector<SocketPtr *> slots;              ///< The container element holding each registered file descriptor
+
+        /**
+         * @brief Convert a SelectClients mask to epoll event flags
+         * @param selectClients the mask
+         * @return the epoll event flags
+         */
+        static uint32_t epollEvents(SelectClients selectClients) {
+            uint32_t e = 0;
+            if (selectClients & SC_Read)
+                e |= EPOLLIN;
+            if (selectClients & SC_Write)
+                e |= EPOLLOUT;
+            if (selectClients & SC_Except)
+                e |= EPOLLPRI;
+            if (selectClients & SC_Edge)
+                e |= EPOLLET;
+            return e;
+        }
+
+        /**
+         * @brief Get the events reported for a file descriptor by the last wait
+         * @param fd the file descriptor
+         * @return the epoll event flags, 0 if none
+         */
+        uint32_t readyEvents(int fd) const {
+            return (fd >= 0 && static_cast<size_t>(fd) < ready.size()) ? ready[fd] : 0;
+        }
+
+    public:
+        EPoll_Set() : epfd{::epoll_create1(EPOLL_CLOEXEC)}, events(64), ready{}, readyFds{}, slots{} {
+            if (epfd < 0)
+                throw runtime_error(string{"epoll_create1 error: "} + strerror(errno));
+        }
+
+        EPoll_Set(const EPoll_Set &) = delete;
+
+        EPoll_Set &operator=(const EPoll_Set &) = delete;
+
+        ~EPoll_Set() {
+            ::close(epfd);
+        }
+
+
+        /**
+         * @brief Forget the results of the last wait.
+         * @details Registrations are persistent so, unlike FD_Set::clear(), nothing has to be rebuilt.
+         */
+        void clear() {
+            for (auto fd: readyFds)
+                ready[fd] = 0;
+            readyFds.clear();
+        }
+
+
+        /**
+         * @brief Given a socket container iterator, set the socket selection criteria
+         * @param sock the iterator
+         */
+        void set(const typename SocketContainer::iterator sock) {
+            set(*sock);
+        }
+
+
+        /**
+         * @brief Given a socket pointer, make the kernel registration match the socket selection criteria
+         * @param sock the pointer
+         * @details epoll_ctl(2) is only called when the socket is new, its file descriptor has changed, or
+         * its selection() has changed since the last call.
+         */
+        void set(SocketPtr &sock) {
+            int fd = sock->fd();
+            if (sock->interestFd >= 0 && sock->interestFd != fd &&
+                static_cast<size_t>(sock->interestFd) < slots.size() && slots[sock->interestFd] == &sock)
+                slots[sock->interestFd] = nullptr;
+            if (fd >= 0) {
+                if (static_cast<size_t>(fd) >= slots.size())
+                    slots.resize(fd + 1, nullptr);
+                slots[fd] = &sock;
+            }
+
+            SelectClients selection = sock->selection();
+            if (sock->interestFd == fd && sock->interest == selection)
+                return;
+
+            struct epoll_event ev{};
+            ev.events = epollEvents(selection);
+            ev.data.fd = fd;
+
+            if (fd >= 0 && sock->interestFd == fd) {
+                if (selection == SC_None) {
+                    ::epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &ev);
+                    sock->interestFd = -1;
+                } else {
+                    ::epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+                }
+            } else if (fd >= 0 && selection != SC_None) {
+                if (::epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) && errno == EEXIST)
+                    ::epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+                sock->interestFd = fd;
+            } else {
+                sock->interestFd = -1;
+            }
+
+            sock->interest = selection;
+        }
+
+
+        /**
+         * @brief Register a file descriptor that is not a socket for read
+         * @param fd the file descriptor
+         */
+        void watch(int fd) {
+            if (static_cast<size_t>(fd) < slots.size())
+                slots[fd] = nullptr;
+
+            struct epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            ::epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        }
+
+
+        /**
+         * @brief Remove the registration of a watched file descriptor
+         * @param fd the file descriptor
+         */
+        void unwatch(int fd) {
+            struct epoll_event ev{};
+            ::epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &ev);
+        }
+
+
+        /**
+         * @brief Test a watched file descriptor for read selection
+         * @param fd the file descriptor
+         * @return true if selected
+         */
+        bool isReady(int fd) { return (readyEvents(fd) & EPOLLIN) != 0; }
+
+
+        /**
+         * @brief Forget a socket that is being removed from the container, the kernel drops the registration on close
+         * @param sock the pointer
+         */
+        void release(SocketPtr &sock) {
+            int fd = sock->interestFd;
+            if (fd >= 0 && static_cast<size_t>(fd) < slots.size() && slots[fd] == &sock)
+                slots[fd] = nullptr;
+            sock->interestFd = -1;
+            sock->interest = SC_None;
+        }
+
+
+        /**
+         * @brief Accept a connection on a listen socket selected for read
+         * @param listener the listen socket
+         * @param addr storage for the peer address
+         * @param len the size of the storage, set to the size of the address
+         * @param flags flags passed to accept4(2)
+         * @return the connection file descriptor or -1 on error
+         */
+        int acceptFd(SocketPtr &listener, struct sockaddr *addr, socklen_t *len, int flags) {
+            return ::accept4(listener->fd(), addr, len, flags);
+        }
+
+
+        /**
+         * @brief Wait for registered sockets to become ready
+         * @param timeout An optional timeout value
+         * @return The number of file descriptors selected.
+         */
+        int select(struct timeval *timeout = nullptr) {
+            int ms = -1;
+            if (timeout)
+                ms = static_cast<int>(timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000);
+
+            int r = ::epoll_wait(epfd, events.data(), static_cast<int>(events.size()), ms);
+
+            for (int i = 0; i < r; ++i) {
+                int fd = events[i].data.fd;
+                if (static_cast<size_t>(fd) >= ready.size())
+                    ready.resize(fd + 1, 0);
+                ready[fd] = events[i].events;
+                readyFds.push_back(fd);
+            }
+
+            if (r == static_cast<int>(events.size()))
+                events.resize(events.size() * 2);
+
+            return r;
+        }
+
+        bool isRead(SocketPtr &s) {         ///< Test for read selection, hang up and error are reported as readable
+            return (s->interest & SC_Read) && (readyEvents(s->fd()) & (EPOLLIN | EPOLLHUP | EPOLLERR));
+        }
+
+        bool isWrite(SocketPtr &s) {        ///< Test for write selection
+            return (s->interest & SC_Write) && (readyEvents(s->fd()) & (EPOLLOUT | EPOLLERR));
+        }
+
+        bool isExcept(SocketPtr &s) {       ///< Test for exception selection
+            return (s->interest & SC_Except) && (readyEvents(s->fd()) & EPOLLPRI);
+        }
+
+        bool isSelected(SocketPtr &s) { return isRead(s) || isWrite(s) || isExcept(s); }    ///< Test for any selection
+
+
+        /**
+         * @brief Get all the selections for a socket
+         * @param s the socket pointer
+         * @return a mask of the SelectClients values selected
+         */
+        SelectClients selected(SocketPtr &s) {
+            return static_cast<SelectClients>((isRead(s) ? SC_Read : SC_None) |
+                                              (isWrite(s) ? SC_Write : SC_None) |
+                                              (isExcept(s) ? SC_Except : SC_None));
+        }
+
+
+        /**
+         * @brief Call a handler for each socket selected by the last wait
+         * @details Only the file descriptors returned by epoll_wait(2) are visited, so the cost is
+         * proportional to the number of ready sockets. Sockets closed by an earlier call to the
+         * handler are skipped.
+         * @tparam Handler a callable with the signature void(SocketPtr &, SelectClients)
+         * @param sockets The socket container, unused
+         * @param handler The handler
+         * @return the number of sockets passed to the handler
+         */
+        template <class Handler>
+        int forEachReady(SocketContainer &, Handler &&handler) {
+            int count = 0;
+            for (size_t i = 0; i < readyFds.size(); ++i) {
+                int fd = readyFds[i];
+                SocketPtr *slot = static_cast<size_t>(fd) < slots.size() ? slots[fd] : nullptr;
+                if (slot && (*slot)->fd() == fd) {
+                    SelectClients s = selected(*slot);
+                    if (s != SC_None) {
+                        ++count;
+                        handler(*slot, s);
+                    }
+                }
+            }
+            return count;
+        }
+
+    };
+}
+
+#endif //EZNETWORK_EPOLL_SET_H
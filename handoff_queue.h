@@ -0,0 +1,174 @@
+//
+// Created by richard on 16/10/26.
+//
+
+#ifndef EZNETWORK_HANDOFF_QUEUE_H
+#define EZNETWORK_HANDOFF_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+using namespace std;
+
+namespace async_net {
+
+    /**
+     * @brief A bounded lock free queue for handing objects, such as accepted sockets, from any number of
+     * producer threads to a single consumer thread.
+     * @details The queue is a ring of cells each carrying a sequence number (D. Vyukov's bounded queue) so
+     * producers only contend on a single atomic position and the consumer never blocks them. The queue
+     * owns an eventfd(2) that becomes readable when the queue goes from empty to not empty; a consumer
+     * running an event loop watches fd() and calls drain() when it is ready, so an idle consumer sleeps
+     * in its readiness engine instead of spinning.
+     * @tparam T The type of object carried, usually a unique_ptr.
+     */
+    template <class T>
+    class HandoffQueue {
+    protected:
+        struct Cell {
+            atomic<size_t> sequence;        ///< The position this cell is ready for
+            T value;                        ///< The object carried
+        };
+
+        const size_t mask;                  ///< Capacity - 1, capacity is a power of two
+        unique_ptr<Cell[]> cells;           ///< The ring of cells
+
+        alignas(64) atomic<size_t> enqueuePos;     ///< The next position producers will claim
+        alignas(64) size_t dequeuePos;             ///< The next position the consumer will take
+        alignas(64) atomic<long> pending;          ///< Claimed and not yet taken positions
+        int event_fd;                              ///< The wake up file descriptor
+
+        /**
+         * @brief Round a requested capacity up to a power of two
+         * @param n the requested capacity
+         * @return the capacity
+         */
+        static size_t capacityFor(size_t n) {
+            size_t c = 2;
+            while (c < n)
+                c <<= 1;
+            return c;
+        }
+
+        /**
+         * @brief Take the object at the head of the queue, if it has been published.
+         * @param value Storage for the object
+         * @return true if an object was taken
+         */
+        bool pop(T &value) {
+            Cell &cell = cells[dequeuePos & mask];
+            if (cell.sequence.load(memory_order_acquire) != dequeuePos + 1)
+                return false;
+
+            value = std::move(cell.value);
+            cell.sequence.store(dequeuePos + mask + 1, memory_order_release);
+            ++dequeuePos;
+            pending.fetch_sub(1, memory_order_acq_rel);
+            return true;
+        }
+
+    public:
+        /**
+         * @brief (constructor)
+         * @param capacity The maximum number of objects in the queue, rounded up to a power of two.
+         */
+        explicit HandoffQueue(size_t capacity = 1024) :
+                mask{capacityFor(capacity) - 1},
+                cells{new Cell[mask + 1]},
+                enqueuePos{0},
+                dequeuePos{0},
+                pending{0},
+                event_fd{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)} {
+            if (event_fd < 0)
+                throw runtime_error(string{"eventfd error: "} + strerror(errno));
+            for (size_t i = 0; i <= mask; ++i)
+                cells[i].sequence.store(i, memory_order_relaxed);
+        }
+
+        HandoffQueue(const HandoffQueue &) = delete;
+
+        HandoffQueue &operator=(const HandoffQueue &) = delete;
+
+        ~HandoffQueue() {
+            ::close(event_fd);
+        }
+
+
+        /**
+         * @brief Get the wake up file descriptor, it is readable when there are objects to drain.
+         * @return the eventfd file descriptor
+         */
+        int fd() const { return event_fd; }
+
+
+        /**
+         * @brief Add an object to the queue, may be called from any thread.
+         * @param value The object, it is only moved from if the push succeeds.
+         * @return false if the queue is full.
+         */
+        bool push(T &&value) {
+            size_t pos = enqueuePos.load(memory_order_relaxed);
+            Cell *cell;
+            for (;;) {
+                cell = &cells[pos & mask];
+                size_t seq = cell->sequence.load(memory_order_acquire);
+                auto dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+                if (dif == 0) {
+                    if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                        break;
+                } else if (dif < 0) {
+                    return false;
+                } else {
+                    pos = enqueuePos.load(memory_order_relaxed);
+                }
+            }
+
+            long was = pending.fetch_add(1, memory_order_acq_rel);
+            cell->value = std::move(value);
+            cell->sequence.store(pos + 1, memory_order_release);
+
+            if (was == 0) {
+                uint64_t one{1};
+                ssize_t r = ::write(event_fd, &one, sizeof(one));
+                (void) r;
+            }
+            return true;
+        }
+
+
+        /**
+         * @brief Take every object from the queue, must only be called from the consumer thread.
+         * @tparam Consumer a callable with the signature void(T &&)
+         * @param consumer Called with each object in the order they were pushed
+         * @return the number of objects taken
+         */
+        template <class Consumer>
+        size_t drain(Consumer &&consumer) {
+            uint64_t count;
+            ssize_t r = ::read(event_fd, &count, sizeof(count));
+            (void) r;
+
+            size_t n = 0;
+            T value{};
+            for (;;) {
+                if (pop(value)) {
+                    consumer(std::move(value));
+                    ++n;
+                } else if (pending.load(memory_order_acquire) > 0) {
+                    // A producer has claimed a cell but not yet published it.
+                    this_thread::yield();
+                } else {
+                    break;
+                }
+            }
+            return n;
+        }
+    };
+}
+
+#endif //EZNETWORK_HANDOFF_QUEUE_H
@@ -0,0 +1,371 @@
+//
+// Created by richard on 16/10/26.
+//
+
+#ifndef EZNETWORK_HAPPY_EYEBALLS_H
+#define EZNETWORK_HAPPY_EYEBALLS_H
+
+#include <list>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "resolver.h"
+
+using namespace std;
+
+namespace async_net {
+
+    /**
+     * @brief Race non-blocking connection attempts to a list of addresses (RFC 8305 Happy Eyeballs).
+     * @details Addresses are interleaved by family, the first family preferred. The first attempt starts
+     * at once and each further attempt starts when an attempt fails or the connection attempt delay
+     * passes without a connection, whichever is sooner. The first attempt to connect wins and the
+     * others are abandoned. The race fails when every attempt has failed or the deadline passes. A race
+     * given a host name first resolves it on Resolver::local() and starts when the addresses arrive.
+     *
+     * The resolution, the attempts and a timer for the next attempt and the deadline are gathered behind one
+     * file descriptor, fd(), which is readable whenever progress() has work to do, so an event loop can drive
+     * the race by selecting fd() for read.
+     */
+    class HappyEyeballs {
+    public:
+        using clock = chrono::steady_clock;
+
+        constexpr static chrono::milliseconds attempt_delay{250};  ///< The recommended connection attempt delay
+
+        /**
+         * @brief Order addresses for a race: grouped by family in the order of the family preferences,
+         * then interleaved, one address of each family in turn.
+         * @param addrs The resolved addresses
+         * @param familyPrefs The preferred families, AF_UNSPEC keeps the resolver's order
+         * @return the ordered addresses
+         */
+        static address_list order(const address_list &addrs, const list<int> &familyPrefs) {
+            vector<int> families{};
+            for (auto pref: familyPrefs)
+                if (pref != AF_UNSPEC)
+                    families.push_back(pref);
+            for (auto &a: addrs)
+                if (find(families.begin(), families.end(), a.family) == families.end())
+                    families.push_back(a.family);
+
+            vector<address_list> byFamily{families.size()};
+            for (auto &a: addrs)
+                byFamily[find(families.begin(), families.end(), a.family) - families.begin()].push_back(a);
+
+            address_list ordered{};
+            for (size_t i = 0; ordered.size() < addrs.size(); ++i)
+                for (auto &group: byFamily)
+                    if (i < group.size())
+                        ordered.push_back(group[i]);
+            return ordered;
+        }
+
+
+        /**
+         * @brief (constructor) Start the race
+         * @param addresses The addresses in the order to try them, see order()
+         * @param deadline When to give up
+         * @param delay The connection attempt delay, RFC 8305 recommends 250 ms and no less than 100 ms
+         */
+        HappyEyeballs(address_list addresses, clock::time_point deadline, chrono::milliseconds delay = attempt_delay) :
+                lookup{},
+                prefs{},
+                watching{false},
+                addrs{std::move(addresses)},
+                next{0},
+                attempts{},
+                deadline{deadline},
+                delay{delay},
+                nextAttempt{clock::now()},
+                epfd{::epoll_create1(EPOLL_CLOEXEC)},
+                timer{::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)},
+                winner{-1},
+                winnerAddr{},
+                error{EHOSTUNREACH} {
+            if (epfd < 0 || timer < 0) {
+                int err = errno;
+                closeAll();
+                throw runtime_error(string{"connect race error: "} + strerror(err));
+            }
+            struct epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.fd = timer;
+            ::epoll_ctl(epfd, EPOLL_CTL_ADD, timer, &ev);
+        }
+
+        /**
+         * @brief (constructor) Resolve a host on the thread's Resolver and race its addresses
+         * @param host The host name or address
+         * @param port The port number or service name
+         * @param familyPrefs The preferred families, see order()
+         * @param deadline When to give up, resolution included
+         * @param delay The connection attempt delay
+         * @details A cached name starts the first attempt at once. A name that does not resolve fails the race
+         * with EHOSTUNREACH, resolveStatus() has the getaddrinfo(3) error.
+         */
+        HappyEyeballs(const string &host, const string &port, list<int> familyPrefs, clock::time_point deadline,
+                      chrono::milliseconds delay = attempt_delay) :
+                HappyEyeballs(address_list{}, deadline, delay) {
+            prefs = std::move(familyPrefs);
+            lookup = make_shared<Lookup>();
+            Resolver::local().resolve(host, port, AF_UNSPEC, [result = lookup](int status, const address_list &a) {
+                result->done = true;
+                result->status = status;
+                result->addrs = a;
+            });
+            if (!lookup->done) {
+                struct epoll_event ev{};
+                ev.events = EPOLLIN;
+                ev.data.fd = Resolver::local().fd();
+                watching = ::epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev) == 0;
+            }
+        }
+
+        HappyEyeballs(const HappyEyeballs &) = delete;
+
+        HappyEyeballs &operator=(const HappyEyeballs &) = delete;
+
+        ~HappyEyeballs() {
+            closeAll();
+        }
+
+
+        /**
+         * @brief Get the file descriptor to select for read
+         * @return the file descriptor
+         */
+        int fd() const { return epfd; }
+
+
+        /**
+         * @brief Advance the race, call when fd() is readable
+         * @return 1 when an attempt has connected, 0 while in progress, -1 on failure with errno set
+         */
+        int progress() {
+            if (winner >= 0)
+                return 1;
+
+            uint64_t expirations;
+            ssize_t r = ::read(timer, &expirations, sizeof(expirations));
+            (void) r;
+
+            if (lookup) {
+                int result = resolve();
+                if (result <= 0)
+                    return result;
+            }
+
+            struct epoll_event events[8];
+            int n = ::epoll_wait(epfd, events, 8, 0);
+            for (int i = 0; i < n && winner < 0; ++i)
+                if (events[i].data.fd != timer)
+                    finish(events[i].data.fd);
+            if (winner >= 0)
+                return 1;
+
+            auto now = clock::now();
+            if (now >= deadline) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+
+            while (winner < 0 && next < addrs.size() && (attempts.empty() || now >= nextAttempt))
+                startAttempt(now);
+            if (winner >= 0)
+                return 1;
+
+            if (attempts.empty()) {
+                errno = error;
+                return -1;
+            }
+
+            armTimer(next < addrs.size() ? min(nextAttempt, deadline) : deadline);
+            return 0;
+        }
+
+
+        /**
+         * @brief Get the result of resolving the host
+         * @return 0 or the getaddrinfo(3) error code
+         */
+        int resolveStatus() const { return lookup ? lookup->status : 0; }
+
+
+        /**
+         * @brief Take the connected socket, which is left in blocking mode
+         * @param addr Set to the address connected to
+         * @return the socket file descriptor, the caller owns it
+         */
+        int take(resolved_address &addr) {
+            int fd = winner;
+            addr = winnerAddr;
+            winner = -1;
+            return fd;
+        }
+
+    protected:
+        struct Attempt {
+            int fd;                     ///< The connecting socket
+            size_t index;               ///< The address being connected to
+        };
+
+        struct Lookup {
+            bool done{false};           ///< True when the resolution has finished
+            int status{0};              ///< The getaddrinfo(3) result
+            address_list addrs{};       ///< The resolved addresses
+        };
+
+        shared_ptr<Lookup> lookup;      ///< The resolution of the host, shared with the Resolver callback
+        list<int> prefs;                ///< The preferred families to order the resolved addresses by
+        bool watching;                  ///< True while epfd watches the Resolver
+        address_list addrs;             ///< The addresses to try, in order
+        size_t next;                    ///< The next address to try
+        vector<Attempt> attempts;       ///< The attempts in progress
+        clock::time_point deadline;     ///< When to give up
+        chrono::milliseconds delay;     ///< The connection attempt delay
+        clock::time_point nextAttempt;  ///< When to start the next attempt
+        int epfd;                       ///< Gathers the attempts and the timer
+        int timer;                      ///< Expires when the next attempt is due or at the deadline
+        int winner;                     ///< The connected socket or -1
+        resolved_address winnerAddr;    ///< The address of the connected socket
+        int error;                      ///< The error of the last failed attempt
+
+        void closeAll() {
+            for (auto &a: attempts)
+                ::close(a.fd);
+            attempts.clear();
+            if (winner >= 0)
+                ::close(winner);
+            if (timer >= 0)
+                ::close(timer);
+            if (epfd >= 0)
+                ::close(epfd);
+            winner = timer = epfd = -1;
+        }
+
+        /**
+         * @brief Run the Resolver's callbacks and take the addresses once the host has resolved
+         * @return 1 when resolved, 0 while resolving with the timer set for the deadline, -1 on failure
+         * with errno set
+         */
+        int resolve() {
+            if (!lookup->done)
+                Resolver::local().complete();
+            if (!lookup->done) {
+                if (clock::now() >= deadline) {
+                    errno = ETIMEDOUT;
+                    return -1;
+                }
+                armTimer(deadline);
+                return 0;
+            }
+            if (watching) {
+                ::epoll_ctl(epfd, EPOLL_CTL_DEL, Resolver::local().fd(), nullptr);
+                watching = false;
+            }
+            if (lookup->status) {
+                errno = error;
+                return -1;
+            }
+            if (next == 0 && addrs.empty())
+                addrs = order(lookup->addrs, prefs);
+            return 1;
+        }
+
+        void armTimer(clock::time_point when) {
+            auto wait = chrono::duration_cast<chrono::nanoseconds>(when - clock::now());
+            if (wait.count() <= 0)
+                wait = chrono::nanoseconds{1};
+            struct itimerspec spec{};
+            spec.it_value.tv_sec = wait.count() / 1000000000;
+            spec.it_value.tv_nsec = wait.count() % 1000000000;
+            ::timerfd_settime(timer, 0, &spec, nullptr);
+        }
+
+        /**
+         * @brief Make the socket of an attempt the winner, abandoning the others
+         * @param attempt the attempt
+         */
+        void win(const Attempt &attempt) {
+            winner = attempt.fd;
+            winnerAddr = addrs[attempt.index];
+            ::fcntl(winner, F_SETFL, ::fcntl(winner, F_GETFL) & ~O_NONBLOCK);
+            ::epoll_ctl(epfd, EPOLL_CTL_DEL, winner, nullptr);
+            for (auto &a: attempts)
+                if (a.fd != winner)
+                    ::close(a.fd);
+            attempts.clear();
+        }
+
+        /**
+         * @brief Start a connection attempt to the next address, the one after is due when the delay has
+         * passed or at once if this one fails
+         * @param now The time
+         */
+        void startAttempt(clock::time_point now) {
+            size_t index = next++;
+            resolved_address &a = addrs[index];
+            nextAttempt = now + delay;
+            int fd = ::socket(a.family, a.socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a.protocol);
+            if (fd < 0) {
+                error = errno;
+                nextAttempt = now;
+                return;
+            }
+
+            if (::connect(fd, (struct sockaddr *) &a.addr, a.len) == 0) {
+                attempts.push_back(Attempt{fd, index});
+                win(attempts.back());
+                return;
+            }
+            if (errno != EINPROGRESS) {
+                error = errno;
+                nextAttempt = now;
+                ::close(fd);
+                return;
+            }
+
+            struct epoll_event ev{};
+            ev.events = EPOLLOUT;
+            ev.data.fd = fd;
+            ::epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+            attempts.push_back(Attempt{fd, index});
+        }
+
+        /**
+         * @brief An attempt's socket is writable, it has connected or failed
+         * @param fd the socket
+         */
+        void finish(int fd) {
+            auto attempt = find_if(attempts.begin(), attempts.end(), [fd](const Attempt &a) { return a.fd == fd; });
+            if (attempt == attempts.end())
+                return;
+
+            int err{0};
+            socklen_t len = sizeof(err);
+            if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len))
+                err = errno;
+
+            if (err == 0) {
+                win(*attempt);
+            } else {
+                error = err;
+                nextAttempt = clock::now();
+                ::close(fd);
+                attempts.erase(attempt);
+            }
+        }
+    };
+}
+
+#endif //EZNETWORK_HAPPY_EYEBALLS_H
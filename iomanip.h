@@ -6,79 +6,158 @@
 #define EZNETWORK_IOMANIP_H
 
 #include <iostream>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iterator>
+#include <ranges>
+#include <string_view>
 #include <arpa/inet.h>
+#include "byte_swap.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace eznet
 {
     /**
-     * @brief A template type safe wrapper around htons and htonl
-     * @tparam T the type of the argument
+     * @brief A template type safe wrapper around htons, htonl and htobe64
+     * @tparam T the type of the argument, an integer, enum or floating point type of 1, 2, 4 or 8 bytes
      * @param v the value of the argument
      * @return the transformed value
      */
     template<typename T>
-    T hton(T v) {
-        if constexpr(std::is_same<T, char>::value) {
+    constexpr T hton(T v) {
+        static_assert(async_net::is_byte_swappable_v<T>, "No implementation of hton for type.");
+        if constexpr (std::endian::native == std::endian::big) {
             return v;
-        }
-        if constexpr(std::is_same<T, uint16_t>::value) {
-            return ::htons(v);
-        } else if constexpr (std::is_same<T, uint32_t>::value) {
-            return ::htonl(v);
         } else {
-            static_assert(std::is_same<std::decay_t<T>, uint32_t>::value, "No implementation of hton for type.");
+            return async_net::byteSwap(v);
         }
     }
 
 
     /**
-     * @brief A template type safe wrapper around ntohs and ntohl
-     * @tparam T the type of the argument
+     * @brief A template type safe wrapper around ntohs, ntohl and be64toh
+     * @tparam T the type of the argument, an integer, enum or floating point type of 1, 2, 4 or 8 bytes
      * @param v the value of the argument
      * @return the transformed value
      */
     template<typename T>
-    T ntoh(T v) {
-        if constexpr(std::is_same<T, char>::value) {
+    constexpr T ntoh(T v) {
+        static_assert(async_net::is_byte_swappable_v<T>, "No implementation of ntoh for type.");
+        if constexpr (std::endian::native == std::endian::big) {
             return v;
-        } else if constexpr(std::is_same<T, uint16_t>::value) {
-            return ::ntohs(v);
-        } else if constexpr (std::is_same<T, uint32_t>::value) {
-            return ::ntohl(v);
         } else {
-            static_assert(std::is_same<T, uint32_t>::value, "No implementation of ntoh for type.");
+            return async_net::byteSwap(v);
+        }
+    }
+
+
+    /**
+     * @brief Transform a contiguous array between host and network format in one pass.
+     * @details Network and host order differ by a byte reversal, or not at all, so the transform is the
+     * same in both directions. The bytes are swapped with the widest SIMD kernel the processor supports.
+     * @tparam T the element type
+     * @param src the elements to transform, need not be aligned for T
+     * @param dst where to put the transformed elements, may be src, need not be aligned for T
+     * @param count the number of elements
+     */
+    template<typename T>
+    void byteOrderRange(const void *src, void *dst, size_t count) {
+        if constexpr (std::endian::native == std::endian::big) {
+            if (src != dst && count)
+                std::memcpy(dst, src, count * sizeof(T));
+        } else {
+            async_net::byteSwapRange<T>(src, dst, count);
         }
     }
 
 
     /**
      * @brief A function to transorm a range from host to network format.
+     * @details A contiguous range of an arithmetic type is transformed in bulk by byteOrderRange().
      * @tparam C The iterator type
      * @param first the beginning of the range
      * @param last the end of the range
      */
     template<class C>
     void Host2Net(C first, C last) {
-        for (auto i = first; i != last; ++i) {
-            auto v = hton(*i);
-            *i = v;
+        using T = std::iter_value_t<C>;
+        if constexpr (std::contiguous_iterator<C> && async_net::is_byte_swappable_v<T>) {
+            T *data = std::to_address(first);
+            byteOrderRange<T>(data, data, static_cast<size_t>(last - first));
+        } else {
+            for (auto i = first; i != last; ++i) {
+                auto v = hton(*i);
+                *i = v;
+            }
         }
     }
 
     /**
      * @brief A function to transorm a range from network to host format.
+     * @details A contiguous range of an arithmetic type is transformed in bulk by byteOrderRange().
      * @tparam C The iterator type
      * @param first the beginning of the range
      * @param last the end of the range
      */
     template<class C>
     void Net2Host(C first, C last) {
-        for (auto i = first; i != last; ++i) {
-            auto v = ntoh(*i);
-            *i = v;
+        using T = std::iter_value_t<C>;
+        if constexpr (std::contiguous_iterator<C> && async_net::is_byte_swappable_v<T>) {
+            T *data = std::to_address(first);
+            byteOrderRange<T>(data, data, static_cast<size_t>(last - first));
+        } else {
+            for (auto i = first; i != last; ++i) {
+                auto v = ntoh(*i);
+                *i = v;
+            }
         }
     }
 
+    /**
+     * @brief Transform a contiguous range, a vector, array or span, from host to network format.
+     * @param range the range
+     */
+    template<std::ranges::contiguous_range R>
+    void Host2Net(R &&range) {
+        Host2Net(std::ranges::begin(range), std::ranges::end(range));
+    }
+
+    /**
+     * @brief Transform a contiguous range, a vector, array or span, from network to host format.
+     * @param range the range
+     */
+    template<std::ranges::contiguous_range R>
+    void Net2Host(R &&range) {
+        Net2Host(std::ranges::begin(range), std::ranges::end(range));
+    }
+
+    /**
+     * @brief Reach the put and get areas of any streambuf.
+     * @details The pointers and the bump functions are protected members of std::streambuf. A pointer to
+     * them named through this derived class may be applied to any streambuf, so a transfer can convert
+     * its data straight into or out of the stream's own buffer rather than copying it through sputn()
+     * or sgetn().
+     */
+    struct stream_buffer_access : std::streambuf {
+        static char *putNext(std::streambuf *sb) { return (sb->*&stream_buffer_access::pptr)(); }
+        static char *putEnd(std::streambuf *sb) { return (sb->*&stream_buffer_access::epptr)(); }
+        static void putBump(std::streambuf *sb, size_t n) { (sb->*&stream_buffer_access::pbump)(static_cast<int>(n)); }
+        static char *getNext(std::streambuf *sb) { return (sb->*&stream_buffer_access::gptr)(); }
+        static char *getEnd(std::streambuf *sb) { return (sb->*&stream_buffer_access::egptr)(); }
+        static void getBump(std::streambuf *sb, size_t n) { (sb->*&stream_buffer_access::gbump)(static_cast<int>(n)); }
+    };
+
+    /**
+     * @brief True when a range is sent and received in bulk: contiguous elements of an arithmetic type.
+     */
+    template<class I>
+    constexpr bool is_bulk_range_v = std::contiguous_iterator<I> &&
+            async_net::is_byte_swappable_v<std::iter_value_t<I>>;
+
 #if 0
     int getPacketDepth() {
         static int packetDepth = std::ios_base::xalloc();
@@ -108,20 +187,72 @@ namespace eznet
     };
 #endif
 
-    struct txval_policy
+    /**
+     * @brief Find the first of a set of characters in a range.
+     * @details Sixteen bytes are compared against every character of the set at once with SSE2, which
+     * every x86-64 processor has, and the tail is compared a byte at a time.
+     * @tparam Cs the characters to find
+     * @param first the beginning of the range
+     * @param last the end of the range
+     * @return the first character found or last
+     */
+    template<char... Cs>
+    const char *findAnyOf(const char *first, const char *last) {
+#ifdef __SSE2__
+        while (last - first >= 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+            __m128i hit = _mm_setzero_si128();
+            ((hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, _mm_set1_epi8(Cs)))), ...);
+            if (int mask = _mm_movemask_epi8(hit))
+                return first + __builtin_ctz(static_cast<unsigned>(mask));
+            first += 16;
+        }
+#endif
+        for (; first != last; ++first)
+            if (((*first == Cs) || ...))
+                break;
+        return first;
+    }
+
+    /**
+     * @brief The framing characters of txval and rxval strings and of txsep and rxsep.
+     * @details A string is sent between STX and ETX, with SO before every STX, ETX or SO in the string.
+     * The characters are fixed when the policy is instantiated, so the searches for them compile to
+     * compares against constants.
+     * @tparam STX_ Start of text
+     * @tparam ETX_ End of text
+     * @tparam SO_ Shift out, the escape
+     * @tparam US_ Unit separator
+     */
+    template <char STX_ = 0x02, char ETX_ = 0x03, char SO_ = 0x0E, char US_ = 0x1f>
+    struct basic_txval_policy
     {
-        static char STX;
-        static char ETX;
-        static char SO;
-        static char US;
+        constexpr static char STX = STX_;
+        constexpr static char ETX = ETX_;
+        constexpr static char SO = SO_;
+        constexpr static char US = US_;
+
+        /**
+         * @brief Find the first character a sender must escape.
+         */
+        static const char *findEscape(const char *first, const char *last) {
+            return findAnyOf<STX, ETX, SO>(first, last);
+        }
+
+        /**
+         * @brief Find the first character a receiver must interpret, the end of text or an escape.
+         */
+        static const char *findControl(const char *first, const char *last) {
+            return findAnyOf<ETX, SO>(first, last);
+        }
     };
 
-    char txval_policy::STX = 0x02;
-    char txval_policy::ETX = 0x03;
-    char txval_policy::SO = 0x0E;
-    char txval_policy::US = 0x1f;
+    /**
+     * @brief The default framing characters, the ASCII control characters of the same names.
+     */
+    using txval_policy = basic_txval_policy<>;
 
-    template <typename T>
+    template <typename T, class Policy = txval_policy>
     struct txval
     {
         union value_union
@@ -135,22 +266,42 @@ namespace eznet
         txval() = delete;
         explicit txval(T t) : tVal{t} {}
 
-        void put(std::ostream &os, const string &str) const {
-            os.put(txval_policy::STX);
-            for (auto c: str) {
-                if (c == txval_policy::STX || c == txval_policy::ETX || c == txval_policy::SO) {
-                    os.put(txval_policy::SO);
-                }
-                os.put(c);
+        /**
+         * @brief Send a string framed by STX and ETX.
+         * @details Runs of characters that need no escape are found with Policy::findEscape() and written
+         * with one sputn() each.
+         */
+        void put(std::ostream &os, std::string_view str) const {
+            std::ostream::sentry ok(os);
+            if (!ok)
+                return;
+
+            auto sb = os.rdbuf();
+            auto fail = [&os] { os.setstate(std::ios_base::badbit); };
+            if (sb->sputc(Policy::STX) == std::char_traits<char>::eof())
+                return fail();
+            const char *first = str.data(), *last = first + str.size();
+            while (first != last) {
+                const char *special = Policy::findEscape(first, last);
+                auto run = static_cast<std::streamsize>(special - first);
+                if (run && sb->sputn(first, run) != run)
+                    return fail();
+                if (special == last)
+                    break;
+                if (sb->sputc(Policy::SO) == std::char_traits<char>::eof() ||
+                    sb->sputc(*special) == std::char_traits<char>::eof())
+                    return fail();
+                first = special + 1;
             }
-            os.put(txval_policy::ETX);
+            if (sb->sputc(Policy::ETX) == std::char_traits<char>::eof())
+                fail();
         }
 
         std::ostream& doXmit(std::ostream &os) const {
-            if constexpr(std::is_same<T, std::string>::value) {
+            if constexpr(std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value) {
                 put(os, tVal);
             } else if constexpr (std::is_same<T,const char *>::value) {
-                put(os, std::string(tVal));
+                put(os, std::string_view(tVal));
             } else {
                 value_union d{};
                 d.value = hton(tVal);
@@ -160,33 +311,77 @@ namespace eznet
         }
     };
 
-    template <typename T>
-    std::ostream& operator<<(std::ostream &os, const txval<T> &x) {
+    template <typename T, class Policy>
+    std::ostream& operator<<(std::ostream &os, const txval<T, Policy> &x) {
         return x.doXmit(os);
     }
 
-    template <class IIT>
+    /**
+     * @brief Transmit a range of values in network order.
+     * @details A contiguous range of an arithmetic type is converted in bulk straight into the put area of
+     * the stream buffer, a chunk at a time through sputn() only when the put area is full. Other ranges
+     * are sent an element at a time.
+     * @tparam IIT The iterator type
+     * @tparam Policy The framing of string elements
+     */
+    template <class IIT, class Policy = txval_policy>
     struct txval_range
     {
         IIT _first, _last;
         txval_range() = delete;
         txval_range(IIT &&first, IIT &&last) : _first(first), _last(last) {}
         std::ostream& doXmit(std::ostream &os) {
-            while (_first != _last) {
-                txval x{*_first};
-                x.doXmit(os);
-                ++_first;
+            if constexpr (is_bulk_range_v<IIT>) {
+                bulkXmit(os);
+            } else {
+                while (_first != _last) {
+                    txval<std::iter_value_t<IIT>, Policy> x{*_first};
+                    x.doXmit(os);
+                    ++_first;
+                }
             }
             return os;
         }
+
+    protected:
+        void bulkXmit(std::ostream &os) {
+            using T = std::iter_value_t<IIT>;
+            std::ostream::sentry ok(os);
+            if (!ok)
+                return;
+
+            auto sb = os.rdbuf();
+            auto src = reinterpret_cast<const char *>(std::to_address(_first));
+            size_t count = static_cast<size_t>(_last - _first);
+            while (count) {
+                size_t room = static_cast<size_t>(stream_buffer_access::putEnd(sb) - stream_buffer_access::putNext(sb)) / sizeof(T);
+                size_t n;
+                if (room) {
+                    n = std::min(room, count);
+                    byteOrderRange<T>(src, stream_buffer_access::putNext(sb), n);
+                    stream_buffer_access::putBump(sb, n * sizeof(T));
+                } else {
+                    char chunk[4096];
+                    n = std::min(sizeof(chunk) / sizeof(T), count);
+                    byteOrderRange<T>(src, chunk, n);
+                    if (sb->sputn(chunk, static_cast<std::streamsize>(n * sizeof(T))) != static_cast<std::streamsize>(n * sizeof(T))) {
+                        os.setstate(std::ios_base::badbit);
+                        break;
+                    }
+                }
+                src += n * sizeof(T);
+                count -= n;
+            }
+            _first = _last;
+        }
     };
 
-    template <class IIT>
-    std::ostream& operator<<(std::ostream &os, eznet::txval_range<IIT>&& x) {
+    template <class IIT, class Policy>
+    std::ostream& operator<<(std::ostream &os, eznet::txval_range<IIT, Policy>&& x) {
         return x.doXmit(os);
     }
 
-    template <typename T>
+    template <typename T, class Policy = txval_policy>
     struct rxval
     {
         union value_union {
@@ -203,65 +398,136 @@ namespace eznet
         explicit rxval(T &t) : tRef{t}, d{} {}
         std::istream& doRecv(std::istream &is) {
             if constexpr(std::is_same<T, std::string>::value) {
-                if (is.get() != txval_policy::STX)
-                    throw logic_error("rxval(std::string&) data does not start with STX");
-
-                int c{};
-                bool escape{};
-                tRef.clear();
-                while ((c = is.get()) != txval_policy::ETX) {
-                    escape = false;
-
-                    if (c == txval_policy::SO)
-                        c = is.get();
-
-                    if (is.eof())
-                        throw logic_error("EOF during rxval(std::string&)");
-
-                    tRef.push_back(c);
-                }
+                get(is);
             } else {
                 is.read(d.buf, sizeof(T));
                 tRef = ntoh(d.value);
             }
             return is;
         }
+
+    protected:
+        /**
+         * @brief Receive a string framed by STX and ETX.
+         * @details Runs of characters between escapes are found in the get area of the stream buffer with
+         * Policy::findControl() and appended to the string in one go. A stream buffer without a get area,
+         * one that only overrides underflow() and uflow(), is read a character at a time.
+         */
+        void get(std::istream &is) {
+            using traits = std::char_traits<char>;
+            std::istream::sentry ok(is, true);
+            if (!ok)
+                return;
+
+            auto sb = is.rdbuf();
+            auto eof = [&is] {
+                is.setstate(std::ios_base::eofbit | std::ios_base::failbit);
+                throw logic_error("EOF during rxval(std::string&)");
+            };
+            int c = sb->sbumpc();
+            if (c != traits::to_int_type(Policy::STX)) {
+                if (c == traits::eof())
+                    is.setstate(std::ios_base::eofbit | std::ios_base::failbit);
+                throw logic_error("rxval(std::string&) data does not start with STX");
+            }
+
+            tRef.clear();
+            for (;;) {
+                const char *first = stream_buffer_access::getNext(sb);
+                const char *last = stream_buffer_access::getEnd(sb);
+                if (first < last) {
+                    const char *control = Policy::findControl(first, last);
+                    tRef.append(first, control);
+                    stream_buffer_access::getBump(sb, static_cast<size_t>(control - first));
+                    if (control == last)
+                        continue;
+                }
+                if ((c = sb->sbumpc()) == traits::eof())
+                    eof();
+                if (c == traits::to_int_type(Policy::ETX))
+                    break;
+                if (c == traits::to_int_type(Policy::SO) && (c = sb->sbumpc()) == traits::eof())
+                    eof();
+                tRef.push_back(traits::to_char_type(c));
+            }
+        }
     };
 
-    template <typename T>
-    std::istream& operator>>(std::istream &is, eznet::rxval<T>&& r) {
+    template <typename T, class Policy>
+    std::istream& operator>>(std::istream &is, eznet::rxval<T, Policy>&& r) {
         return r.doRecv(is);
     }
 
-    template <class OIT>
+    /**
+     * @brief Receive a range of values sent in network order.
+     * @details A contiguous range of an arithmetic type is converted in bulk straight out of the get area
+     * of the stream buffer, and whatever was not yet buffered is read into the range with a single sgetn()
+     * and converted in place. Other ranges are received an element at a time.
+     * @tparam OIT The iterator type
+     * @tparam Policy The framing of string elements
+     */
+    template <class OIT, class Policy = txval_policy>
     struct rxval_range
     {
         OIT _first, _last;
         rxval_range() = delete;
         rxval_range(OIT &&first, OIT &&last) : _first(first), _last(last) {}
         std::istream& doRecv(std::istream &is) {
-            while (_first != _last) {
-                rxval r{*_first};
-                r.doRecv(is);
-                ++_first;
+            if constexpr (is_bulk_range_v<OIT>) {
+                bulkRecv(is);
+            } else {
+                while (_first != _last) {
+                    rxval<std::iter_value_t<OIT>, Policy> r{*_first};
+                    r.doRecv(is);
+                    ++_first;
+                }
             }
             return is;
         }
+
+    protected:
+        void bulkRecv(std::istream &is) {
+            using T = std::iter_value_t<OIT>;
+            std::istream::sentry ok(is, true);
+            if (!ok)
+                return;
+
+            auto sb = is.rdbuf();
+            auto dst = reinterpret_cast<char *>(std::to_address(_first));
+            size_t count = static_cast<size_t>(_last - _first);
+            size_t n = std::min(count, static_cast<size_t>(stream_buffer_access::getEnd(sb) - stream_buffer_access::getNext(sb)) / sizeof(T));
+            if (n) {
+                byteOrderRange<T>(stream_buffer_access::getNext(sb), dst, n);
+                stream_buffer_access::getBump(sb, n * sizeof(T));
+                dst += n * sizeof(T);
+                count -= n;
+            }
+            if (count) {
+                auto want = static_cast<std::streamsize>(count * sizeof(T));
+                auto got = sb->sgetn(dst, want);
+                byteOrderRange<T>(dst, dst, static_cast<size_t>(got) / sizeof(T));
+                if (got != want)
+                    is.setstate(std::ios_base::eofbit | std::ios_base::failbit);
+            }
+            _first = _last;
+        }
     };
 
-    template <class OIT>
-    std::istream& operator>>(std::istream &is, eznet::rxval_range<OIT>&& r) {
+    template <class OIT, class Policy>
+    std::istream& operator>>(std::istream &is, eznet::rxval_range<OIT, Policy>&& r) {
         return r.doRecv(is);
     }
 
 
+    template <class Policy = txval_policy>
     std::ostream& txsep(std::ostream &os) {
-        return os.put(txval_policy::US);
+        return os.put(Policy::US);
     }
 
 
+    template <class Policy = txval_policy>
     std::istream& rxsep(std::istream &is) {
-        if (is.get() != txval_policy::US)
+        if (is.get() != Policy::US)
             throw logic_error("Expecting unit separator");
         return is;
     }
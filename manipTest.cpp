@@ -4,6 +4,11 @@
 
 #include <iostream>
 #include <iomanip>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
 #include "server.h"
 
 #include "iomanip.h"
@@ -11,19 +16,95 @@
 using namespace std;
 using namespace eznet;
 
+/**
+ * @brief A policy with printable framing characters for easier debugging.
+ */
+using debug_policy = basic_txval_policy<'<', '>', '\\', ','>;
+
+/**
+ * @brief An input stream buffer with no get area, it only overrides underflow() and uflow().
+ */
+class unbuffered_source : public std::streambuf {
+public:
+    explicit unbuffered_source(string data) : data{std::move(data)}, next{0} {}
+
+protected:
+    string data;        ///< The characters to give
+    size_t next;        ///< The index of the next character
+
+    int_type underflow() override {
+        return next < data.size() ? traits_type::to_int_type(data[next]) : traits_type::eof();
+    }
+
+    int_type uflow() override {
+        return next < data.size() ? traits_type::to_int_type(data[next++]) : traits_type::eof();
+    }
+};
+
+/**
+ * @brief Swap every length from 0 to 130 elements with one byte swap kernel, from an unaligned source to an
+ * unaligned destination and in place, and compare each element with byteSwap().
+ * @tparam N The element size
+ * @param kernel The kernel to check
+ * @return the number of lengths with a wrong element
+ */
+template<size_t N>
+static int kernelMismatches(typename async_net::ByteSwapKernels<N>::kernel_t kernel) {
+    using word_t = typename async_net::ByteSwapKernels<N>::word_t;
+    int wrong = 0;
+    for (size_t count = 0; count <= 130; ++count) {
+        vector<char> src(count * N + 1), dst(count * N + 1), inPlace(count * N + 1);
+        for (size_t i = 0; i < src.size(); ++i)
+            src[i] = static_cast<char>(i * 7 + 1);
+        inPlace = src;
+        kernel(src.data() + 1, dst.data() + 1, count);
+        kernel(inPlace.data() + 1, inPlace.data() + 1, count);
+
+        bool ok = true;
+        for (size_t i = 0; i < count; ++i) {
+            word_t in, out, swapped;
+            memcpy(&in, src.data() + 1 + i * N, N);
+            memcpy(&out, dst.data() + 1 + i * N, N);
+            memcpy(&swapped, inPlace.data() + 1 + i * N, N);
+            ok = ok && out == async_net::byteSwap(in) && swapped == out;
+        }
+        wrong += !ok;
+    }
+    return wrong;
+}
+
+/**
+ * @brief Check the scalar kernel and each SIMD kernel the processor supports for one element size.
+ * @tparam N The element size
+ * @return the number of kernels that swapped an element wrongly
+ */
+template<size_t N>
+static int kernelsMismatch() {
+    using kernels = async_net::ByteSwapKernels<N>;
+    vector<pair<const char *, typename kernels::kernel_t>> checked{{"scalar", kernels::scalar}};
+#ifdef EZNETWORK_BYTE_SWAP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+        checked.emplace_back("ssse3", kernels::ssse3);
+    if (__builtin_cpu_supports("avx2"))
+        checked.emplace_back("avx2", kernels::avx2);
+#endif
+    int failed = 0;
+    for (auto &[name, kernel]: checked) {
+        int wrong = kernelMismatches<N>(kernel);
+        failed += wrong != 0;
+        cout << "Kernel " << name << ' ' << N << ": " << (wrong ? "MISMATCH" : "ok") << endl;
+    }
+    return failed;
+}
+
 /**
  * @brief A simple test of manipulators for transmitting binary data.
+ * @return non-zero if a value did not round trip
  */
 int main() {
-    /*
-     * Set policy values for easier debugging.
-     */
-    txval_policy::STX = '<';
-    txval_policy::ETX = '>';
-    txval_policy::SO = '\\';
-    txval_policy::US = ',';
-
     std::cout << "Hello, World!" << std::endl;
+    int mismatches = 0;
 
     /*
      * Create two arrays of test data. Choose data that maps to ASCII characters for easy debugging
@@ -57,9 +138,9 @@ int main() {
      */
     stringstream ss;
 
-    ss << txval_range(a16.begin(), a16.end()) << txsep
-       << txval_range(a32.begin(), a32.end()) << txsep
-       << txval("Hello World!");
+    ss << txval_range(a16.begin(), a16.end()) << txsep<debug_policy>
+       << txval_range(a32.begin(), a32.end()) << txsep<debug_policy>
+       << txval<const char *, debug_policy>("Hello <World>!");
 
     /*
      * Display the data in the string stream.
@@ -70,9 +151,9 @@ int main() {
      * Receive the data from the string stream
      */
     string hello;
-    ss >> rxval_range(r16.begin(), r16.end()) >> rxsep
-       >> rxval_range(r32.begin(), r32.end()) >> rxsep
-       >> rxval(hello);
+    ss >> rxval_range(r16.begin(), r16.end()) >> rxsep<debug_policy>
+       >> rxval_range(r32.begin(), r32.end()) >> rxsep<debug_policy>
+       >> rxval<string, debug_policy>(hello);
 
     /*
      * Display the received results.
@@ -89,8 +170,139 @@ int main() {
     }
     cout << endl;
 
-    cout << "String: " << hello << endl;
+    bool same = r16 == a16 && r32 == a32 && hello == "Hello <World>!";
+    mismatches += !same;
+    cout << "String: " << hello << (same ? " ok" : " MISMATCH") << endl;
+
+    /*
+     * Strings are received a character at a time from a stream buffer without a get area.
+     */
+    {
+        string escaped{"STX\x02 ETX\x03 SO\x0e end"}, plain{"plain"}, first, second;
+        stringstream framed;
+        framed << txval(escaped) << txval(plain) << hex << 0x1234;
+        unbuffered_source source{framed.str()};
+        istream in{&source};
+        in >> rxval(first) >> rxval(second);
+        bool ok = first == escaped && second == plain && in.get() == '1';
+
+        unbuffered_source truncated{framed.str().substr(0, 6)};
+        istream cut{&truncated};
+        try {
+            cut >> rxval(first);
+            ok = false;
+        } catch (logic_error &) {
+            ok = ok && cut.eof();
+        }
+        mismatches += !ok;
+        cout << "Unbuffered: " << second << (ok ? " ok" : " MISMATCH") << endl;
+    }
+
+    /*
+     * 64 bit, signed and floating point values round trip as well.
+     */
+    stringstream wide;
+    int64_t i64{-0x0102030405060708}, ri64{};
+    int16_t i16{-2}, ri16{};
+    double dbl{3.14159}, rdbl{};
+    wide << txval(i64) << txval(i16) << txval(dbl);
+    wide >> rxval(ri64) >> rxval(ri16) >> rxval(rdbl);
+    same = ri64 == i64 && ri16 == i16 && rdbl == dbl;
+    mismatches += !same;
+    cout << dec << "Wide: " << ri64 << ' ' << ri16 << ' ' << rdbl << (same ? " ok" : " MISMATCH") << endl;
+
+    /*
+     * Each byte swap kernel the processor supports agrees with byteSwap() at every length around its vector widths.
+     */
+    mismatches += kernelsMismatch<2>() + kernelsMismatch<4>() + kernelsMismatch<8>();
+
+    /*
+     * Time the element at a time loop Host2Net used to run against the bulk conversion.
+     */
+    auto gbps = [](size_t bytes, auto duration) {
+        return static_cast<double>(bytes) / chrono::duration<double, nano>(duration).count();
+    };
+
+    auto timeSwap = [&]<typename T>(const char *name, vector<T> &samples) {
+        constexpr int passes = 20;
+        size_t bytes = samples.size() * sizeof(T) * passes;
+
+        auto start = chrono::steady_clock::now();
+        for (int p = 0; p < passes; ++p)
+            for (auto &v: samples)
+                v = hton(v);
+        auto loop = chrono::steady_clock::now() - start;
+
+        start = chrono::steady_clock::now();
+        for (int p = 0; p < passes; ++p)
+            Host2Net(samples);
+        auto bulk = chrono::steady_clock::now() - start;
+
+        cout << name << fixed << setprecision(2) << " element loop " << gbps(bytes, loop) << " GB/s, bulk "
+             << byteSwapKernelName() << ' ' << gbps(bytes, bulk) << " GB/s" << endl;
+    };
+
+    vector<uint16_t> s16(1 << 20);
+    vector<uint32_t> s32(1 << 20);
+    vector<double> s64(1 << 20);
+    for (size_t i = 0; i < s16.size(); ++i) {
+        s16[i] = static_cast<uint16_t>(i);
+        s32[i] = static_cast<uint32_t>(i);
+        s64[i] = static_cast<double>(i);
+    }
+    timeSwap("uint16_t", s16);
+    timeSwap("uint32_t", s32);
+    timeSwap("double  ", s64);
+
+    /*
+     * Time a range transmitted an element at a time against txval_range and rxval_range.
+     */
+    {
+        stringstream each, bulk;
+        auto start = chrono::steady_clock::now();
+        for (auto v: s32)
+            each << txval(v);
+        auto loop = chrono::steady_clock::now() - start;
+
+        start = chrono::steady_clock::now();
+        bulk << txval_range(s32.cbegin(), s32.cend());
+        bulk >> rxval_range(s32.begin(), s32.end());
+        auto range = chrono::steady_clock::now() - start;
+
+        mismatches += each.str() != bulk.str();
+        cout << "txval   " << " element loop " << gbps(s32.size() * sizeof(uint32_t), loop) << " GB/s, range tx+rx "
+             << gbps(2 * s32.size() * sizeof(uint32_t), range) << " GB/s"
+             << (each.str() == bulk.str() ? "" : " MISMATCH") << endl;
+    }
+
+    /*
+     * Time framing a large text payload with an escape every kilobyte. The second pass reuses the
+     * buffers the first grew, so it times the framing rather than the allocator.
+     */
+    {
+        string text(8 << 20, 'x'), received;
+        for (size_t i = 0; i < text.size(); i += 1024)
+            text[i] = txval_policy::ETX;
+
+        stringstream framed;
+        chrono::steady_clock::duration tx{}, rx{};
+        for (int pass = 0; pass < 2; ++pass) {
+            framed.seekp(0);
+            framed.seekg(0);
+            auto start = chrono::steady_clock::now();
+            framed << txval(string_view(text));
+            tx = chrono::steady_clock::now() - start;
+
+            start = chrono::steady_clock::now();
+            framed >> rxval(received);
+            rx = chrono::steady_clock::now() - start;
+        }
+
+        mismatches += received != text;
+        cout << "string   frame " << gbps(text.size(), tx) << " GB/s, unframe " << gbps(text.size(), rx) << " GB/s"
+             << (received == text ? "" : " MISMATCH") << endl;
+    }
 
-    return 0;
+    return mismatches ? 1 : 0;
 }
 
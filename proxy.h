@@ -0,0 +1,206 @@
+//
+// Created by richard on 16/10/26.
+//
+
+#ifndef EZNETWORK_PROXY_H
+#define EZNETWORK_PROXY_H
+
+#include <memory>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "socket.h"
+
+using namespace std;
+
+namespace eznet {
+
+    /**
+     * @brief Forward a connection to an upstream connection, and back, without copying through user space.
+     * @details Each direction moves data from one socket into a kernel pipe and from the pipe to the other
+     * socket with splice(2). A direction stops reading when its pipe is full and selects the other socket
+     * for write until the pipe drains, so a slow peer only slows its own connection. When one socket reaches
+     * end of file the other socket's writes are shut down once the pipe is empty; when both directions
+     * have finished, or either fails, both sockets are closed.
+     *
+     * Both Sockets must be in a Server. join() makes them non-blocking and sets their ready handlers, so
+     * poll_ready() forwards data for them without calling the application's handler. SIGPIPE is blocked
+     * while splicing, so a peer that has reset the connection closes the proxy instead of the process.
+     */
+    class SpliceProxy {
+    public:
+        /**
+         * @brief Join two connected Sockets.
+         * @param client The accepted connection
+         * @param upstream The connection to forward it to
+         * @param pipeSize The capacity of each pipe, 0 for the system default
+         * @return the proxy, it is also held by the Sockets and freed when both are removed from the Server
+         */
+        static shared_ptr<SpliceProxy> join(Socket &client, Socket &upstream, int pipeSize = 0) {
+            shared_ptr<SpliceProxy> proxy{new SpliceProxy(client, upstream, pipeSize)};
+            client.onReady = [proxy](SelectClients events) { proxy->service(proxy->up, proxy->down, events); };
+            upstream.onReady = [proxy](SelectClients events) { proxy->service(proxy->down, proxy->up, events); };
+            proxy->updateSelection();
+            return proxy;
+        }
+
+        SpliceProxy(const SpliceProxy &) = delete;
+
+        SpliceProxy &operator=(const SpliceProxy &) = delete;
+
+        ~SpliceProxy() {
+            up.closePipe();
+            down.closePipe();
+        }
+
+
+        /**
+         * @brief Close both Sockets, they are removed from the Server by its next select().
+         */
+        void close() {
+            up.from->close();
+            up.to->close();
+        }
+
+
+        /**
+         * @brief Determine if the proxy has finished
+         * @return true when both Sockets are closed
+         */
+        bool closed() { return up.from->fd() < 0 && up.to->fd() < 0; }
+
+    protected:
+        /**
+         * @brief The state of one direction, from one Socket through a pipe to the other.
+         */
+        struct Direction {
+            Socket *from;           ///< The Socket read from
+            Socket *to;             ///< The Socket written to
+            int pipe_r{-1};         ///< The read end of the pipe
+            int pipe_w{-1};         ///< The write end of the pipe
+            size_t capacity{0};     ///< The capacity of the pipe
+            size_t inPipe{0};       ///< The number of bytes in the pipe
+            bool eof{false};        ///< True when from has reached end of file
+            bool shut{false};       ///< True when writes to to have been shut down
+
+            constexpr static int max_rounds = 16;   ///< The most fill and drain rounds for one event
+
+            Direction(Socket &src, Socket &dst, int pipeSize) : from{&src}, to{&dst} {
+                int p[2];
+                if (::pipe2(p, O_NONBLOCK | O_CLOEXEC))
+                    throw runtime_error(string{"pipe error: "} + strerror(errno));
+                pipe_r = p[0];
+                pipe_w = p[1];
+                if (pipeSize > 0)
+                    ::fcntl(pipe_w, F_SETPIPE_SZ, pipeSize);
+                int size = ::fcntl(pipe_w, F_GETPIPE_SZ);
+                capacity = size > 0 ? static_cast<size_t>(size) : 65536;
+            }
+
+            void closePipe() {
+                if (pipe_r >= 0)
+                    ::close(pipe_r);
+                if (pipe_w >= 0)
+                    ::close(pipe_w);
+                pipe_r = pipe_w = -1;
+            }
+
+            bool wantsRead() const { return !eof && inPipe < capacity; }    ///< True if from should be read
+            bool done() const { return shut; }                              ///< True when finished
+
+            /**
+             * @brief Move data from the source into the pipe and from the pipe to the destination until
+             * neither can make progress.
+             * @return -1 on error, 0 otherwise
+             */
+            int pump() {
+                async_net::SigPipeGuard noSignal{};
+                for (int round = 0; round < max_rounds; ++round) {
+                    bool progress = false;
+
+                    if (wantsRead()) {
+                        ssize_t n = ::splice(from->fd(), nullptr, pipe_w, nullptr, capacity - inPipe,
+                                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                        if (n > 0) {
+                            inPipe += n;
+                            progress = true;
+                        } else if (n == 0) {
+                            eof = true;
+                        } else if (errno != EAGAIN && errno != EINTR) {
+                            return -1;
+                        }
+                    }
+
+                    if (inPipe) {
+                        ssize_t n = ::splice(pipe_r, nullptr, to->fd(), nullptr, inPipe,
+                                             SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                        if (n > 0) {
+                            inPipe -= n;
+                            progress = true;
+                        } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                            return -1;
+                        }
+                    }
+
+                    if (eof && !inPipe && !shut) {
+                        to->shutdown(async_net::SHUT_WR);
+                        shut = true;
+                    }
+
+                    if (!progress)
+                        break;
+                }
+                return 0;
+            }
+        };
+
+        Direction up;       ///< From the client to the upstream
+        Direction down;     ///< From the upstream to the client
+
+        SpliceProxy(Socket &client, Socket &upstream, int pipeSize) :
+                up{client, upstream, pipeSize},
+                down{upstream, client, pipeSize} {
+            if (client.socketFlags(true, O_NONBLOCK) || upstream.socketFlags(true, O_NONBLOCK))
+                throw runtime_error(string{"proxy socket error: "} + strerror(errno));
+        }
+
+        /**
+         * @brief Service one of the Sockets
+         * @param out The direction reading from the Socket
+         * @param in The direction writing to the Socket
+         * @param events The Socket's selections
+         */
+        void service(Direction &out, Direction &in, SelectClients events) {
+            if (closed())
+                return;
+
+            if ((events & (SC_Read | SC_Except)) && out.pump() < 0) {
+                close();
+                return;
+            }
+            if ((events & SC_Write) && in.pump() < 0) {
+                close();
+                return;
+            }
+
+            if (up.done() && down.done())
+                close();
+            else
+                updateSelection();
+        }
+
+        /**
+         * @brief Select each Socket for read while its outgoing pipe has room and for write while its
+         * incoming pipe has data.
+         */
+        void updateSelection() {
+            up.from->selectClients = static_cast<SelectClients>((up.wantsRead() ? SC_Read : SC_None) |
+                                                                 (down.inPipe ? SC_Write : SC_None));
+            down.from->selectClients = static_cast<SelectClients>((down.wantsRead() ? SC_Read : SC_None) |
+                                                                   (up.inPipe ? SC_Write : SC_None));
+        }
+    };
+}
+
+#endif //EZNETWORK_PROXY_H
@@ -0,0 +1,375 @@
+//
+// Created by richard on 16/10/26.
+//
+
+#ifndef EZNETWORK_RESOLVER_H
+#define EZNETWORK_RESOLVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include "handoff_queue.h"
+
+using namespace std;
+
+namespace async_net {
+
+    /**
+     * @brief One address returned by name resolution
+     */
+    struct resolved_address {
+        int family;                         ///< The address family
+        int socktype;                       ///< The socket type
+        int protocol;                       ///< The protocol
+        socklen_t len;                      ///< The length of the address
+        struct sockaddr_storage addr;       ///< The address
+    };
+
+    using address_list = vector<resolved_address>;     ///< The addresses a name resolves to, in order of preference
+
+
+    /**
+     * @brief A thread safe cache of resolved names keyed by host, port and address family.
+     * @details getaddrinfo(3) does not report a record's TTL so each entry lives for a fixed time, 30
+     * seconds by default. Failed resolutions are not cached. When the cache is full expired entries are
+     * removed, then the oldest. local_socket consults the global() cache for every connect() and listen().
+     */
+    class AddressCache {
+    public:
+        using clock = chrono::steady_clock;
+
+        /**
+         * @brief Get the process wide cache
+         * @return the cache
+         */
+        static AddressCache &global() {
+            static AddressCache cache{};
+            return cache;
+        }
+
+        AddressCache() : entries{}, ttl{chrono::seconds{30}}, capacity{1024}, hit_count{0}, miss_count{0} {}
+
+        AddressCache(const AddressCache &) = delete;
+
+        AddressCache &operator=(const AddressCache &) = delete;
+
+
+        /**
+         * @brief Set how long resolved names are kept, zero disables caching
+         * @param seconds the time to live
+         */
+        void setTTL(chrono::seconds seconds) {
+            lock_guard<mutex> guard{lock};
+            ttl = seconds;
+        }
+
+
+        /**
+         * @brief Set the maximum number of cached names
+         * @param n the number of names
+         */
+        void setCapacity(size_t n) {
+            lock_guard<mutex> guard{lock};
+            capacity = n;
+        }
+
+
+        /**
+         * @brief Remove every entry
+         */
+        void clear() {
+            lock_guard<mutex> guard{lock};
+            entries.clear();
+        }
+
+        size_t hits() const { return hit_count; }       ///< The number of lookups answered from the cache
+        size_t misses() const { return miss_count; }    ///< The number of lookups that had to resolve
+
+
+        /**
+         * @brief Find an unexpired entry
+         * @param host The host name or address, empty for the any address
+         * @param port The port number or service name
+         * @param family The address family asked for, or AF_UNSPEC
+         * @param addrs Set to the cached addresses if found
+         * @return true if found
+         */
+        bool find(const string &host, const string &port, int family, address_list &addrs) {
+            lock_guard<mutex> guard{lock};
+            auto entry = entries.find(cache_key{host, port, family});
+            if (entry == entries.end() || entry->second.expires <= clock::now()) {
+                ++miss_count;
+                return false;
+            }
+            addrs = entry->second.addrs;
+            ++hit_count;
+            return true;
+        }
+
+
+        /**
+         * @brief Add or replace an entry
+         * @param host The host name or address
+         * @param port The port number or service name
+         * @param family The address family asked for
+         * @param addrs The addresses
+         */
+        void insert(const string &host, const string &port, int family, const address_list &addrs) {
+            lock_guard<mutex> guard{lock};
+            if (ttl.count() <= 0 || capacity == 0)
+                return;
+
+            auto now = clock::now();
+            if (entries.size() >= capacity) {
+                for (auto entry = entries.begin(); entry != entries.end();) {
+                    if (entry->second.expires <= now)
+                        entry = entries.erase(entry);
+                    else
+                        ++entry;
+                }
+            }
+            if (entries.size() >= capacity) {
+                auto oldest = entries.begin();
+                for (auto entry = entries.begin(); entry != entries.end(); ++entry)
+                    if (entry->second.expires < oldest->second.expires)
+                        oldest = entry;
+                entries.erase(oldest);
+            }
+
+            entries[cache_key{host, port, family}] = entry_t{addrs, now + ttl};
+        }
+
+
+        /**
+         * @brief Resolve a name, from the cache if possible, caching the result.
+         * @param host The host name or address, empty for the any address
+         * @param port The port number or service name
+         * @param family The address family asked for, or AF_UNSPEC
+         * @param addrs Set to the addresses
+         * @return 0 on success or a getaddrinfo(3) error code, see gai_strerror(3)
+         */
+        int resolve(const string &host, const string &port, int family, address_list &addrs) {
+            if (find(host, port, family, addrs))
+                return 0;
+
+            int status = getAddresses(host, port, family, addrs);
+            if (status == 0)
+                insert(host, port, family, addrs);
+            return status;
+        }
+
+
+        /**
+         * @brief Resolve a name with getaddrinfo(3), bypassing the cache. This blocks.
+         * @param host The host name or address, empty for the any address
+         * @param port The port number or service name
+         * @param family The address family asked for, or AF_UNSPEC
+         * @param addrs Set to the stream socket addresses
+         * @return 0 on success or a getaddrinfo(3) error code
+         */
+        static int getAddresses(const string &host, const string &port, int family, address_list &addrs) {
+            struct addrinfo hints{};
+            struct addrinfo *peer_info{nullptr};
+
+            hints.ai_family = family;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_flags = AI_PASSIVE;
+
+            addrs.clear();
+            int status = getaddrinfo((host.length() ? host.c_str() : nullptr), port.c_str(), &hints, &peer_info);
+            if (status)
+                return status;
+
+            for (struct addrinfo *peer = peer_info; peer != nullptr; peer = peer->ai_next) {
+                resolved_address a{peer->ai_family, peer->ai_socktype, peer->ai_protocol, peer->ai_addrlen, {}};
+                memcpy(&a.addr, peer->ai_addr, peer->ai_addrlen);
+                addrs.push_back(a);
+            }
+
+            freeaddrinfo(peer_info);
+            return 0;
+        }
+
+    protected:
+        using cache_key = tuple<string, string, int>;
+
+        struct entry_t {
+            address_list addrs;             ///< The resolved addresses
+            clock::time_point expires;      ///< When the entry expires
+        };
+
+        mutex lock;                         ///< Guards the entries and settings
+        map<cache_key, entry_t> entries;        ///< The cached names
+        chrono::seconds ttl;                ///< How long entries live
+        size_t capacity;                    ///< The maximum number of entries
+        atomic<size_t> hit_count;           ///< Lookups answered from the cache
+        atomic<size_t> miss_count;          ///< Lookups not answered from the cache
+    };
+
+
+    /**
+     * @brief Resolve names on a thread of its own and complete them on an event loop.
+     * @details An event loop watches fd() and calls complete() when it is ready; complete() runs the
+     * callback of each finished resolution on the loop's thread. Names found in the cache complete at
+     * once, so a callback may run before resolve() returns. Results are cached, so a callback can call
+     * local_socket::connect() without it blocking on name resolution.
+     *
+     * @code{.cpp}
+     * Resolver resolver{};
+     * server.watch(resolver.fd());
+     * resolver.resolve("backend", "8080", AF_UNSPEC, [&](int status, const address_list &) {
+     *     if (status == 0)
+     *         (*upstream)->connect(AF_INET6, AF_INET);
+     * });
+     * // ... in the loop
+     * if (server.isReady(resolver.fd()))
+     *     resolver.complete();
+     * @endcode
+     */
+    class Resolver {
+    public:
+        using callback_t = function<void(int status, const address_list &addrs)>;  ///< Called with the result
+
+        /**
+         * @brief (constructor) Start the resolver thread
+         * @param addressCache The cache to consult and fill
+         * @param depth The maximum number of finished resolutions waiting for complete()
+         */
+        explicit Resolver(AddressCache &addressCache = AddressCache::global(), size_t depth = 1024) :
+                cache{addressCache},
+                completions{depth},
+                requests{},
+                stopping{false},
+                worker{} {
+            worker = thread{&Resolver::run, this};
+        }
+
+        Resolver(const Resolver &) = delete;
+
+        Resolver &operator=(const Resolver &) = delete;
+
+
+        /**
+         * @brief Get the calling thread's resolver, started on first use, which fills AddressCache::global()
+         * @return the resolver
+         */
+        static Resolver &local() {
+            thread_local Resolver resolver{};
+            return resolver;
+        }
+
+        ~Resolver() {
+            {
+                lock_guard<mutex> guard{lock};
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+
+
+        /**
+         * @brief Get the completion file descriptor, it is readable when complete() has callbacks to run.
+         * @return the file descriptor
+         */
+        int fd() const { return completions.fd(); }
+
+
+        /**
+         * @brief Start resolving a name
+         * @param host The host name or address, empty for the any address
+         * @param port The port number or service name
+         * @param family The address family asked for, or AF_UNSPEC
+         * @param callback Called from complete(), or from resolve() if the name is cached, with 0 or a
+         * getaddrinfo(3) error code and the addresses
+         * @return true if the name was cached and the callback has been called
+         */
+        bool resolve(const string &host, const string &port, int family, callback_t callback) {
+            address_list addrs{};
+            if (cache.find(host, port, family, addrs)) {
+                callback(0, addrs);
+                return true;
+            }
+
+            auto request = make_unique<Request>(Request{host, port, family, std::move(callback), 0, {}});
+            {
+                lock_guard<mutex> guard{lock};
+                requests.push_back(std::move(request));
+            }
+            wake.notify_one();
+            return false;
+        }
+
+
+        /**
+         * @brief Run the callbacks of finished resolutions, call from the event loop when fd() is ready.
+         * @return the number of callbacks run
+         */
+        size_t complete() {
+            return completions.drain([](unique_ptr<Request> &&request) {
+                request->callback(request->status, request->addrs);
+            });
+        }
+
+    protected:
+        struct Request {
+            string host;            ///< The host to resolve
+            string port;            ///< The port to resolve
+            int family;             ///< The address family asked for
+            callback_t callback;    ///< Called with the result
+            int status;             ///< The getaddrinfo(3) result
+            address_list addrs;     ///< The addresses
+        };
+
+        AddressCache &cache;                                ///< The cache consulted and filled
+        HandoffQueue<unique_ptr<Request>> completions;      ///< Finished resolutions
+
+        mutex lock;                                         ///< Guards requests and stopping
+        condition_variable wake;                            ///< Signals the resolver thread
+        deque<unique_ptr<Request>> requests;                ///< Resolutions not yet started
+        atomic_bool stopping;                               ///< True when the resolver thread should exit
+        thread worker;                                      ///< The resolver thread
+
+        /**
+         * @brief The resolver thread
+         */
+        void run() {
+            for (;;) {
+                unique_ptr<Request> request{};
+                {
+                    unique_lock<mutex> guard{lock};
+                    wake.wait(guard, [this] { return stopping || !requests.empty(); });
+                    if (stopping)
+                        return;
+                    request = std::move(requests.front());
+                    requests.pop_front();
+                }
+
+                request->status = AddressCache::getAddresses(request->host, request->port, request->family,
+                                                             request->addrs);
+                if (request->status == 0)
+                    cache.insert(request->host, request->port, request->family, request->addrs);
+
+                while (!completions.push(std::move(request))) {
+                    if (stopping)
+                        return;
+                    this_thread::sleep_for(chrono::milliseconds(1));
+                }
+            }
+        }
+    };
+}
+
+#endif //EZNETWORK_RESOLVER_H
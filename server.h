@@ -6,37 +6,145 @@
 #define EZNETWORK_SERVER_H
 
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <typeinfo>
 #include "socket.h"
+#include "socket_slab.h"
+#include "awaitable.h"
+#include "epoll_set.h"
+#include "uring_set.h"
 
 using namespace std;
 
 namespace eznet {
 
+    /**
+     * @brief A readiness engine using select(2)
+     * @details The selection of each socket is kept in a set of registered file descriptors that set() only
+     * changes for the socket it is given, and each select() copies the registered sets for the call, so a
+     * Server only needs to set() the sockets whose selection has changed.
+     * @tparam SocketContainer The container type holding the sockets
+     * @tparam SocketPtr The pointer type stored in the container
+     */
     template <class SocketContainer, class SocketPtr>
     class FD_Set {
     protected:
-        int n;                          ///< The largest file descriptor set + 1;
+        int n;                          ///< The largest file descriptor registered + 1;
+
+        fd_set rd_interest,             ///< The file descriptors registered for read
+                wr_interest,            ///< The file descriptors registered for write
+                ex_interest;            ///< The file descriptors registered for exception
 
         fd_set rd_set,                  ///< The file descriptor sets for the select call read
                 wr_set,                 ///< The file descriptor sets for the select call write
                 ex_set;                 ///< The file descriptor sets for the select call exception
 
+        vector<SocketPtr *> slots;      ///< The container element holding each registered file descriptor
+
+        /**
+         * @brief Determine if a file descriptor is registered for anything
+         * @param fd the file descriptor
+         * @return true if registered
+         */
+        bool registered(int fd) const {
+            return FD_ISSET(fd, &rd_interest) || FD_ISSET(fd, &wr_interest) || FD_ISSET(fd, &ex_interest);
+        }
+
+        /**
+         * @brief Remove the registration of a file descriptor
+         * @param fd the file descriptor
+         */
+        void unregister(int fd) {
+            FD_CLR(fd, &rd_interest);
+            FD_CLR(fd, &wr_interest);
+            FD_CLR(fd, &ex_interest);
+            if (static_cast<size_t>(fd) < slots.size())
+                slots[fd] = nullptr;
+            while (n > 0 && !registered(n - 1))
+                --n;
+        }
+
+        /**
+         * @brief Test a file descriptor in one of the sets returned by the last select call
+         * @param fd the file descriptor
+         * @param set the set
+         * @return true if selected
+         */
+        bool selectedIn(int fd, const fd_set &set) const { return fd >= 0 && fd < n && FD_ISSET(fd, &set); }
+
     public:
-        FD_Set() : n{0}, rd_set{}, wr_set{}, ex_set{} {
+        FD_Set() : n{0}, rd_interest{}, wr_interest{}, ex_interest{}, rd_set{}, wr_set{}, ex_set{}, slots{} {
+            FD_ZERO(&rd_interest);
+            FD_ZERO(&wr_interest);
+            FD_ZERO(&ex_interest);
             clear();
         }
 
 
         /**
-         * @brief Clear all file descriptor sets.
+         * @brief Forget the results of the last select call.
+         * @details The registered selections are kept.
          */
         void clear() {
-            // Clear the fd_sets
             FD_ZERO(&rd_set);
             FD_ZERO(&wr_set);
             FD_ZERO(&ex_set);
+        }
+
+
+        /**
+         * @brief Select a file descriptor that is not a socket for read until it is unwatched
+         * @param fd the file descriptor
+         */
+        void watch(int fd) {
+            if (static_cast<size_t>(fd) < slots.size())
+                slots[fd] = nullptr;
+            FD_SET(fd, &rd_interest);
+            n = max(n, fd + 1);
+        }
+
+
+        /**
+         * @brief Stop selecting a watched file descriptor
+         * @param fd the file descriptor
+         */
+        void unwatch(int fd) {
+            unregister(fd);
+        }
 
-            n = 0;
+
+        /**
+         * @brief Test a watched file descriptor for read selection
+         * @param fd the file descriptor
+         * @return true if selected
+         */
+        bool isReady(int fd) { return selectedIn(fd, rd_set); }
+
+
+        /**
+         * @brief Forget a socket that is being removed from the container
+         * @param sock the pointer
+         */
+        void release(SocketPtr &sock) {
+            int fd = sock->interestFd;
+            if (fd >= 0 && static_cast<size_t>(fd) < slots.size() && slots[fd] == &sock)
+                unregister(fd);
+            sock->interestFd = -1;
+            sock->interest = SC_None;
+        }
+
+
+        /**
+         * @brief Accept a connection on a listen socket selected for read
+         * @param listener the listen socket
+         * @param addr storage for the peer address
+         * @param len the size of the storage, set to the size of the address
+         * @param flags flags passed to accept4(2)
+         * @return the connection file descriptor or -1 on error
+         */
+        int acceptFd(SocketPtr &listener, struct sockaddr *addr, socklen_t *len, int flags) {
+            return ::accept4(listener->fd(), addr, len, flags);
         }
 
 
@@ -50,39 +158,101 @@ namespace eznet {
 
 
         /**
-         * Given a socket pointer, set the socket selection criteria
+         * Given a socket pointer, make the registered sets match the socket selection criteria
          * @param sock the pointer
          */
         void set(SocketPtr &sock) {
-            if (sock->selectClients != SC_None) {
-                if (sock->selectClients & SC_Read)
-                    FD_SET(sock->fd(), &rd_set);
-                if (sock->selectClients & SC_Write)
-                    FD_SET(sock->fd(), &wr_set);
-                if (sock->selectClients & SC_Except)
-                    FD_SET(sock->fd(), &ex_set);
-                n = max(n, sock->fd() + 1);
-            }
+            int fd = sock->fd();
+            if (sock->interestFd >= 0 && sock->interestFd != fd)
+                release(sock);
+            if (fd < 0)
+                return;
+
+            if (static_cast<size_t>(fd) >= slots.size())
+                slots.resize(fd + 1, nullptr);
+            slots[fd] = &sock;
+
+            SelectClients selection = sock->selection();
+            if (selection & SC_Read)
+                FD_SET(fd, &rd_interest);
+            else
+                FD_CLR(fd, &rd_interest);
+            if (selection & SC_Write)
+                FD_SET(fd, &wr_interest);
+            else
+                FD_CLR(fd, &wr_interest);
+            if (selection & SC_Except)
+                FD_SET(fd, &ex_interest);
+            else
+                FD_CLR(fd, &ex_interest);
+            if (selection & SC_All)
+                n = max(n, fd + 1);
+
+            sock->interestFd = fd;
+            sock->interest = selection;
         }
 
 
         /**
-         * @brief Make the select call
+         * @brief Make the select call on a copy of the registered sets
          * @param timeout An optional timeout value
          * @return The number of file descriptors selected.
          */
         int select(struct timeval *timeout = nullptr) {
+            rd_set = rd_interest;
+            wr_set = wr_interest;
+            ex_set = ex_interest;
             return ::select(n, &rd_set, &wr_set, &ex_set, timeout);
         }
 
-        bool isRead(SocketPtr &s) { return FD_ISSET((*s).fd(), &rd_set); }      ///< Test for read selection
+        bool isRead(SocketPtr &s) { return selectedIn(s->fd(), rd_set); }      ///< Test for read selection
 
-        bool isWrite(SocketPtr &s) { return FD_ISSET((*s).fd(), &wr_set); }     ///< Test for write selection
+        bool isWrite(SocketPtr &s) { return selectedIn(s->fd(), wr_set); }     ///< Test for write selection
 
-        bool isExcept(SocketPtr &s) { return FD_ISSET((*s).fd(), &ex_set); }    ///< Test for exception selection
+        bool isExcept(SocketPtr &s) { return selectedIn(s->fd(), ex_set); }    ///< Test for exception selection
 
         bool isSelected(SocketPtr &s) { return isRead(s) || isWrite(s) || isExcept(s); }    ///< Test for any selection
 
+
+        /**
+         * @brief Get all the selections for a socket
+         * @param s the socket pointer
+         * @return a mask of the SelectClients values selected
+         */
+        SelectClients selected(SocketPtr &s) {
+            return static_cast<SelectClients>((isRead(s) ? SC_Read : SC_None) |
+                                              (isWrite(s) ? SC_Write : SC_None) |
+                                              (isExcept(s) ? SC_Except : SC_None));
+        }
+
+
+        /**
+         * @brief Call a handler for each socket selected by the last select
+         * @details select(2) does not provide a ready list so every registered file descriptor is tested,
+         * without visiting the sockets that are not selected. Sockets closed by an earlier call to the
+         * handler are skipped.
+         * @tparam Handler a callable with the signature void(SocketPtr &, SelectClients)
+         * @param sockets The socket container, unused
+         * @param handler The handler
+         * @return the number of sockets passed to the handler
+         */
+        template <class Handler>
+        int forEachReady(SocketContainer &, Handler &&handler) {
+            int count = 0;
+            int limit = min(n, static_cast<int>(slots.size()));
+            for (int fd = 0; fd < limit; ++fd) {
+                SocketPtr *slot = slots[fd];
+                if (slot && (*slot)->fd() == fd) {
+                    SelectClients s = selected(*slot);
+                    if (s != SC_None) {
+                        ++count;
+                        handler(*slot, s);
+                    }
+                }
+            }
+            return count;
+        }
+
     };
 
 
@@ -91,7 +261,11 @@ namespace eznet {
      * @details A server policy class is used to set library default behavior at compile time.
      *
      * - *acceptFlags* Flags set on all client connections accepted by the server
+     * - *acceptBudget* The most connections acceptAll() takes from a listener for one readiness notification
+     * - *socketPool* The most closed sockets select() keeps for reuse by accept.
      * - *push_front*  A method that provides the same semantics across standard library containers for push_front.
+     * - *push_back*, *erase*, *recycle* and *reclaim* Methods that move sockets between containers.
+     * - *selector_t* The readiness engine used to select sockets, FD_Set uses select(2).
      */
 
     template <class T>
@@ -105,9 +279,17 @@ namespace eznet {
          */
         int acceptFlags = SOCK_CLOEXEC;
 
+        size_t acceptBudget = 64;       ///< The default batch limit for acceptAll()
+
+        bool deferFlush = false;        ///< Defer the flushes of accepted sockets to the server's FlushList
+        bool corkFlush = false;         ///< Cork accepted sockets while flushing output that includes a file
+
+        size_t socketPool = 256;        ///< The most closed sockets kept for reuse by accept, 0 to free them
+
         using socket_ptr_t = T;
         using socket_container_t = std::list<T>;
         using socket_iterator_t = typename socket_container_t::iterator;
+        using selector_t = FD_Set<socket_container_t, socket_ptr_t>;
 
 
         /**
@@ -124,6 +306,18 @@ namespace eznet {
         }
 
 
+        /**
+         * @brief Append a socket to the socket container, and return an iterator to the new socket.
+         * @param sockets The socket container
+         * @param socketPtr A pointer to the new socket
+         * @return An iterator pointing to the new socket in the container.
+         */
+        socket_iterator_t push_back(socket_container_t &sockets, socket_ptr_t socketPtr) {
+            sockets.push_back(std::move(socketPtr));
+            return prev(sockets.end());
+        }
+
+
         /**
          * @brief Provide erase semantics
          * @param sockets The socket container
@@ -133,6 +327,110 @@ namespace eznet {
         socket_iterator_t erase(socket_container_t &sockets, socket_iterator_t itr) {
             return sockets.erase(itr);
         }
+
+
+        /**
+         * @brief Move a socket to a container of sockets kept for reuse, without freeing it
+         * @param sockets The socket container
+         * @param itr An iterator selecting a Socket to move
+         * @param spare The container of sockets kept for reuse
+         * @return The next iterator or end()
+         */
+        socket_iterator_t recycle(socket_container_t &sockets, socket_iterator_t itr, socket_container_t &spare) {
+            auto next = std::next(itr);
+            spare.splice(spare.end(), sockets, itr);
+            return next;
+        }
+
+
+        /**
+         * @brief Move the first socket kept for reuse to the end of a socket container
+         * @param sockets The socket container
+         * @param spare The container of sockets kept for reuse, it must not be empty
+         * @return An iterator pointing to the socket in the container
+         */
+        socket_iterator_t reclaim(socket_container_t &sockets, socket_container_t &spare) {
+            sockets.splice(sockets.end(), spare, spare.begin());
+            return prev(sockets.end());
+        }
+    };
+
+    /**
+     * @brief A server policy that uses epoll(7) as the readiness engine
+     * @details Sockets are registered with the kernel once and only updated when selectClients changes,
+     * and file descriptors are not limited to FD_SETSIZE.
+     */
+
+    template <class T>
+    class EPollServerPolicy : public DefaultServerPolicy<T>
+    {
+    public:
+        using typename DefaultServerPolicy<T>::socket_ptr_t;
+        using typename DefaultServerPolicy<T>::socket_container_t;
+        using typename DefaultServerPolicy<T>::socket_iterator_t;
+        using selector_t = EPoll_Set<socket_container_t, socket_ptr_t>;
+    };
+
+    /**
+     * @brief A server policy that uses io_uring(7) as the readiness engine
+     * @details Listen sockets use a multishot accept and each select() is a single io_uring_enter(2). The
+     * streams of accepted sockets are received for by the engine and their flushes are deferred, so their
+     * output is sent by requests submitted with the next wait.
+     */
+
+    template <class T>
+    class URingServerPolicy : public DefaultServerPolicy<T>
+    {
+    public:
+        using typename DefaultServerPolicy<T>::socket_ptr_t;
+        using typename DefaultServerPolicy<T>::socket_container_t;
+        using typename DefaultServerPolicy<T>::socket_iterator_t;
+        using selector_t = URing_Set<socket_container_t, socket_ptr_t>;
+
+        bool deferFlush = true;         ///< Send the output of accepted sockets with the next wait
+    };
+
+    /**
+     * @brief A server policy that keeps sockets in a SocketSlab instead of a std::list
+     * @details The slab's pages of pointers are walked in order, so select() and the select(2) engine's
+     * scan of the sockets touch contiguous memory rather than a list node per socket. Iterators, including
+     * the one push_front() returns for a listener, stay valid until their socket is erased.
+     * @tparam T The socket pointer type
+     * @tparam Selector The readiness engine template, FD_Set, EPoll_Set or URing_Set
+     */
+
+    template <class T, template <class, class> class Selector = FD_Set>
+    class SlabServerPolicy : public DefaultServerPolicy<T>
+    {
+    public:
+        using socket_ptr_t = T;
+        using socket_container_t = SocketSlab<T>;
+        using socket_iterator_t = typename socket_container_t::iterator;
+        using selector_t = Selector<socket_container_t, socket_ptr_t>;
+
+        socket_iterator_t push_front(socket_container_t &sockets, socket_ptr_t socketPtr) {
+            return sockets.push_front(std::move(socketPtr));
+        }
+
+        socket_iterator_t push_back(socket_container_t &sockets, socket_ptr_t socketPtr) {
+            return sockets.push_back(std::move(socketPtr));
+        }
+
+        socket_iterator_t erase(socket_container_t &sockets, socket_iterator_t itr) {
+            return sockets.erase(itr);
+        }
+
+        socket_iterator_t recycle(socket_container_t &sockets, socket_iterator_t itr, socket_container_t &spare) {
+            spare.push_back(std::move(*itr));
+            return sockets.erase(itr);
+        }
+
+        socket_iterator_t reclaim(socket_container_t &sockets, socket_container_t &spare) {
+            auto last = prev(spare.end());
+            auto itr = sockets.push_back(std::move(*last));
+            spare.erase(last);
+            return itr;
+        }
     };
 
     /**
@@ -172,33 +470,79 @@ namespace eznet {
          * @param selectClients What operations to select the clients on
          * @param timeout A timeout value in a timeval struct or nullptr for no timeout
          * @return the value returned from ::select()
+         * @details Before waiting the output of every stream whose flush was deferred to flushes is sent.
+         * Only the sockets on the interest list, those accepted or added since the last call and those whose
+         * selection may have changed, are visited: closed sockets are removed and the readiness engine is
+         * updated for the rest, so the cost of a call does not depend on the number of unchanged sockets.
          */
         int select(struct timeval *timeout = nullptr) {
             // Move new sockets onto the list.
-            for (auto &&ns: newSockets) {
-                sockets.push_back(std::move(ns));
-            }
+            while (!newSockets.empty())
+                adopt(Policy::reclaim(sockets, newSockets));
+
+            // Send the output of every stream flushed since the last wait.
+            flushes.flush();
+
+            fd_set.clear();
 
-            // Clean sockets
-            auto socket = sockets.begin();
-            while (socket != sockets.end()) {
-                if ((*socket)->fd() < 0) {
-                    socket = Policy::erase(sockets,socket);
-                } else {
-                    ++socket;
+            // Remove closed sockets, keeping plain Sockets for reuse by accept, and update the selection of the rest.
+            for (size_t i = 0; i < interests.changed.size(); ++i) {
+                size_t handle = interests.changed[i];
+                auto socket = socketHandles[handle];
+                (*socket)->interestListed = false;
+                if ((*socket)->fd() < 0)
+                    remove(handle);
+                else
+                    fd_set.set(*socket);
+            }
+            interests.changed.clear();
+
+            // Wait no longer than the next timer expiry.
+            struct timeval timerTimeout{};
+            auto due = timers.nextExpiry();
+            if (due != TimerWheel::clock::time_point::max()) {
+                auto wait = chrono::duration_cast<chrono::microseconds>(due - TimerWheel::clock::now());
+                if (wait.count() < 0)
+                    wait = chrono::microseconds{0};
+                if (!timeout || wait.count() < timeout->tv_sec * 1000000 + timeout->tv_usec) {
+                    timerTimeout.tv_sec = wait.count() / 1000000;
+                    timerTimeout.tv_usec = wait.count() % 1000000;
+                    timeout = &timerTimeout;
                 }
             }
 
-            newSockets.clear();
+            int result = fd_set.select(timeout);
+            timers.advance();
+            return result;
+        }
 
-            fd_set.clear();
 
-            // Select all sockets
-            for (auto &&s: sockets) {
-                fd_set.set(s);
-            }
+        /**
+         * @brief Schedule a timer on the server's timer wheel, replacing its previous schedule.
+         * @tparam Duration A std::chrono duration
+         * @param timer The timer
+         * @param after How long until it expires
+         * @param callback Called once, from select(), when the timer expires
+         * @details select() waits no longer than the next timer expiry and expires the timers that are due
+         * after the readiness engine returns, before poll_ready() is called.
+         */
+        template <typename Duration>
+        void setTimer(Timer &timer, Duration after, Timer::callback_t callback) {
+            timers.schedule(timer, after, std::move(callback));
+        }
+
 
-            return fd_set.select(timeout);
+        /**
+         * @brief Schedule a socket's timer, such as an idle timeout, replacing its previous schedule.
+         * @tparam Duration A std::chrono duration
+         * @param sock The socket
+         * @param after How long until it expires
+         * @param callback Called once, from select(), when the timer expires
+         * @details The timer is cancelled when the socket is closed or destroyed.
+         */
+        template <typename Duration>
+        void setTimer(typename Policy::socket_ptr_t &sock, Duration after, Timer::callback_t callback) {
+            timers.schedule(sock->timer, after, std::move(callback));
         }
 
 
@@ -224,15 +568,65 @@ namespace eznet {
                 struct sockaddr_storage client_addr{};
                 socklen_t length = sizeof(client_addr);
 
-                int clientfd = ::accept4(listener->fd(), (struct sockaddr *) &client_addr, &length, Policy::acceptFlags);
-                newSockets.push_back(std::make_unique<Socket>(clientfd, (struct sockaddr *) &client_addr, length));
-                return newSockets.rbegin();
+                int clientfd = fd_set.acceptFd(listener, (struct sockaddr *) &client_addr, &length, Policy::acceptFlags);
+                return make_reverse_iterator(next(addSocket(clientfd, (struct sockaddr *) &client_addr, length)));
             }
 
             throw logic_error("Accept on a non-listening socket.");
         }
 
 
+        /**
+         * @brief Accept every pending connection request on a listener socket, up to a budget, and add the
+         * accepted connections to the connection list.
+         * @param listener A pointer to the listener socket
+         * @param budget The most connections to accept, 0 for the policy's acceptBudget
+         * @param flags accept4(2) flags, such as SOCK_NONBLOCK, added to the policy's acceptFlags
+         * @return An iterator pointing to each created Socket, empty if there were no connection requests. The
+         * vector is reused by the next call.
+         * @details Accepting stops when the listen queue is empty, the budget is spent or accept4(2) fails
+         * for want of resources, so a burst of connections is taken in a few loop iterations rather than one
+         * per connection. A failed accept does not create a Socket.
+         */
+        const auto &acceptAll(typename Policy::socket_ptr_t &listener, size_t budget = 0, int flags = 0) {
+            if (listener->socketType() != SockListen)
+                throw logic_error("Accept on a non-listening socket.");
+
+            accepted.clear();
+            if (budget == 0)
+                budget = Policy::acceptBudget;
+
+            while (accepted.size() < budget) {
+                struct sockaddr_storage client_addr{};
+                socklen_t length = sizeof(client_addr);
+
+                int clientfd = fd_set.acceptFd(listener, (struct sockaddr *) &client_addr, &length,
+                                               Policy::acceptFlags | flags);
+                if (clientfd < 0) {
+                    if (errno == EINTR || errno == ECONNABORTED)
+                        continue;
+                    break;
+                }
+
+                accepted.push_back(addSocket(clientfd, (struct sockaddr *) &client_addr, length));
+            }
+
+            return accepted;
+        }
+
+
+        /**
+         * @brief Accept every pending connection request on a listener socket, up to a budget.
+         * @param listener An iterator selecting the listener socket
+         * @param budget The most connections to accept, 0 for the policy's acceptBudget
+         * @param flags accept4(2) flags added to the policy's acceptFlags
+         * @return An iterator pointing to each created Socket
+         */
+        const auto &acceptAll(typename Policy::socket_iterator_t &listener, size_t budget = 0, int flags = 0) {
+            return acceptAll(*listener, budget, flags);
+        }
+
+
         /**
          * @brief Determine if a listener socket has been selected due to a connection request
          * @param listener An iterator selecting the listener socket
@@ -320,20 +714,213 @@ namespace eznet {
         bool isSelected(typename Policy::socket_ptr_t &s) { return fd_set.isSelected(s); }
 
 
+        /**
+         * @brief Call a handler for each socket selected by the last call to select()
+         * @details With a readiness engine that reports a ready list, such as EPoll_Set, only the ready
+         * sockets are visited so the cost of each loop iteration does not depend on the number of
+         * connected sockets. The handler may accept new connections and close sockets. Queued output
+         * is drained when a socket becomes writable; the handler only sees SC_Write if the socket's
+         * selectClients asks for it. If draining fails, such as when the peer has reset the connection,
+         * the queued output is dropped and the handler is passed SC_Except, whatever selectClients asks
+         * for, so it can close the socket. A socket with an onReady handler, such as one joined to a
+         * SpliceProxy, is passed to that instead of the handler, and a coroutine suspended on a socket
+         * is resumed instead of calling either once its operation completes. A socket connecting with connectAsync()
+         * is passed to the handler once, with SC_Write when it has connected or SC_Except when it has
+         * failed and been closed. After the handler returns the socket's empty stream buffers are
+         * returned to the buffer pool.
+         * @tparam Handler a callable with the signature void(Policy::socket_ptr_t &, SelectClients)
+         * @param handler The handler, passed each ready socket and a mask of its selections.
+         * @return the number of sockets passed to the handler
+         */
+        template <class Handler>
+        int poll_ready(Handler &&handler) {
+            return fd_set.forEachReady(sockets, [this, &handler](typename Policy::socket_ptr_t &sock, SelectClients events) {
+                if (sock->connecting()) {
+                    if (sock->connectProgress() == 0)
+                        return;
+                    events = sock->fd() >= 0 ? SC_Write : SC_Except;
+                }
+                if ((events & SC_Write) && sock->outputQueued()) {
+                    SelectClients wanted = sock->awaiter ? sock->awaiter->selection : sock->selectClients;
+                    if (sock->drainOutput() < 0) {
+                        sock->discardOutput();
+                        events = static_cast<SelectClients>((events & ~SC_Write) | SC_Except);
+                    } else if (!(wanted & SC_Write)) {
+                        events = static_cast<SelectClients>(events & ~SC_Write);
+                    }
+                }
+                if (events != SC_None) {
+                    if (sock->awaiter) {
+                        if (sock->awaiter->complete(events))
+                            sock->resume();
+                    } else if (sock->onReady)
+                        sock->onReady(events);
+                    else
+                        handler(sock, events);
+                }
+                sock->trimBuffers();
+            });
+        }
+
+
+        /**
+         * @brief Accept a connection in a coroutine: Socket *client = co_await server.acceptAsync(listener)
+         * @param listener A pointer to the listen socket
+         * @return an awaitable giving the accepted Socket, owned by the server, or nullptr with errno set
+         * @details The coroutine is suspended until a connection request arrives and is resumed by
+         * poll_ready(). The accepted socket has selectClients SC_None, so it is only selected while a
+         * coroutine awaits it.
+         */
+        auto acceptAsync(typename Policy::socket_ptr_t &listener) {
+            if (listener->socketType() != SockListen)
+                throw logic_error("Accept on a non-listening socket.");
+            return AcceptAwaiter<Server, typename Policy::socket_ptr_t>{*this, listener};
+        }
+
+
+        /**
+         * @brief Accept a connection in a coroutine.
+         * @param listener An iterator selecting the listen socket
+         * @return an awaitable giving the accepted Socket or nullptr
+         */
+        auto acceptAsync(typename Policy::socket_iterator_t &listener) {
+            return acceptAsync(*listener);
+        }
+
+
+        /**
+         * @brief Suspend a coroutine on the server's timer wheel: co_await server.sleepFor(100ms)
+         * @tparam Duration A std::chrono duration
+         * @param duration How long to sleep, rounded up to whole milliseconds
+         * @return an awaitable resumed by select() once the duration has passed
+         */
+        template <typename Duration>
+        SleepAwaiter sleepFor(Duration duration) {
+            return SleepAwaiter{timers, chrono::ceil<chrono::milliseconds>(duration)};
+        }
+
+
+        /**
+         * @brief Select a file descriptor that is not a socket, such as an eventfd, for read
+         * @param fd the file descriptor
+         * @details Watched file descriptors are selected by every call to select() until they are unwatched
+         * and are never passed to a poll_ready() handler; test them with isReady().
+         */
+        void watch(int fd) { fd_set.watch(fd); }
+
+
+        /**
+         * @brief Stop selecting a watched file descriptor
+         * @param fd the file descriptor
+         */
+        void unwatch(int fd) { fd_set.unwatch(fd); }
+
+
+        /**
+         * @brief Determine if a watched file descriptor is selected for read
+         * @param fd the file descriptor
+         * @return true if selected
+         */
+        bool isReady(int fd) { return fd_set.isReady(fd); }
+
+
         /**
          * @brief Move a new socket into the front of the socket container, the container takes ownership of the socket
          * @param socketPtr A pointer to the socket to move.
          * @return An iterator pointing to the socket pointer in the container
          */
         auto push_front(typename Policy::socket_ptr_t socketPtr) {
-            return Policy::push_front(sockets, std::move(socketPtr));
+            return adopt(Policy::push_front(sockets, std::move(socketPtr)));
         }
 
+        TimerWheel timers;                                    ///< Timers expired by select(), outlives the sockets
+
+        FlushList flushes;                                    ///< Deferred flushes sent by select(), outlives the sockets
+
+        InterestList interests;                               ///< Sockets select() must update, outlives the sockets
+
         typename Policy::socket_container_t sockets;          ///< A list of accepted connection sockets
 
+        /**
+         * @brief Get the number of Sockets accept has allocated
+         * @return the number of Sockets
+         */
+        size_t socketAllocations() const { return socket_allocations; }
+
+        /**
+         * @brief Get the number of times accept has reused a closed Socket instead of allocating one
+         * @return the number of reuses
+         */
+        size_t socketReuses() const { return socket_reuses; }
+
     protected:
         typename Policy::socket_container_t newSockets;       ///< A list of sockets accepted
-        FD_Set<typename Policy::socket_container_t, typename Policy::socket_ptr_t> fd_set;   ///< An object containing the fd_sets used
+        typename Policy::socket_container_t spareSockets;     ///< Closed sockets kept for reuse by accept
+        vector<typename Policy::socket_iterator_t> accepted;  ///< The sockets accepted by the last acceptAll()
+        vector<typename Policy::socket_iterator_t> socketHandles; ///< The socket each interest list handle selects
+        vector<size_t> freeHandles;                           ///< Interest list handles not in use
+        size_t socket_allocations{0};                         ///< Sockets allocated by accept
+        size_t socket_reuses{0};                              ///< Sockets reused by accept
+        typename Policy::selector_t fd_set;                   ///< The readiness engine selecting the sockets
+
+        /**
+         * @brief Give a socket in the container an interest list handle and list it
+         * @param socket An iterator selecting the socket
+         * @return the iterator
+         */
+        typename Policy::socket_iterator_t adopt(typename Policy::socket_iterator_t socket) {
+            size_t handle;
+            if (freeHandles.empty()) {
+                handle = socketHandles.size();
+                socketHandles.push_back(socket);
+            } else {
+                handle = freeHandles.back();
+                freeHandles.pop_back();
+                socketHandles[handle] = socket;
+            }
+            (*socket)->setInterestList(&interests, handle);
+            (*socket)->selectionChanged();
+            return socket;
+        }
+
+        /**
+         * @brief Remove a closed socket from the container, keeping a plain Socket for reuse by accept
+         * @param handle The socket's interest list handle
+         */
+        void remove(size_t handle) {
+            auto socket = socketHandles[handle];
+            fd_set.release(*socket);
+            (*socket)->setInterestList(nullptr, 0);
+            freeHandles.push_back(handle);
+            if (spareSockets.size() < Policy::socketPool && typeid(**socket) == typeid(Socket)) {
+                (*socket)->recycle();
+                Policy::recycle(sockets, socket, spareSockets);
+            } else {
+                Policy::erase(sockets, socket);
+            }
+        }
+
+        /**
+         * @brief Add a Socket for an accepted connection to the new sockets, reusing a spare one if there is one
+         * @param fd The accepted connection file descriptor
+         * @param addr The peer address
+         * @param len The size of the peer address
+         * @return An iterator pointing to the Socket
+         */
+        typename Policy::socket_iterator_t addSocket(int fd, struct sockaddr *addr, socklen_t len) {
+            typename Policy::socket_iterator_t sock;
+            if (spareSockets.empty()) {
+                sock = Policy::push_back(newSockets, std::make_unique<Socket>(fd, addr, len));
+                ++socket_allocations;
+            } else {
+                sock = Policy::reclaim(newSockets, spareSockets);
+                (*sock)->reuse(fd, addr, len);
+                ++socket_reuses;
+            }
+            if (Policy::deferFlush)
+                (*sock)->setFlushList(&flushes, Policy::corkFlush);
+            return sock;
+        }
     };
 }
 
@@ -1,9 +1,11 @@
 #include <iostream>
 #include <algorithm>
+#include <map>
 #include <iomanip>
 #include "name_that_type.h"
 #include "server.h"
 #include "iomanip.h"
+#include "proxy.h"
 
 using namespace std;
 using namespace eznet;
@@ -106,44 +108,198 @@ using namespace eznet;
     while (run) {
 
         // Perform select call to find Sockets that need service
-        int s = server.select();
-
-        // Loop over the Sockets contained in the server and service each one that needs it
-        for (auto &&first: server.sockets) {
-            if (server.isSelected(first)) {       // Socket needs service
-                --s;                              // Decrement count so we may be able to exit for loop early
-
-                // Test to see if the Socket is a listen socket and has a connection request
-                if (server.isConnectRequest(first)) {
-                    auto newSock = server.accept(first);    // Accept the connection
-                    if ((*newSock)->fd() >= 0) {            // If successfull add a stream buffer to the Socket
-                        cout << "New connection " << (*newSock)->getPeerName() << endl;
-                        run = (*newSock)->setStreamBuffer(make_unique<socket_streambuf>((*newSock)->fd()));
-                    }
+        server.select();
+
+        // Service each Socket that needs it, the handler is only called for Sockets that were selected
+        server.poll_ready([&](auto &first, SelectClients events) {
+
+            // Test to see if the Socket is a listen socket and has a connection request
+            if (server.isConnectRequest(first)) {
+                auto newSock = server.accept(first);    // Accept the connection
+                if ((*newSock)->fd() >= 0) {            // If successfull open a stream on the Socket
+                    cout << "New connection " << (*newSock)->getPeerName() << endl;
+                    run = (*newSock)->openStream();
+                    (*newSock)->selectClients = SC_Read;
+                }
 
-                // Otherwise test to see if the Socket has input to process
-                } else if (server.isRead(first)) {
-                    char buf[BUFSIZ];
-                    ssize_t  n = first->iostrm().readsome(buf, sizeof(buf));   // non-blocking read
-                    if (n > 0) {
-                        cout.write(buf, n);
-                    } else {
-                        cout << "Client " << first->getPeerName() << " disconnected." << endl;
-                        first->close();                                        // close connection
-                    }
+            // Otherwise test to see if the Socket has input to process
+            } else if (events & SC_Read) {
+                char buf[BUFSIZ];
+                ssize_t  n = first->iostrm().readsome(buf, sizeof(buf));   // non-blocking read
+                if (n > 0) {
+                    cout.write(buf, n);
+                } else {
+                    cout << "Client " << first->getPeerName() << " disconnected." << endl;
+                    first->close();                                        // close connection
                 }
             }
-        }
+        });
     }
    @endcode
 
+   The loop may also walk `server.sockets` and test each one with `server.isSelected()`, but
+   poll_ready() only visits the Sockets that are ready.
+
+   `server.accept()` takes one connection request for each time the listener is selected. To absorb
+   a burst of requests `server.acceptAll()` takes every pending request, up to the policy's
+   acceptBudget, and returns an iterator for each new Socket:
+
+   @code{.cpp}
+   for (auto &newSock: server.acceptAll(first, 0, SOCK_NONBLOCK))
+       (*newSock)->selectClients = SC_Read;
+   @endcode
+
    This is a very basic example, but it does cover the basics.
- */
 
-int main() {
-    std::cout << "Hello, World!" << std::endl;
+   ## Readiness engines ##
+
+   The default policy selects sockets with select(2) which passes every file descriptor to the kernel
+   on every call and can not handle file descriptors larger than FD_SETSIZE. A server with many
+   connections should use the epoll(7) engine which keeps a persistent registration for each socket:
+
+   @code{.cpp}
+   Server<EPollServerPolicy<std::unique_ptr<Socket>>> server{};
+   @endcode
+
+   On Linux 5.19 or later the io_uring(7) engine accepts connections with a multishot accept and
+   makes each select() a single io_uring_enter(2) call. On Linux 6.0 or later it also receives for
+   the streams of accepted Sockets into a ring of provided buffers, and sends the output they flush
+   with requests submitted by the next select(), so a stream makes no recv(2) or sendmsg(2) calls;
+   read such a Socket through its stream only:
+
+   @code{.cpp}
+   Server<URingServerPolicy<std::unique_ptr<Socket>>> server{};
+   @endcode
 
-    Server server{};
+   The select-accept-process loop above is unchanged. This program takes the engine to use,
+   `select`, `epoll`, `uring` or `slab`, as its first argument.
+
+   The default policies keep sockets in a std::list. SlabServerPolicy keeps them in a SocketSlab,
+   pages of pointers walked in order, with any of the engines; `slab` runs it with epoll:
+
+   @code{.cpp}
+   Server<SlabServerPolicy<std::unique_ptr<Socket>, EPoll_Set>> server{};
+   @endcode
+
+   select() keeps closed Sockets, up to the policy's `socketPool`, and accept() reuses them for
+   new connections along with their stream buffers, so a server under connection churn stops
+   allocating once warm. Give accepted Sockets their stream with `openStream()` rather than
+   `setStreamBuffer()` to keep the buffer a reused Socket already has. `socketAllocations()`
+   and `socketReuses()` count how accept() came by its Sockets.
+
+   Every engine keeps what it was last told about each Socket, and select() only updates the Sockets
+   whose selection has changed since, so its cost does not grow with idle connections. Assigning
+   `selectClients`, opening or closing the Socket and awaiting it mark it changed; a Socket subclass
+   whose `selection()` depends on state of its own calls `selectionChanged()` when that state changes.
+
+   ## Output queues ##
+
+   Writing to a Socket stream blocks until the peer takes the data, which stalls every other
+   Socket in the loop. A Socket given a write queue never blocks:
+
+   @code{.cpp}
+   (*newSock)->setWriteQueue(1 << 20);     // Queue up to 1 MiB for this client
+   @endcode
+
+   Output that can not be sent is queued and the Server selects the Socket for write until
+   poll_ready() has drained it. When the queue reaches its high-water mark writes to the stream
+   fail; use `writable()` to stop producing output for a slow client.
+
+   Input can be made non-blocking too. `setReadAhead(limit)` makes every read from the socket
+   repeat until it would block, which together with SC_Edge in selectClients lets an EPoll_Set
+   report a Socket once per arrival of input. A read that runs out of input fails the stream;
+   `inputState()` then says whether more may come (IoWouldBlock) or the peer has closed (IoEof).
+
+   A handler that writes several responses, each ending with `endl`, makes a system call for
+   each. `setFlushList(&server.flushes)` defers a Socket's flushes instead: select() sends all
+   the output written since the last wait with one sendmsg(2) per Socket, and `drainOutput()`
+   still sends at once. A policy with `deferFlush` set does this for every accepted Socket.
+
+   ## Proxies ##
+
+   A SpliceProxy forwards an accepted connection to an upstream server with splice(2), so the
+   data never enters user space:
+
+   @code{.cpp}
+   auto upstream = server.push_front(make_unique<Socket>("backend", "8080"));
+   if ((*upstream)->connectAsync(std::chrono::seconds(5), AF_INET6, AF_INET) > 0)
+       SpliceProxy::join(**newSock, **upstream);
+   @endcode
+
+   The upstream connection is made without blocking the loop; when connectAsync() returns 0 the
+   handler is passed the upstream Socket with SC_Write once it connects, and joins the proxy then.
+   From then on poll_ready() services both Sockets itself and closes them when both sides have
+   finished. Given an upstream host and port after the engine this program forwards every
+   connection to them.
+
+   ## Name resolution ##
+
+   `connect()` and `listen()` resolve their host and port with getaddrinfo(3), which blocks the
+   loop for a DNS round trip. Results are kept in `AddressCache::global()` for 30 seconds, and a
+   `Resolver` resolves names on a thread of its own and runs a callback on the loop when the
+   name is ready; a connect() from that callback is answered from the cache.
+
+   `connect()` also blocks until the connection is made, which can take the kernel's whole SYN
+   timeout if an address does not answer. `connectAsync()` races the host's addresses, IPv6 and
+   IPv4 in turn, and gives up after a timeout; a Server completes the connection and passes the
+   Socket to the handler with SC_Write, or SC_Except if it failed:
+
+   @code{.cpp}
+   auto upstream = make_unique<Socket>("backend", "8080");
+   upstream->connectAsync(std::chrono::seconds(5), AF_INET6, AF_INET);
+   server.push_front(std::move(upstream));
+   @endcode
+
+   ## Timers ##
+
+   A Server owns a hierarchical timer wheel. Scheduling and cancelling a timer costs the same
+   however many are scheduled, and select() waits no longer than the next timer is due, then
+   runs the callbacks of the timers that have expired. Every Socket has a timer of its own that
+   is cancelled when the Socket is closed, which suits an idle timeout:
+
+   @code{.cpp}
+   server.setTimer(*newSock, std::chrono::seconds(30), [&sock = **newSock] { sock.close(); });
+   @endcode
+
+   Scheduling the timer again, on each request say, pushes the timeout back.
+
+   ## Coroutines ##
+
+   A handler can be written as a C++20 coroutine returning `Task`. Each `co_await` that would
+   block suspends the coroutine into the loop, and poll_ready() resumes it when the Socket is
+   ready, so every client gets sequential code without a thread of its own:
+
+   @code{.cpp}
+   Task echo(Socket *sock) {
+       std::array<std::byte, 1024> buffer{};
+       ssize_t n;
+       while ((n = co_await sock->readAsync(buffer)) > 0)
+           co_await sock->writeAsync(std::span{buffer.data(), size_t(n)});
+       sock->close();
+   }
+   @endcode
+
+   `server.acceptAsync(listener)` awaits a connection and `server.sleepFor(duration)` awaits the
+   server's timer wheel. Closing a Socket resumes a coroutine waiting on it with ECANCELED.
+   AsyncServer serves each client this way.
+
+   ## Raw I/O ##
+
+   The iostream is a convenience. `read()`, `write()`, `readv()`, `writev()`, `recvmsg()` and
+   `sendmsg()` go straight to the socket and return an `io_result`, the bytes transferred and
+   whether the call would have blocked, met end of file or failed, without exceptions or errno:
+
+   @code{.cpp}
+   std::array<std::byte, 4096> buffer{};
+   auto r = sock->read(buffer, MSG_DONTWAIT);
+   if (r.status == IoWouldBlock)
+       return;
+   @endcode
+ */
+
+template <class Policy>
+int runServer(const string &upHost, const string &upPort) {
+    Server<Policy> server{};
 
     // Make a socket to bind to any address at port 8000 and add it to the server
     auto serverListen = server.push_front(make_unique<Socket>("", "8000"));
@@ -158,32 +314,67 @@ int main() {
     cout << "Server connection " << (*serverListen)->getPeerName() << endl;
 
     bool run = true;
+    map<Socket *, Socket *> connecting{};   // Upstream connections in progress and the client of each
 
     while (run) {
-        int s = server.select();
-        for (auto &&first: server.sockets) {
-            if (server.isSelected(first)) {
-                --s;
-                if (server.isConnectRequest(first)) {
-                    auto newSock = server.accept(first);
-                    if ((*newSock)->fd() >= 0) {
-                        cout << "New connection " << (*newSock)->getPeerName() << endl;
-                        run = (*newSock)->setStreamBuffer(make_unique<socket_streambuf>((*newSock)->fd()));
-                        (*newSock)->selectClients = SC_Read;
-                    }
-                } else if (server.isRead(first)) {
-                    char buf[BUFSIZ];
-                    ssize_t  n = first->iostrm().readsome(buf, sizeof(buf));
-                    if (n > 0) {
-                        cout.write(buf, n);
-                    } else {
-                        cout << "Client " << first->getPeerName() << " disconnected." << endl;
-                        first->close();
+        server.select();
+        server.poll_ready([&](auto &first, SelectClients events) {
+            if (auto up = connecting.find(&*first); up != connecting.end()) {
+                // connectAsync() has finished, SC_Write if the upstream connected.
+                Socket *client = up->second;
+                connecting.erase(up);
+                if (events & SC_Write)
+                    SpliceProxy::join(*client, *first);
+                else
+                    client->close();
+            } else if (server.isConnectRequest(first)) {
+                auto newSock = server.accept(first);
+                if ((*newSock)->fd() >= 0) {
+                    cout << "New connection " << (*newSock)->getPeerName() << endl;
+                    if (!upHost.empty()) {
+                        auto upstream = server.push_front(make_unique<Socket>(upHost, upPort));
+                        int connected = (*upstream)->connectAsync(chrono::seconds(5), AF_INET6, AF_INET);
+                        if (connected > 0)
+                            SpliceProxy::join(**newSock, **upstream);
+                        else if (connected == 0)
+                            connecting[&**upstream] = &**newSock;
+                        else
+                            (*newSock)->close();
+                        return;
                     }
+                    run = (*newSock)->openStream();
+                    (*newSock)->selectClients = SC_Read;
+                }
+            } else if (events & SC_Read) {
+                char buf[BUFSIZ];
+                ssize_t  n = first->iostrm().readsome(buf, sizeof(buf));
+                if (n > 0) {
+                    cout.write(buf, n);
+                } else {
+                    cout << "Client " << first->getPeerName() << " disconnected." << endl;
+                    first->close();
                 }
             }
-        }
+        });
     }
 
     return 0;
+}
+
+int main(int argc, char **argv) {
+    std::cout << "Hello, World!" << std::endl;
+
+    // ServerTest [engine [upstream-host upstream-port]]
+    string engine{argc > 1 ? argv[1] : "epoll"};
+    string upHost{argc > 3 ? argv[2] : ""};
+    string upPort{argc > 3 ? argv[3] : ""};
+
+    if (engine == "select")
+        return runServer<DefaultServerPolicy<std::unique_ptr<Socket>>>(upHost, upPort);
+    else if (engine == "uring")
+        return runServer<URingServerPolicy<std::unique_ptr<Socket>>>(upHost, upPort);
+    else if (engine == "slab")
+        return runServer<SlabServerPolicy<std::unique_ptr<Socket>, EPoll_Set>>(upHost, upPort);
+
+    return runServer<EPollServerPolicy<std::unique_ptr<Socket>>>(upHost, upPort);
 }
\ No newline at end of file
@@ -13,7 +13,11 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <list>
+#include <functional>
 #include <utility>
+#include <coroutine>
+#include <span>
+#include <cstddef>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -21,6 +25,7 @@
 #include <netdb.h>
 #include "socket_buffer.h"
 #include "basic_socket.h"
+#include "timer_wheel.h"
 
 using namespace std;
 using namespace async_net;
@@ -36,22 +41,235 @@ namespace eznet {
         SC_Read = 1,        ///< Select for read
         SC_Write = 2,       ///< Select for write
         SC_Except = 4,      ///< Select for exception
-        SC_All = 7          ///< Select for all
+        SC_All = 7,         ///< Select for all
+        SC_Edge = 8         ///< Report readiness only when it changes, where the readiness engine supports it
+    };
+
+
+    class Socket;
+
+
+    /**
+     * @brief A Socket's selectClients, a SelectClients value that tells the Socket when it is changed so its
+     * Server can update the socket's registration.
+     */
+    class Selection {
+    public:
+        explicit Selection(Socket &owner) : owner{owner}, value{SC_None} {}
+
+        Selection(const Selection &) = delete;
+
+        inline Selection &operator=(SelectClients select);
+
+        Selection &operator=(const Selection &other) { return *this = other.value; }
+
+        operator SelectClients() const { return value; }
+
+    protected:
+        Socket &owner;          ///< The socket selected
+        SelectClients value;    ///< How the socket should be selected
+    };
+
+
+    /**
+     * @brief The sockets whose selection may have changed since their Server last updated its readiness
+     * engine, see Socket::selectionChanged().
+     * @details A Server gives each of its sockets a handle and a pointer to its list, and each select()
+     * updates only the sockets listed, so the cost of a loop iteration does not depend on the number of
+     * sockets that have not changed.
+     */
+    class InterestList {
+    public:
+        InterestList() : changed{} {}
+
+        InterestList(const InterestList &) = delete;
+
+        InterestList &operator=(const InterestList &) = delete;
+
+        vector<size_t> changed;     ///< The handles of the changed sockets, each listed once
+    };
+
+
+    /**
+     * @brief The part of a coroutine awaiter that Server::poll_ready() drives while a coroutine is suspended
+     * on a Socket.
+     * @details While an awaiter is suspended the Socket is selected for the awaiter's selection instead of
+     * selectClients, and when it is selected poll_ready() calls complete() instead of the handler, resuming
+     * the coroutine once complete() returns true.
+     */
+    class SocketAwaiter {
+    public:
+        SelectClients selection{SC_None};      ///< What the suspended operation waits for
+        coroutine_handle<> handle{};            ///< The suspended coroutine
+
+        /**
+         * @brief Retry the operation when the socket is selected
+         * @param events the selections
+         * @return true when the operation has finished and the coroutine should resume
+         */
+        virtual bool complete(SelectClients events) = 0;
+
+        /**
+         * @brief Finish the operation with an error because the socket has been closed
+         */
+        virtual void cancel() = 0;
+
+    protected:
+        ~SocketAwaiter() = default;
+
+        /**
+         * @brief Suspend on a socket
+         * @param sock The socket
+         * @param slot The socket's awaiter
+         * @param h The coroutine
+         * @param select What to wait for
+         */
+        void suspend(basic_socket &sock, SocketAwaiter *&slot, coroutine_handle<> h, SelectClients select) {
+            if (slot)
+                throw logic_error("A coroutine is already waiting on the socket.");
+            handle = h;
+            selection = select;
+            slot = this;
+            sock.selectionChanged();
+        }
+    };
+
+
+    /**
+     * @brief Await data on a socket, see Socket::readAsync()
+     */
+    class ReadAwaiter : public SocketAwaiter {
+    public:
+        ReadAwaiter(basic_socket &sock, SocketAwaiter *&slot, span<byte> buffer) :
+                sock{sock}, slot{slot}, buffer{buffer}, result{-1}, error{0} {}
+
+        bool await_ready() { return complete(SC_Read); }
+
+        void await_suspend(coroutine_handle<> h) { suspend(sock, slot, h, SC_Read); }
+
+        /**
+         * @return the number of bytes read, 0 at end of file, or -1 with errno set
+         */
+        ssize_t await_resume() const {
+            if (result < 0)
+                errno = error;
+            return result;
+        }
+
+        bool complete(SelectClients) override {
+            io_result r = sock.read(buffer, MSG_DONTWAIT);
+            if (r.status == IoWouldBlock)
+                return false;
+            result = r.status == IoError ? -1 : static_cast<ssize_t>(r.bytes);
+            error = r.error;
+            return true;
+        }
+
+        void cancel() override {
+            result = -1;
+            error = ECANCELED;
+        }
+
+    protected:
+        basic_socket &sock;         ///< The socket
+        SocketAwaiter *&slot;       ///< The socket's awaiter
+        span<byte> buffer;          ///< Where to put the data
+        ssize_t result;             ///< The bytes read or -1
+        int error;                  ///< The error when result is -1
+    };
+
+
+    /**
+     * @brief Await sending a buffer on a socket, see Socket::writeAsync()
+     */
+    class WriteAwaiter : public SocketAwaiter {
+    public:
+        WriteAwaiter(basic_socket &sock, SocketAwaiter *&slot, span<const byte> buffer) :
+                sock{sock}, slot{slot}, buffer{buffer}, sent{0}, error{0} {}
+
+        bool await_ready() { return complete(SC_Write); }
+
+        void await_suspend(coroutine_handle<> h) { suspend(sock, slot, h, SC_Write); }
+
+        /**
+         * @return the size of the buffer once it has all been sent, or -1 with errno set
+         */
+        ssize_t await_resume() const {
+            if (error) {
+                errno = error;
+                return -1;
+            }
+            return static_cast<ssize_t>(sent);
+        }
+
+        bool complete(SelectClients) override {
+            while (sent < buffer.size()) {
+                io_result r = sock.write(buffer.subspan(sent), MSG_DONTWAIT);
+                if (r.status == IoWouldBlock)
+                    return false;
+                if (r.status == IoError) {
+                    error = r.error;
+                    return true;
+                }
+                sent += r.bytes;
+            }
+            return true;
+        }
+
+        void cancel() override {
+            error = ECANCELED;
+        }
+
+    protected:
+        basic_socket &sock;         ///< The socket
+        SocketAwaiter *&slot;       ///< The socket's awaiter
+        span<const byte> buffer;    ///< The data to send
+        size_t sent;                ///< The bytes sent so far
+        int error;                  ///< The error, or 0
     };
 
 
     class Socket : public local_socket {
 
     public:
-        SelectClients selectClients;    ///< How this socket should be selected.
+        Selection selectClients;        ///< How this socket should be selected.
+
+        int interestFd;                 ///< The file descriptor registered with a persistent readiness engine, or -1
+        SelectClients interest;         ///< The selection registered with a persistent readiness engine
+
+        size_t writeHighWater;          ///< The high-water mark of queued output, 0 for blocking output
+
+        size_t readAheadLimit;          ///< The most input the stream reads ahead, 0 for blocking input
+
+        FlushList *flushList;           ///< Where the stream's flushes are deferred, or nullptr
+        bool flushCork;                 ///< Cork the socket while flushing output that includes part of a file
+
+        InterestList *interestList;     ///< The list of the Server that owns the socket, or nullptr
+        size_t interestHandle;          ///< The socket's handle in the Server
+        bool interestListed;            ///< The socket is on the interest list
+
+        /// When set Server::poll_ready() calls this with the socket's selections instead of its handler.
+        function<void(SelectClients)> onReady;
+
+        Timer timer;                    ///< A timer for the socket, cancelled when the socket is closed or destroyed
+
+        SocketAwaiter *awaiter;         ///< The coroutine operation suspended on the socket, or nullptr
 
         Socket &operator=(const Socket &) = delete;
 
+        /**
+         * @brief (move assignment) Close this socket and take the connection and stream buffer of another.
+         * @details Nothing is copied: the stream buffer is handed over and this socket's iostream is pointed
+         * at it, so a Socket can be moved cheaply between containers. A timer or coroutine waiting on the other
+         * socket is not moved, the timer is cancelled and the coroutine stays with the other socket.
+         */
         Socket &operator=(Socket &&other) noexcept {
-            basic_socket::operator=(std::move(other));
-            setStreamBuffer(std::move(other.strmbuf));
-            selectClients = other.selectClients;
-            sock_future = std::move(other.sock_future);
+            if (this != &other) {
+                close();
+                local_socket::operator=(std::move(other));
+                take(other);
+            }
+            return *this;
         }
 
         unique_ptr<socket_streambuf> strmbuf;  ///< A buffer to abstract the socket as a stream
@@ -71,9 +289,21 @@ namespace eznet {
         explicit Socket(string host,                ///< The hostname or address to connect or bind to
                         string port                 ///< The port number to connect or bind to
         ) : local_socket(host, port),
-            selectClients{SC_None},
-            sock_stream{nullptr},
-            strmbuf{}
+            selectClients{*this},
+            interestFd{-1},
+            interest{SC_None},
+            writeHighWater{0},
+            readAheadLimit{0},
+            flushList{nullptr},
+            flushCork{false},
+            interestList{nullptr},
+            interestHandle{0},
+            interestListed{false},
+            onReady{},
+            timer{},
+            awaiter{nullptr},
+            strmbuf{},
+            sock_stream{nullptr}
         {
         }
 
@@ -82,12 +312,137 @@ namespace eznet {
                struct sockaddr *addr,
                socklen_t addr_len
         ) : local_socket(fd, addr, addr_len),
-            selectClients{SC_None},
-            sock_stream{nullptr},
-            strmbuf{}
+            selectClients{*this},
+            interestFd{-1},
+            interest{SC_None},
+            writeHighWater{0},
+            readAheadLimit{0},
+            flushList{nullptr},
+            flushCork{false},
+            interestList{nullptr},
+            interestHandle{0},
+            interestListed{false},
+            onReady{},
+            timer{},
+            awaiter{nullptr},
+            strmbuf{},
+            sock_stream{nullptr}
         {}
 
 
+        /**
+         * @brief (move constructor) Take the connection and stream buffer of another socket, see operator=().
+         */
+        Socket(Socket &&other) noexcept :
+                local_socket(std::move(other)),
+                selectClients{*this},
+                interestFd{-1},
+                interest{SC_None},
+                writeHighWater{0},
+                readAheadLimit{0},
+                flushList{nullptr},
+                flushCork{false},
+                interestList{nullptr},
+                interestHandle{0},
+                interestListed{false},
+                onReady{},
+                timer{},
+                awaiter{nullptr},
+                strmbuf{},
+                sock_stream{nullptr} {
+            take(other);
+        }
+
+
+        /**
+         * @brief (destructor) A coroutine still suspended on the socket is destroyed without being resumed.
+         */
+        ~Socket() {
+            interestList = nullptr;
+            if (strmbuf)
+                strmbuf->setOutputNotify(nullptr);
+            if (awaiter)
+                exchange(awaiter, nullptr)->handle.destroy();
+        }
+
+
+        /**
+         * @brief Close the socket, cancelling its timer
+         * @return the return value from ::close(2)
+         * @details Output whose flush has been deferred is sent first. A coroutine suspended on the socket is
+         * resumed, before close() returns, with the operation failed with ECANCELED.
+         */
+        int close() {
+            if (strmbuf)
+                strmbuf->flushDeferred();
+            timer.cancel();
+            int result = local_socket::close();
+            selectionChanged();
+            if (awaiter) {
+                awaiter->cancel();
+                resume();
+            }
+            return result;
+        }
+
+
+        /**
+         * @brief Read from the socket in a coroutine: co_await sock->readAsync(buffer)
+         * @param buffer Where to put the data, it must outlive the co_await
+         * @return an awaitable giving the number of bytes read, 0 at end of file, or -1 with errno set
+         * @details The coroutine is suspended until data arrives and is resumed by Server::poll_ready(). The
+         * read bypasses the stream buffer, so do not mix it with reading the iostream. Only one coroutine
+         * may wait on a socket at a time.
+         */
+        ReadAwaiter readAsync(span<byte> buffer) { return ReadAwaiter{*this, awaiter, buffer}; }
+
+
+        /**
+         * @brief Write to the socket in a coroutine: co_await sock->writeAsync(buffer)
+         * @param buffer The data to send, it must outlive the co_await
+         * @return an awaitable giving the size of the buffer once it has all been sent, or -1 with errno set
+         * @details The coroutine is suspended while the socket can not take more data and is resumed by
+         * Server::poll_ready(). The write bypasses the stream buffer, flush the iostream first.
+         */
+        WriteAwaiter writeAsync(span<const byte> buffer) { return WriteAwaiter{*this, awaiter, buffer}; }
+
+
+        /**
+         * @brief Resume the coroutine suspended on the socket
+         */
+        void resume() {
+            auto waiting = exchange(awaiter, nullptr);
+            selectionChanged();
+            waiting->handle.resume();
+        }
+
+
+        /**
+         * @brief Put the socket on its Server's interest list so the Server updates its registration
+         * @details Called when selectClients is assigned, a coroutine suspends on or resumes from the socket,
+         * output becomes or stops being queued, or the file descriptor changes. Call it after changing
+         * anything else that selection() depends on.
+         */
+        void selectionChanged() override {
+            if (interestList && !interestListed) {
+                interestListed = true;
+                interestList->changed.push_back(interestHandle);
+            }
+        }
+
+
+        /**
+         * @brief Give the socket to a Server's interest list, or take it away
+         * @param list The list, or nullptr
+         * @param handle The handle the Server knows the socket by
+         */
+        void setInterestList(InterestList *list, size_t handle) {
+            interestList = list;
+            interestHandle = handle;
+            interestListed = false;
+        }
+
+
         /**
          * @brief Move a unique pointer to a socket_stream into the Socket object
          * @param sbuf an rvalue reference to the socket unique pointer
@@ -95,19 +450,252 @@ namespace eznet {
          */
         bool setStreamBuffer(unique_ptr<socket_streambuf> && sbuf) {
             strmbuf = std::move(sbuf);
+            if (strmbuf) {
+                strmbuf->setWriteQueue(writeHighWater);
+                strmbuf->setReadAhead(readAheadLimit);
+                strmbuf->setFlushList(flushList, flushCork);
+                strmbuf->setOutputNotify([this] { selectionChanged(); });
+            }
             sock_stream.rdbuf(strmbuf.get());
+            selectionChanged();
+            return not sock_stream.bad();
+        }
+
+
+        /**
+         * @brief Give the socket a stream buffer, keeping the one a recycled socket already has.
+         * @return true if the iostream is valid
+         * @details Use in place of setStreamBuffer() on accepted sockets so a Server that reuses sockets
+         * does not allocate a stream buffer for each connection.
+         */
+        bool openStream() {
+            if (!strmbuf)
+                return setStreamBuffer(make_unique<socket_streambuf>(fd()));
             return not sock_stream.bad();
         }
 
 
+        /**
+         * @brief Return the socket to the state of a newly constructed one, keeping what it has allocated.
+         * @details The socket is closed, its timer cancelled, its callback released and a coroutine still
+         * suspended on it destroyed. The stream buffer is kept, empty, for the next connection.
+         */
+        void recycle() {
+            setInterestList(nullptr, 0);
+            local_socket::close();
+            timer.cancel();
+            if (awaiter)
+                exchange(awaiter, nullptr)->handle.destroy();
+            onReady = nullptr;
+            sock_future = future<int>{};
+            selectClients = SC_None;
+            interestFd = -1;
+            interest = SC_None;
+            writeHighWater = 0;
+            readAheadLimit = 0;
+            flushList = nullptr;
+            flushCork = false;
+            if (strmbuf)
+                strmbuf->reset(-1);
+            sock_stream.clear();
+        }
+
+
+        /**
+         * @brief Reuse a recycled socket for an accepted connection
+         * @param fd The accepted connection file descriptor
+         * @param addr The peer address
+         * @param len The size of the peer address
+         */
+        void reuse(int fd, struct sockaddr *addr, socklen_t len) {
+            local_socket::reset(fd, addr, len);
+            if (strmbuf)
+                strmbuf->reset(fd);
+        }
+
+
+        /**
+         * @brief Select blocking or non-blocking, queued, output for the stream.
+         * @param highWater When 0 output blocks until it is sent. Otherwise output that can not be sent
+         * without blocking is queued until the amount queued reaches highWater, after which output to the
+         * stream fails until the queue drains.
+         * @details While output is queued a Server selects the socket for write, whatever the value of
+         * selectClients, and Server::poll_ready() drains the queue when the socket becomes writable.
+         */
+        void setWriteQueue(size_t highWater) {
+            writeHighWater = highWater;
+            if (strmbuf)
+                strmbuf->setWriteQueue(highWater);
+            selectionChanged();
+        }
+
+
+        /**
+         * @brief Defer flushes of the stream to a FlushList, such as the Server's, which sends the output of
+         * every listed stream once per loop iteration.
+         * @param list The list, or nullptr to flush at once
+         * @param cork Set TCP_CORK while flushing output that includes part of a file
+         */
+        void setFlushList(FlushList *list, bool cork = false) {
+            flushList = list;
+            flushCork = cork;
+            if (strmbuf)
+                strmbuf->setFlushList(list, cork);
+        }
+
+
+        /**
+         * @brief Select blocking input, or non-blocking input that reads ahead for edge-triggered readiness.
+         * @param limit When 0 reading the stream blocks. Otherwise reading never blocks: each read from the
+         * socket repeats until it would block or limit characters are buffered. A read that finds no input
+         * fails the stream with inputState() IoWouldBlock, and the stream's state must be cleared before
+         * it is read again.
+         * @details Combine with SC_Edge in selectClients so an EPoll_Set reports the socket once for each
+         * arrival of input, and read until inputState() is IoWouldBlock or IoEof.
+         */
+        void setReadAhead(size_t limit) {
+            readAheadLimit = limit;
+            if (strmbuf)
+                strmbuf->setReadAhead(limit);
+        }
+
+
+        /**
+         * @brief Read everything the socket has into the stream buffer without blocking.
+         * @return the number of characters read and the outcome, see socket_streambuf::fill()
+         */
+        io_result fillInput() { return strmbuf ? strmbuf->fill() : io_result{0, IoError, ENOTCONN}; }
+
+
+        /**
+         * @brief Get the outcome of the last read of the stream from the socket
+         * @return IoWouldBlock or IoEof after a read that found no input, IoError after a failure, otherwise IoOk
+         */
+        IoStatus inputState() const { return strmbuf ? strmbuf->inputState() : IoError; }
+
+
+        /**
+         * @brief Determine if the stream will accept more output.
+         * @return false if the queued output has reached the high-water mark.
+         */
+        bool writable() const { return !strmbuf || strmbuf->writable(); }
+
+
+        /**
+         * @brief Determine if there is queued output waiting for the socket to become writable.
+         * @return true if there is queued output
+         */
+        bool outputQueued() const { return strmbuf && strmbuf->queued(); }
+
+
+        /**
+         * @brief Send the stream's output now, even if flushes are deferred. Queued output is sent as far as
+         * the socket will take it without blocking.
+         * @return 0 on success, -1 on error
+         */
+        int drainOutput() { return strmbuf ? strmbuf->flushNow() : 0; }
+
+
+        /**
+         * @brief Drop the stream's unsent output, such as when the connection has failed and it can not be sent.
+         */
+        void discardOutput() {
+            if (strmbuf)
+                strmbuf->discardOutput();
+        }
+
+
+        /**
+         * @brief Send part of a file on the stream without copying it through the stream buffer.
+         * @param fd The file, the caller may close it once this returns
+         * @param offset The offset of the first byte to send
+         * @param length The number of bytes to send
+         * @details The file follows anything already written to the stream. With a write queue the part of
+         * the file that can not be sent is queued, and sent by Server::poll_ready() as the socket becomes
+         * writable.
+         * @return 0 on success, -1 on error
+         */
+        int sendFile(int fd, off_t offset, size_t length) {
+            if (!strmbuf) {
+                errno = ENOTCONN;
+                return -1;
+            }
+            return strmbuf->sendFile(fd, offset, length);
+        }
+
+
+        /**
+         * @brief Return the stream's empty buffers to the buffer pool, call when the socket goes idle.
+         */
+        void trimBuffers() {
+            if (strmbuf)
+                strmbuf->trim();
+        }
+
+
+        /**
+         * @brief The selection a readiness engine should register for the socket
+         * @return selectClients, or the selection of a suspended coroutine, with SC_Write added while output
+         * is queued, or SC_Read while connectAsync() is in progress
+         */
+        SelectClients selection() const {
+            if (connecting())
+                return SC_Read;
+            SelectClients select = awaiter ? awaiter->selection : selectClients;
+            return outputQueued() ? static_cast<SelectClients>(select | SC_Write) : select;
+        }
+
+
         /**
          * @brief Access to the iostream tied to the underlying socket
          * @return an iostream reference
          */
         std::iostream & iostrm() { return sock_stream; }
 
+
+        /**
+         * @brief Get the stream buffer, for an engine that receives and sends for it
+         * @return the stream buffer or nullptr
+         */
+        socket_streambuf *streamBuffer() const { return strmbuf.get(); }
+
+    protected:
+        /**
+         * @brief Take the settings and stream buffer of a moved from socket, whose connection has been taken
+         * @param other the socket
+         */
+        void take(Socket &other) {
+            selectClients = other.selectClients;
+            other.selectClients = SC_None;
+            interestFd = exchange(other.interestFd, -1);
+            interest = exchange(other.interest, SC_None);
+            writeHighWater = other.writeHighWater;
+            readAheadLimit = other.readAheadLimit;
+            flushList = other.flushList;
+            flushCork = other.flushCork;
+            onReady = std::move(other.onReady);
+            other.timer.cancel();
+            strmbuf = std::move(other.strmbuf);
+            if (strmbuf)
+                strmbuf->setOutputNotify([this] { selectionChanged(); });
+            sock_stream.rdbuf(strmbuf.get());
+            sock_stream.clear(other.sock_stream.rdstate());
+            other.sock_stream.rdbuf(nullptr);
+            sock_future = std::move(other.sock_future);
+            selectionChanged();
+            other.selectionChanged();
+        }
     };
 
+
+    Selection &Selection::operator=(SelectClients select) {
+        if (select != value) {
+            value = select;
+            owner.selectionChanged();
+        }
+        return *this;
+    }
+
 }
 
 #endif //EZNETWORK_SOCKET_H
@@ -0,0 +1,1347 @@
+//
+// Created by richard on 16/10/26.
+//
+
+#include <iostream>
+#include <string>
+#include <map>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <array>
+#include <cstdio>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/utsname.h>
+#include <poll.h>
+#include "server.h"
+#include "connection_pool.h"
+#include "handoff_queue.h"
+#include "proxy.h"
+
+using namespace std;
+using namespace eznet;
+
+/**
+ * @brief Checks of the Socket and Server behaviour, run by ctest.
+ * @details Each check is a named function, `SocketTest <name>` runs one and `SocketTest` runs them all. The
+ * program exits 1 if any check fails, and otherwise 77 if any check was skipped.
+ */
+
+static int failures = 0;
+static int skips = 0;       ///< Checks that could not run, such as on an engine the kernel lacks
+constexpr int skipped_exit = 77;    ///< The exit status when checks were skipped, ctest's SKIP_RETURN_CODE
+
+/**
+ * @brief Report the outcome of a check
+ * @param ok true if the check passed
+ * @param what A description of what was checked
+ */
+static void check(bool ok, const string &what) {
+    cout << (ok ? "  ok   " : "  FAIL ") << what << endl;
+    if (!ok)
+        ++failures;
+}
+
+/**
+ * @brief Get the port a listen socket was bound to, listening on port "0" picks a free one.
+ * @param sock The listen socket
+ * @return the port number as a string
+ */
+static string localPort(Socket &sock) {
+    struct sockaddr_storage addr{};
+    socklen_t len = sizeof(addr);
+    ::getsockname(sock.fd(), reinterpret_cast<struct sockaddr *>(&addr), &len);
+    auto port = addr.ss_family == AF_INET6 ? reinterpret_cast<struct sockaddr_in6 *>(&addr)->sin6_port
+                                           : reinterpret_cast<struct sockaddr_in *>(&addr)->sin_port;
+    return to_string(ntohs(port));
+}
+
+/**
+ * @brief Make a connected pair of Sockets with socketpair(2)
+ * @param type The socket type, SOCK_SEQPACKET keeps the boundary of each send
+ * @return the two ends, neither has a stream yet
+ */
+static pair<unique_ptr<Socket>, unique_ptr<Socket>> socketPair(int type = SOCK_STREAM) {
+    int fds[2];
+    if (::socketpair(AF_UNIX, type, 0, fds))
+        throw runtime_error(string{"socketpair error: "} + strerror(errno));
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    auto len = static_cast<socklen_t>(sizeof(addr.sun_family));
+    return {make_unique<Socket>(fds[0], reinterpret_cast<struct sockaddr *>(&addr), len),
+            make_unique<Socket>(fds[1], reinterpret_cast<struct sockaddr *>(&addr), len)};
+}
+
+/**
+ * @brief Read what a socket has without blocking, checking each byte follows the pattern of offset % 251
+ * @param sock The socket
+ * @param received The bytes received so far, updated
+ * @return false if a byte broke the pattern
+ */
+static bool readPattern(Socket &sock, size_t &received) {
+    array<byte, 4096> buffer{};
+    io_result r;
+    while ((r = sock.read(buffer, MSG_DONTWAIT))) {
+        for (size_t i = 0; i < r.bytes; ++i, ++received)
+            if (buffer[i] != static_cast<byte>(received % 251))
+                return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Run an echo server on one readiness engine and check several clients get every line back.
+ * @tparam Policy The server policy, which selects the engine and socket container
+ * @param engine The engine name to report
+ */
+template <class Policy>
+static void echoRoundTrip(const string &engine) {
+    unique_ptr<Server<Policy>> server{};
+    try {
+        server = make_unique<Server<Policy>>();
+    } catch (runtime_error &e) {
+        cout << "  skip " << engine << ": " << e.what() << endl;
+        ++skips;
+        return;
+    }
+
+    auto listener = server->push_front(make_unique<Socket>("", "0"));
+    (*listener)->selectClients = SC_Read;
+    if ((*listener)->listen(16, AF_INET6) < 0) {
+        check(false, engine + " listen");
+        return;
+    }
+    string port = localPort(**listener);
+
+    constexpr int clients = 4, lines = 50;
+    atomic<int> echoed{0}, finished{0};
+    vector<thread> threads{};
+    for (int c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c] {
+            Socket client{"localhost", port};
+            if (client.connect(AF_INET6, AF_INET) >= 0 && client.openStream()) {
+                auto &io = client.iostrm();
+                string line;
+                for (int i = 0; i < lines; ++i) {
+                    string sent = "client " + to_string(c) + " line " + to_string(i);
+                    io << sent << endl;
+                    if (getline(io, line) && line == sent)
+                        ++echoed;
+                }
+            }
+            ++finished;
+        });
+    }
+
+    int closed = 0;
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+    while ((finished < clients || closed < clients) && chrono::steady_clock::now() < deadline) {
+        server->select(chrono::milliseconds(100));
+        server->poll_ready([&](auto &sock, SelectClients events) {
+            if (server->isConnectRequest(sock)) {
+                for (auto &accepted: server->acceptAll(sock)) {
+                    (*accepted)->openStream();
+                    (*accepted)->selectClients = SC_Read;
+                }
+            } else if (events & SC_Read) {
+                auto &io = sock->iostrm();
+                string line;
+                do {
+                    if (!getline(io, line)) {
+                        sock->close();
+                        ++closed;
+                        return;
+                    }
+                    io << line << endl;
+                } while (io.rdbuf()->in_avail() > 0);
+            }
+        });
+    }
+
+    for (auto &t: threads)
+        t.join();
+    check(echoed == clients * lines, engine + " echoed " + to_string(echoed.load()) + " of " +
+                                     to_string(clients * lines) + " lines");
+    check(closed == clients, engine + " saw every client close");
+}
+
+/**
+ * @brief The echo round trip on the select and epoll engines with each socket container.
+ */
+static void echo() {
+    echoRoundTrip<DefaultServerPolicy<unique_ptr<Socket>>>("select");
+    echoRoundTrip<EPollServerPolicy<unique_ptr<Socket>>>("epoll");
+    echoRoundTrip<SlabServerPolicy<unique_ptr<Socket>>>("slab select");
+    echoRoundTrip<SlabServerPolicy<unique_ptr<Socket>, EPoll_Set>>("slab epoll");
+}
+
+/**
+ * @brief The echo round trip on the io_uring engine with each socket container, skipped if the kernel
+ * does not provide io_uring.
+ */
+static void echoURing() {
+    echoRoundTrip<URingServerPolicy<unique_ptr<Socket>>>("uring");
+    echoRoundTrip<SlabServerPolicy<unique_ptr<Socket>, URing_Set>>("slab uring");
+}
+
+/**
+ * @brief A multishot accept that ends with an error, here EMFILE because the process is out of file
+ * descriptors, is re-armed, so the io_uring listener accepts again once descriptors are free. Skipped if the
+ * kernel does not provide io_uring.
+ */
+static void uringRearm() {
+    using URingServer = Server<URingServerPolicy<unique_ptr<Socket>>>;
+    unique_ptr<URingServer> server{};
+    try {
+        server = make_unique<URingServer>();
+    } catch (runtime_error &e) {
+        cout << "  skip uring: " << e.what() << endl;
+        ++skips;
+        return;
+    }
+    auto listener = server->push_front(make_unique<Socket>("", "0"));
+    (*listener)->selectClients = SC_Read;
+    if ((*listener)->listen(16, AF_INET6) < 0) {
+        check(false, "listen");
+        return;
+    }
+    int accepted = 0;
+    auto loop = [&](chrono::milliseconds duration) {
+        auto deadline = chrono::steady_clock::now() + duration;
+        while (!accepted && chrono::steady_clock::now() < deadline) {
+            server->select(chrono::milliseconds(10));
+            server->poll_ready([&](auto &sock, SelectClients) {
+                if (server->isConnectRequest(sock))
+                    accepted += static_cast<int>(server->acceptAll(sock).size());
+            });
+        }
+    };
+
+    // Use up the descriptors but one for the client. The accept takes the limit when it is armed.
+    struct rlimit saved{};
+    ::getrlimit(RLIMIT_NOFILE, &saved);
+    struct rlimit limited = saved;
+    limited.rlim_cur = min<rlim_t>(saved.rlim_cur, 128);
+    ::setrlimit(RLIMIT_NOFILE, &limited);
+    vector<int> spare{};
+    for (int fd; (fd = ::dup(0)) >= 0;)
+        spare.push_back(fd);
+    ::close(spare.back());
+    spare.pop_back();
+    loop(chrono::milliseconds(10));
+
+    Socket client{"localhost", localPort(**listener)};
+    int connected = client.connect(AF_INET6, AF_INET);
+    loop(chrono::milliseconds(100));
+    check(connected >= 0 && accepted == 0, "no connection is accepted while out of descriptors");
+
+    for (auto fd: spare)
+        ::close(fd);
+    ::setrlimit(RLIMIT_NOFILE, &saved);
+    loop(chrono::seconds(5));
+    check(accepted == 1, "the listener accepts again once descriptors are free");
+}
+
+/**
+ * @brief The io_uring engine receives for the stream of an accepted socket and sends its deferred flushes:
+ * input is taken from the kernel before the stream is read, a blocking read waits on the engine, receiving
+ * stops at the read-ahead limit until the stream is read, and end of file follows the input.
+ */
+static void uringFeed() {
+    struct utsname name{};
+    unsigned major = 0;
+    if (::uname(&name) == 0 && sscanf(name.release, "%u", &major) == 1 && major < 6) {
+        cout << "  skip uring feed: Linux " << name.release << " has no multishot recv" << endl;
+        ++skips;
+        return;
+    }
+    using URingServer = Server<URingServerPolicy<unique_ptr<Socket>>>;
+    unique_ptr<URingServer> server{};
+    try {
+        server = make_unique<URingServer>();
+    } catch (runtime_error &e) {
+        cout << "  skip uring: " << e.what() << endl;
+        ++skips;
+        return;
+    }
+    auto listener = server->push_front(make_unique<Socket>("", "0"));
+    (*listener)->selectClients = SC_Read;
+    if ((*listener)->listen(16, AF_INET6) < 0) {
+        check(false, "listen");
+        return;
+    }
+    Socket client{"localhost", localPort(**listener)};
+    if (client.connect(AF_INET6, AF_INET) < 0) {
+        check(false, "connect");
+        return;
+    }
+
+    Socket *peer = nullptr;
+    bool readable = false;
+    auto loop = [&](chrono::milliseconds duration, const function<bool()> &done) {
+        auto deadline = chrono::steady_clock::now() + duration;
+        while (!done() && chrono::steady_clock::now() < deadline) {
+            server->select(chrono::milliseconds(10));
+            server->poll_ready([&](auto &sock, SelectClients events) {
+                if (server->isConnectRequest(sock)) {
+                    for (auto &accepted: server->acceptAll(sock)) {
+                        (*accepted)->openStream();
+                        (*accepted)->selectClients = SC_Read;
+                        peer = accepted->get();
+                    }
+                } else if (events & SC_Read) {
+                    readable = true;
+                }
+            });
+        }
+    };
+
+    loop(chrono::seconds(5), [&] { return peer != nullptr; });
+    if (!peer) {
+        check(false, "accept");
+        return;
+    }
+    auto &io = peer->iostrm();
+    ::send(client.fd(), "hello\n", 6, MSG_NOSIGNAL);
+    loop(chrono::seconds(5), [&] { return readable; });
+    int inKernel = -1;
+    ::ioctl(peer->fd(), FIONREAD, &inKernel);
+    check(readable && inKernel == 0 && io.rdbuf()->in_avail() == 6,
+          "the engine received the input before the stream was read");
+    string line;
+    check(getline(io, line) && line == "hello", "the stream reads the input the engine received");
+
+    io << "world" << endl;
+    struct pollfd reply{client.fd(), POLLIN, 0};
+    bool early = ::poll(&reply, 1, 50) > 0;
+    server->select(chrono::milliseconds(10));
+    char echoed[16]{};
+    ssize_t got = ::poll(&reply, 1, 1000) > 0 ? ::recv(client.fd(), echoed, sizeof(echoed), 0) : -1;
+    check(!early && got == 6 && string(echoed, 6) == "world\n", "the next select sends a flush through the engine");
+
+    thread halves{[&] {
+        ::send(client.fd(), "split ", 6, MSG_NOSIGNAL);
+        this_thread::sleep_for(chrono::milliseconds(100));
+        ::send(client.fd(), "line\n", 5, MSG_NOSIGNAL);
+    }};
+    check(getline(io, line) && line == "split line", "a blocking read waits on the engine for the rest of a line");
+    halves.join();
+
+    // With small socket buffers the sender gets little further than what the engine takes, which is far
+    // less than the provided buffers hold when the recv is paused at the read-ahead limit.
+    constexpr size_t total = 4 << 20;
+    int small = 64 * 1024;
+    ::setsockopt(peer->fd(), SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    ::setsockopt(client.fd(), SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    atomic<size_t> sent{0};
+    thread sender{[&] {
+        vector<char> pattern(total);
+        for (size_t i = 0; i < total; ++i)
+            pattern[i] = static_cast<char>(i % 251);
+        while (sent < total) {
+            size_t part = min<size_t>(total - sent, 16384);
+            ssize_t n = ::send(client.fd(), pattern.data() + sent, part, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += n;
+        }
+        ::shutdown(client.fd(), 1);
+    }};
+    loop(chrono::milliseconds(200), [] { return false; });
+    inKernel = 0;
+    ::ioctl(peer->fd(), FIONREAD, &inKernel);
+    check(inKernel > 0 && sent < (768 << 10),
+          "the engine stops receiving at the read-ahead limit and leaves the rest to the kernel");
+
+    vector<char> input(total);
+    io.read(input.data(), total);
+    bool intact = static_cast<size_t>(io.gcount()) == total;
+    for (size_t i = 0; intact && i < total; ++i)
+        intact = input[i] == static_cast<char>(i % 251);
+    sender.join();
+    check(intact, "the input arrives in order once the stream is read");
+    check(io.get() == char_traits<char>::eof() && peer->inputState() == IoEof, "end of file follows the input");
+}
+
+/**
+ * @brief Queue output to a peer that then closes: draining it fails without SIGPIPE, the output is dropped
+ * and the handler is passed SC_Except even though it did not select for it.
+ * @param file Queue part of a file, sent with sendfile(2), rather than characters sent with sendmsg(2)
+ */
+static void writeQueueClosedPeer(bool file) {
+    string what = file ? "file " : "";
+    Server<EPollServerPolicy<unique_ptr<Socket>>> server{};
+    auto [writer, reader] = socketPair();
+    int small = 4096;
+    ::setsockopt(writer->fd(), SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    auto sock = server.push_front(std::move(writer));
+    (*sock)->setWriteQueue(64 * 1024);
+    (*sock)->openStream();
+    (*sock)->selectClients = SC_Read;
+
+    if (file) {
+        FILE *tmp = tmpfile();
+        string blob(1 << 20, 'f');
+        fwrite(blob.data(), 1, blob.size(), tmp);
+        fflush(tmp);
+        (*sock)->sendFile(fileno(tmp), 0, blob.size());
+        fclose(tmp);
+    } else {
+        string record(1024, 'q');
+        while ((*sock)->iostrm().write(record.data(), record.size()).flush()) {}
+    }
+    check((*sock)->outputQueued(), what + "output is queued for a peer that is not reading");
+    reader->close();
+
+    SelectClients seen = SC_None;
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+    while (!(seen & SC_Except) && chrono::steady_clock::now() < deadline) {
+        server.select(chrono::milliseconds(100));
+        server.poll_ready([&](auto &s, SelectClients events) {
+            seen = static_cast<SelectClients>(seen | events);
+            if (events & SC_Except)
+                s->close();
+        });
+    }
+    check(seen & SC_Except, "draining " + what + "output to a closed peer passes SC_Except, without SIGPIPE");
+    check(!(*sock)->outputQueued() && (*sock)->fd() < 0,
+          "the " + what + "output was dropped and the handler closed the socket");
+}
+
+/**
+ * @brief A write queue stops taking output at its high-water mark without blocking, and the Server drains it.
+ */
+static void writeQueue() {
+    Server<EPollServerPolicy<unique_ptr<Socket>>> server{};
+    auto [writer, reader] = socketPair();
+    int small = 4096;
+    ::setsockopt(writer->fd(), SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+
+    constexpr size_t highWater = 64 * 1024;
+    auto sock = server.push_front(std::move(writer));
+    (*sock)->setWriteQueue(highWater);
+    (*sock)->openStream();
+
+    // Nobody reads yet, so output queues until the stream refuses it.
+    auto &io = (*sock)->iostrm();
+    size_t written = 0;
+    char record[1024];
+    while (written < 16 * highWater) {
+        for (size_t i = 0; i < sizeof(record); ++i)
+            record[i] = static_cast<char>((written + i) % 251);
+        if (!io.write(record, sizeof(record)).flush())
+            break;
+        written += sizeof(record);
+    }
+    check(!io, "output fails at the high-water mark instead of blocking");
+    check(written < 16 * highWater, "the stream refused output after " + to_string(written) + " bytes");
+    check(!(*sock)->writable(), "writable() is false at the high-water mark");
+    check((*sock)->outputQueued(), "the unsent output is queued");
+    check(((*sock)->selection() & SC_Write) != 0, "a socket with queued output is selected for write");
+
+    // Reading the peer lets poll_ready() drain the queue.
+    size_t received = 0;
+    bool ordered = true;
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+    while (((*sock)->outputQueued() || received < written) && chrono::steady_clock::now() < deadline) {
+        ordered = readPattern(*reader, received) && ordered;
+        server.select(chrono::milliseconds(10));
+        server.poll_ready([](auto &, SelectClients) {});
+    }
+    ordered = readPattern(*reader, received) && ordered;
+    check(!(*sock)->outputQueued(), "poll_ready() drained the queue");
+    check((*sock)->writable(), "writable() is true again once drained");
+    check(ordered && received >= written && received < written + sizeof(record),
+          "the peer received the " + to_string(received) + " bytes in order");
+
+    writeQueueClosedPeer(false);
+    writeQueueClosedPeer(true);
+}
+
+/**
+ * @brief A Resolver completes on the loop and fills its cache, and cached names expire.
+ */
+static void resolver() {
+    AddressCache cache{};
+    Resolver resolver{cache};
+    Server<EPollServerPolicy<unique_ptr<Socket>>> server{};
+    server.watch(resolver.fd());
+
+    int status = -1;
+    size_t found = 0;
+    bool cached = resolver.resolve("localhost", "8000", AF_UNSPEC, [&](int s, const address_list &addrs) {
+        status = s;
+        found = addrs.size();
+    });
+    check(!cached, "an uncached name is resolved on the resolver thread");
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+    while (status < 0 && chrono::steady_clock::now() < deadline) {
+        server.select(chrono::milliseconds(100));
+        if (server.isReady(resolver.fd()))
+            resolver.complete();
+    }
+    check(status == 0 && found > 0, "the callback ran from complete() with " + to_string(found) + " addresses");
+
+    size_t hits = cache.hits();
+    bool called = false;
+    cached = resolver.resolve("localhost", "8000", AF_UNSPEC, [&](int s, const address_list &addrs) {
+        called = s == 0 && addrs.size() == found;
+    });
+    check(cached && called, "a cached name completes inside resolve()");
+    check(cache.hits() == hits + 1, "the cached lookup counts as a hit");
+
+    address_list addrs{};
+    check(cache.resolve("localhost", "no-such-service-name", AF_UNSPEC, addrs) != 0, "an unknown service fails");
+    check(!cache.find("localhost", "no-such-service-name", AF_UNSPEC, addrs), "a failed resolution is not cached");
+
+    cache.setTTL(chrono::seconds(1));
+    cache.clear();
+    check(cache.resolve("localhost", "8001", AF_UNSPEC, addrs) == 0, "resolve with a one second TTL");
+    check(cache.find("localhost", "8001", AF_UNSPEC, addrs), "the entry is found before it expires");
+    this_thread::sleep_for(chrono::milliseconds(1100));
+    check(!cache.find("localhost", "8001", AF_UNSPEC, addrs), "the entry is gone after its TTL");
+
+    cache.setTTL(chrono::seconds(0));
+    cache.resolve("localhost", "8002", AF_UNSPEC, addrs);
+    check(!cache.find("localhost", "8002", AF_UNSPEC, addrs), "a zero TTL disables caching");
+    server.unwatch(resolver.fd());
+}
+
+/**
+ * @brief Run a connectAsync() on a Server until the handler is passed the socket.
+ * @param port The port on localhost to connect to
+ * @param events Set to the events the handler saw, SC_None if it was not called
+ * @param fd Set to the socket's descriptor when it completed
+ * @return the value connectAsync() returned
+ */
+static int connectOnLoop(const string &port, SelectClients &events, int &fd) {
+    Server<EPollServerPolicy<unique_ptr<Socket>>> server{};
+    auto sock = server.push_front(make_unique<Socket>("localhost", port));
+    (*sock)->selectClients = SC_Read;
+    events = SC_None;
+    int started = (*sock)->connectAsync(chrono::seconds(5), AF_INET6, AF_INET);
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+    while (started == 0 && events == SC_None && chrono::steady_clock::now() < deadline) {
+        server.select(chrono::milliseconds(100));
+        server.poll_ready([&](auto &s, SelectClients e) {
+            events = e;
+            fd = s->fd();
+        });
+    }
+    if (started != 0)
+        fd = (*sock)->fd();
+    return started;
+}
+
+/**
+ * @brief connectAsync() completes on the loop, the handler sees SC_Write on success and SC_Except on failure.
+ */
+static void connectAsync() {
+    Socket listener{"", "0"};
+    if (listener.listen(16, AF_INET6) < 0) {
+        check(false, "listen");
+        return;
+    }
+    string port = localPort(listener);
+
+    SelectClients events;
+    int fd = -1;
+    int started = connectOnLoop(port, events, fd);
+    check(started == 1 || (started == 0 && events == SC_Write), "a connection to a listener is passed with SC_Write");
+    check(fd >= 0, "the connected socket has a descriptor");
+
+    // Close the listener so the port refuses connections.
+    listener.close();
+    fd = 0;
+    started = connectOnLoop(port, events, fd);
+    check(started == -1 || (started == 0 && events == SC_Except), "a refused connection is passed with SC_Except");
+    check(fd < 0, "the failed socket is closed");
+
+    fd = 0;
+    started = connectOnLoop("no-such-service", events, fd);
+    check(started == -1 || (started == 0 && events == SC_Except),
+          "a name that does not resolve is passed with SC_Except");
+    check(fd < 0, "the unresolved socket is closed");
+}
+
+/**
+ * @brief A HappyEyeballs race starts the next attempt as soon as one fails instead of waiting out the delay.
+ * @details The first address is a listener with a full accept queue, which drops the SYN so the attempt
+ * hangs; the second refuses; the third accepts. The third should start as the second fails, one delay
+ * after the first, not two.
+ */
+static void happyEyeballs() {
+    Socket full{"", "0"}, listener{"", "0"}, refusing{"", "0"};
+    if (full.listen(0, AF_INET6) < 0 || listener.listen(16, AF_INET6) < 0 || refusing.listen(16, AF_INET6) < 0) {
+        check(false, "listen");
+        return;
+    }
+    string port = localPort(listener);
+    address_list hanging{}, refused{}, open{};
+    AddressCache::getAddresses("localhost", localPort(full), AF_UNSPEC, hanging);
+    AddressCache::getAddresses("localhost", localPort(refusing), AF_UNSPEC, refused);
+    AddressCache::getAddresses("localhost", port, AF_UNSPEC, open);
+    refusing.close();
+
+    // Fill the accept queue until a connection is left waiting for its SYN to be answered.
+    vector<int> fillers{};
+    bool saturated = false;
+    for (int i = 0; i < 8 && !saturated && !hanging.empty(); ++i) {
+        auto &a = hanging.front();
+        int fd = ::socket(a.family, a.socktype | SOCK_NONBLOCK, a.protocol);
+        fillers.push_back(fd);
+        if (::connect(fd, reinterpret_cast<struct sockaddr *>(&a.addr), a.len) < 0 && errno == EINPROGRESS) {
+            struct pollfd pfd{fd, POLLOUT, 0};
+            saturated = ::poll(&pfd, 1, 100) == 0;
+        }
+    }
+    if (!saturated || refused.empty() || open.empty()) {
+        check(false, "a connection to a full accept queue hangs");
+        return;
+    }
+
+    address_list addrs{hanging.front(), refused.front(), open.front()};
+    constexpr auto delay = chrono::milliseconds(300);
+    auto start = HappyEyeballs::clock::now();
+    HappyEyeballs race{addrs, start + chrono::seconds(10), delay};
+    int result;
+    while ((result = race.progress()) == 0) {
+        struct pollfd pfd{race.fd(), POLLIN, 0};
+        ::poll(&pfd, 1, 1000);
+    }
+    auto took = chrono::duration_cast<chrono::milliseconds>(HappyEyeballs::clock::now() - start);
+    check(result == 1, "the race connects to the open port");
+    check(took >= delay && took < delay + delay / 2,
+          "the refused attempt started the next at once, " + to_string(took.count()) + " ms");
+    resolved_address peer{};
+    int fd = race.take(peer);
+    auto peerPort = peer.family == AF_INET6 ? reinterpret_cast<struct sockaddr_in6 *>(&peer.addr)->sin6_port
+                                            : reinterpret_cast<struct sockaddr_in *>(&peer.addr)->sin_port;
+    check(fd >= 0 && to_string(ntohs(peerPort)) == port, "the winner is connected to the open port");
+    ::close(fd);
+    for (auto f: fillers)
+        ::close(f);
+}
+
+/**
+ * @brief Close every connection waiting on a listener, as a peer that hangs up.
+ * @param listener The listen socket, non-blocking
+ * @return the number of connections closed
+ */
+static int hangUp(Socket &listener) {
+    int closed = 0;
+    for (int fd; (fd = ::accept(listener.fd(), nullptr, nullptr)) >= 0; ++closed)
+        ::close(fd);
+    return closed;
+}
+
+/**
+ * @brief A ConnectionPool reuses returned connections, enforces its limits, and evicts closed and expired ones.
+ */
+static void connectionPool() {
+    Socket listener{"", "0"};
+    if (listener.listen(16, AF_INET6) < 0) {
+        check(false, "listen");
+        return;
+    }
+    string port = localPort(listener);
+
+    ConnectionPool<Socket> pool{2, 3, chrono::milliseconds(50)};
+    auto a = pool.checkout("localhost", port);
+    auto b = pool.checkout("localhost", port);
+    check(a && b && pool.misses() == 2 && pool.hits() == 0, "the first checkouts connect");
+
+    Socket *reused = a.get();
+    pool.checkin(std::move(a));
+    check(pool.idle("localhost", port) == 1, "a checked in connection is idle");
+    auto c = pool.checkout("localhost", port);
+    check(c.get() == reused && pool.hits() == 1, "the idle connection is reused");
+
+    auto d = pool.checkout("localhost", port);
+    check(d != nullptr && pool.misses() == 3, "a third connection is made");
+    errno = 0;
+    auto e = pool.checkout("localhost", port);
+    check(!e && errno == EAGAIN && pool.misses() == 4, "a checkout beyond the connection limit fails with EAGAIN");
+
+    pool.checkin(std::move(b));
+    pool.checkin(std::move(c));
+    pool.checkin(std::move(d));
+    check(pool.idle("localhost", port) == 2, "no more than the idle limit is kept");
+
+    // The server closes its ends, so the idle connections are no longer healthy.
+    check(hangUp(listener) == 3, "the server closed its three connections");
+    this_thread::sleep_for(chrono::milliseconds(10));
+    auto f = pool.checkout("localhost", port);
+    check(f != nullptr && pool.evictions() == 2 && pool.misses() == 5,
+          "connections the peer closed are evicted and a new one made");
+
+    pool.checkin(std::move(f));
+    check(pool.evictIdle() == 0, "a fresh idle connection is kept");
+    this_thread::sleep_for(chrono::milliseconds(60));
+    check(pool.evictIdle() == 1 && pool.idle("localhost", port) == 0, "evictIdle() closes an expired connection");
+    check(pool.evictions() == 3, "the expiry counts as an eviction");
+}
+
+/**
+ * @brief A TimerWheel expires timers in order across its levels, skips cancelled ones, and drives select().
+ */
+static void timerWheel() {
+    auto start = TimerWheel::clock::now();
+    TimerWheel wheel{start};
+    vector<int> fired{};
+    Timer t300, t5, t70, t5000, cancelled, rescheduled;
+    wheel.schedule(t300, chrono::milliseconds(300), [&] { fired.push_back(300); });
+    wheel.schedule(t5, chrono::milliseconds(5), [&] { fired.push_back(5); });
+    wheel.schedule(t5000, chrono::milliseconds(5000), [&] { fired.push_back(5000); });
+    wheel.schedule(t70, chrono::milliseconds(70), [&] { fired.push_back(70); });
+    wheel.schedule(cancelled, chrono::milliseconds(100), [&] { fired.push_back(100); });
+    wheel.schedule(rescheduled, chrono::milliseconds(10), [&] { fired.push_back(10); });
+    {
+        Timer destroyed;
+        wheel.schedule(destroyed, chrono::milliseconds(50), [&] { fired.push_back(50); });
+    }
+    wheel.schedule(rescheduled, chrono::milliseconds(200), [&] { fired.push_back(200); });
+    cancelled.cancel();
+    check(!cancelled.active() && wheel.size() == 5, "cancelled and destroyed timers leave the wheel");
+    check(wheel.nextExpiry() <= TimerWheel::clock::now() + chrono::milliseconds(6), "nextExpiry() is the first timer");
+
+    check(wheel.advance(start + chrono::milliseconds(1)) == 0, "nothing expires early");
+    wheel.advance(start + chrono::milliseconds(250));
+    check(fired == vector<int>{5, 70, 200}, "the timers due by 250 ms expire in order");
+    check(t300.active() && !t70.active(), "expired timers are no longer active");
+    wheel.advance(start + chrono::seconds(10));
+    check(fired == vector<int>{5, 70, 200, 300, 5000}, "the rest expire in order, the cancelled one never");
+    check(wheel.size() == 0 && wheel.nextExpiry() == TimerWheel::clock::time_point::max(), "the wheel is empty");
+
+    // select() sleeps until the next timer and expires it, closing a socket cancels its timer.
+    Server<EPollServerPolicy<unique_ptr<Socket>>> server{};
+    auto [one, two] = socketPair();
+    auto sock = server.push_front(std::move(one));
+    bool timedOut = false, closedFired = false;
+    server.setTimer(*sock, chrono::milliseconds(20), [&] { closedFired = true; });
+    (*sock)->close();
+    Timer timer;
+    server.setTimer(timer, chrono::milliseconds(20), [&] { timedOut = true; });
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+    while (!timedOut && chrono::steady_clock::now() < deadline)
+        server.select(chrono::seconds(1));
+    check(timedOut, "select() expires a Server timer");
+    check(!closedFired, "closing a socket cancels its timer");
+}
+
+/**
+ * @brief read() and write() report IoWouldBlock, IoEof and IoError instead of -1 and errno.
+ */
+static void readWrite() {
+    auto [one, two] = socketPair();
+    array<byte, 4096> buffer{};
+
+    auto r = one->read(buffer, MSG_DONTWAIT);
+    check(!r && r.status == IoWouldBlock && r.bytes == 0, "reading an empty socket would block");
+
+    // Fill the socket until a non-blocking write would block.
+    int small = 4096;
+    ::setsockopt(two->fd(), SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    size_t written = 0;
+    io_result w;
+    while ((w = two->write(buffer, MSG_DONTWAIT)))
+        written += w.bytes;
+    check(w.status == IoWouldBlock && written > 0,
+          "writing a full socket would block after " + to_string(written) + " bytes");
+
+    size_t received = 0;
+    while ((r = one->read(buffer, MSG_DONTWAIT)))
+        received += r.bytes;
+    check(r.status == IoWouldBlock && received == written, "every byte written is read");
+
+    array<byte, 3> first{}, second{};
+    array<iovec, 2> iov{iovec{first.data(), first.size()}, iovec{second.data(), second.size()}};
+    array<byte, 6> six{byte{1}, byte{2}, byte{3}, byte{4}, byte{5}, byte{6}};
+    w = two->write(six);
+    r = one->readv(iov);
+    check(w.bytes == 6 && r.bytes == 6 && first[2] == byte{3} && second[0] == byte{4}, "readv() scatters in order");
+
+    two->close();
+    r = one->read(buffer, MSG_DONTWAIT);
+    check(r.status == IoEof && r.bytes == 0, "reading after the peer closed is IoEof");
+    w = one->write(six, MSG_DONTWAIT);
+    check(w.status == IoError && w.error == EPIPE, "writing after the peer closed is IoError EPIPE, without SIGPIPE");
+}
+
+/**
+ * @brief Write bytes following the pattern of offset % 251
+ * @param sock The socket
+ * @param sent The bytes sent so far, updated
+ * @param count How many bytes to write
+ */
+static void writePattern(Socket &sock, size_t &sent, size_t count) {
+    vector<byte> buffer(count);
+    for (size_t i = 0; i < count; ++i)
+        buffer[i] = static_cast<byte>((sent + i) % 251);
+    for (span<const byte> rest{buffer}; !rest.empty();) {
+        auto w = sock.write(rest);
+        if (!w)
+            return;
+        rest = rest.subspan(w.bytes);
+        sent += w.bytes;
+    }
+}
+
+/**
+ * @brief Read-ahead fills the stream buffer without blocking and keeps buffered input across reads and showmanyc().
+ */
+static void readAhead() {
+    auto [reader, writer] = socketPair();
+    reader->setReadAhead(4096);
+    reader->openStream();
+    auto &io = reader->iostrm();
+    auto sb = io.rdbuf();
+
+    size_t sent = 0, received = 0;
+    bool ordered = true;
+    auto take = [&](size_t count) {
+        for (size_t i = 0; i < count; ++i, ++received) {
+            int c = sb->sbumpc();
+            ordered = ordered && c == static_cast<int>(received % 251);
+        }
+    };
+
+    auto r = reader->fillInput();
+    check(r.status == IoWouldBlock && r.bytes == 0 && sb->in_avail() == 0, "an empty socket fills nothing");
+
+    writePattern(*writer, sent, 10000);
+    r = reader->fillInput();
+    check(r.status == IoOk && r.bytes == 4096, "fillInput() stops at the read-ahead limit");
+    check(sb->in_avail() == 4096, "in_avail() counts the buffered characters");
+
+    take(100);
+    reader->setReadAhead(64 * 1024);
+    r = reader->fillInput();
+    check(r.status == IoWouldBlock && r.bytes == 10000 - 4096, "fillInput() reads the rest until it would block");
+    check(sb->in_avail() == 9900, "the unread characters are kept when more are read");
+
+    writePattern(*writer, sent, 500);
+    check(sb->in_avail() == 9900, "showmanyc() is not asked while characters are buffered");
+    take(9900);
+    check(sb->in_avail() == 500, "showmanyc() reads ahead without blocking once the buffer is empty");
+    take(10);
+    writePattern(*writer, sent, 200);
+    check(sb->in_avail() == 490, "characters buffered by showmanyc() stay buffered");
+    take(490);
+    check(sb->in_avail() == 200 && reader->inputState() == IoWouldBlock, "showmanyc() found the rest");
+    take(200);
+    check(ordered && received == sent, "the " + to_string(received) + " characters arrived in order");
+
+    check(io.get() == char_traits<char>::eof() && reader->inputState() == IoWouldBlock,
+          "reading past the input fails without blocking, with inputState() IoWouldBlock");
+    io.clear();
+    writer->close();
+    r = reader->fillInput();
+    check(r.status == IoEof && reader->inputState() == IoEof, "fillInput() reports the peer closed");
+    check(sb->in_avail() == -1, "showmanyc() reports the end of the sequence");
+}
+
+/**
+ * @brief Flushes deferred to a FlushList are sent together by one send when the list is flushed.
+ * @details A SOCK_SEQPACKET pair delivers each send as one message, so the peer counts the sends.
+ */
+static void flushList() {
+    auto [writer, reader] = socketPair(SOCK_SEQPACKET);
+    FlushList list{};
+    writer->setFlushList(&list);
+    writer->openStream();
+    auto &io = writer->iostrm();
+
+    string expected{};
+    for (int i = 0; i < 5; ++i) {
+        string line = "deferred line " + to_string(i);
+        io << line << endl;
+        expected += line + '\n';
+    }
+    check(io.good(), "the stream accepts the deferred flushes");
+    check(list.size() == 1, "the stream buffer is listed once for several flushes");
+
+    array<char, 4096> buffer{};
+    ssize_t n = ::recv(reader->fd(), buffer.data(), buffer.size(), MSG_DONTWAIT);
+    check(n < 0 && errno == EAGAIN, "nothing is sent before the list is flushed");
+
+    check(list.flush() == 1 && list.size() == 0, "flush() sends the one listed stream buffer");
+    n = ::recv(reader->fd(), buffer.data(), buffer.size(), MSG_DONTWAIT);
+    check(n == static_cast<ssize_t>(expected.size()) && string(buffer.data(), n) == expected,
+          "one send carried all " + to_string(expected.size()) + " characters");
+    n = ::recv(reader->fd(), buffer.data(), buffer.size(), MSG_DONTWAIT);
+    check(n < 0 && errno == EAGAIN, "there was no second send");
+
+    io << "sent by close" << endl;
+    check(list.size() == 1, "a later flush is deferred again");
+    writer->close();
+    n = ::recv(reader->fd(), buffer.data(), buffer.size(), MSG_DONTWAIT);
+    check(n > 0 && string(buffer.data(), n) == "sent by close\n", "close() sends deferred output first");
+    check(list.size() == 0, "close() takes the stream buffer off the list");
+}
+
+/**
+ * @brief A Server accepting and closing connections one after another reuses its Sockets, their stream
+ * buffers, and the pooled buffer memory instead of allocating for each connection.
+ */
+static void socketReuse() {
+    Server<EPollServerPolicy<unique_ptr<Socket>>> server{};
+    auto listener = server.push_front(make_unique<Socket>("", "0"));
+    (*listener)->selectClients = SC_Read;
+    if ((*listener)->listen(16, AF_INET6) < 0) {
+        check(false, "listen");
+        return;
+    }
+    string port = localPort(**listener);
+
+    constexpr int connections = 20;
+    size_t warmAllocations = 0, outstanding = BufferPool::local()->outstanding();
+    streambuf *warmBuffer = nullptr;
+    bool sameBuffer = true, returned = true, checkedOut = true;
+    int answered = 0;
+    for (int i = 0; i < connections; ++i) {
+        Socket client{"localhost", port};
+        if (client.connect(AF_INET6, AF_INET) < 0) {
+            check(false, "connect " + to_string(i));
+            return;
+        }
+        string request = "request " + to_string(i) + "\n";
+        client.write(as_bytes(span{request}));
+
+        streambuf *buffer = nullptr;
+        bool closed = false;
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+        while (!closed && chrono::steady_clock::now() < deadline) {
+            server.select(chrono::milliseconds(100));
+            server.poll_ready([&](auto &sock, SelectClients events) {
+                if (server.isConnectRequest(sock)) {
+                    for (auto &accepted: server.acceptAll(sock)) {
+                        (*accepted)->openStream();
+                        (*accepted)->selectClients = SC_Read;
+                    }
+                } else if (events & SC_Read) {
+                    auto &io = sock->iostrm();
+                    string line;
+                    if (getline(io, line))
+                        io << line << endl;
+                    checkedOut = checkedOut && BufferPool::local()->outstanding() > outstanding;
+                    buffer = io.rdbuf();
+                    sock->close();
+                    closed = true;
+                }
+            });
+        }
+
+        array<byte, 64> reply{};
+        auto r = client.read(reply);
+        if (r && r.bytes == request.size())
+            ++answered;
+        // Let the server see the closed socket and take it back for reuse.
+        server.select(chrono::milliseconds(0));
+        server.poll_ready([](auto &, SelectClients) {});
+
+        if (i == 0) {
+            warmAllocations = server.socketAllocations();
+            warmBuffer = buffer;
+        } else {
+            sameBuffer = sameBuffer && buffer == warmBuffer;
+        }
+        returned = returned && BufferPool::local()->outstanding() == outstanding;
+    }
+
+    check(answered == connections, "every connection was answered");
+    check(warmAllocations == 1 && server.socketAllocations() == warmAllocations,
+          "sockets allocated stayed at " + to_string(server.socketAllocations()));
+    check(server.socketReuses() == connections - 1, "sockets reused grew to " + to_string(server.socketReuses()));
+    check(sameBuffer && warmBuffer != nullptr, "each reused socket kept its stream buffer");
+    check(checkedOut, "a connection holds pooled buffers while it is served");
+    check(returned, "the pooled buffers were all returned after each connection");
+}
+
+/**
+ * @brief Determine if a file descriptor is readable, waiting no longer than a timeout
+ * @param fd The file descriptor
+ * @param timeout How long to wait in milliseconds
+ * @return true if readable
+ */
+static bool readable(int fd, int timeout) {
+    struct pollfd p{fd, POLLIN, 0};
+    return ::poll(&p, 1, timeout) > 0 && (p.revents & POLLIN);
+}
+
+/**
+ * @brief Several producers push through a HandoffQueue to one consumer woken by its eventfd: nothing is lost
+ * or duplicated, each producer's order is kept, and a full queue refuses a value without taking it.
+ */
+static void handoffQueue() {
+    {
+        HandoffQueue<unique_ptr<int>> queue{2};
+        check(!readable(queue.fd(), 0), "an empty queue is not readable");
+        check(queue.push(make_unique<int>(1)) && readable(queue.fd(), 0), "the first push wakes the consumer");
+        check(queue.push(make_unique<int>(2)), "the queue takes a second value");
+        auto refused = make_unique<int>(3);
+        check(!queue.push(std::move(refused)) && refused && *refused == 3,
+              "a full queue refuses a value without moving from it");
+        uint64_t wakes = 0;
+        check(::read(queue.fd(), &wakes, sizeof(wakes)) == sizeof(wakes) && wakes == 1,
+              "two pushes to an empty queue write the eventfd once");
+        vector<int> taken{};
+        queue.drain([&](unique_ptr<int> &&v) { taken.push_back(*v); });
+        check(taken == vector<int>{1, 2}, "drain() takes the values in order");
+        check(!readable(queue.fd(), 0), "a drained queue is not readable");
+        check(queue.push(std::move(refused)) && readable(queue.fd(), 0), "a push after the drain wakes again");
+    }
+
+    constexpr int producers = 4, each = 50000;
+    HandoffQueue<unique_ptr<int>> queue{64};
+    atomic<int> full{0};
+    vector<thread> threads{};
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            for (int i = 0; i < each; ++i) {
+                auto v = make_unique<int>(p * each + i);
+                while (!queue.push(std::move(v))) {
+                    ++full;
+                    this_thread::yield();
+                }
+            }
+        });
+    }
+
+    vector<int> seen(producers * each, 0), last(producers, -1);
+    bool ordered = true;
+    int taken = 0, wakeups = 0;
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(30);
+    while (taken < producers * each && chrono::steady_clock::now() < deadline) {
+        if (!readable(queue.fd(), 100))
+            continue;
+        ++wakeups;
+        taken += static_cast<int>(queue.drain([&](unique_ptr<int> &&v) {
+            ++seen[*v];
+            int p = *v / each;
+            ordered = ordered && *v > last[p];
+            last[p] = *v;
+        }));
+    }
+    for (auto &t: threads)
+        t.join();
+    taken += static_cast<int>(queue.drain([&](unique_ptr<int> &&v) { ++seen[*v]; }));
+
+    check(taken == producers * each, "the consumer took " + to_string(taken) + " values, the queue was full " +
+                                     to_string(full.load()) + " times");
+    check(count(seen.begin(), seen.end(), 1) == producers * each, "every value was taken exactly once");
+    check(ordered, "each producer's values arrived in order");
+    check(wakeups > 0, "the consumer was woken " + to_string(wakeups) + " times by the eventfd");
+}
+
+/**
+ * @brief Make a temporary file holding the pattern of offset % 251
+ * @param size The size of the file
+ * @return the open file, deleted when it is closed
+ */
+static FILE *patternFile(size_t size) {
+    FILE *tmp = tmpfile();
+    string blob(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+        blob[i] = static_cast<char>(i % 251);
+    fwrite(blob.data(), 1, blob.size(), tmp);
+    fflush(tmp);
+    return tmp;
+}
+
+/**
+ * @brief Read everything a socket has without blocking
+ * @param sock The socket
+ * @param received Where to append what was read
+ */
+static void readAll(Socket &sock, string &received) {
+    array<byte, 16384> buffer{};
+    io_result r;
+    while ((r = sock.read(buffer, MSG_DONTWAIT)))
+        received.append(reinterpret_cast<const char *>(buffer.data()), r.bytes);
+}
+
+/**
+ * @brief sendFile() sends part of a file in order with the characters written before and after it, resumes
+ * a partial send from poll_ready(), and does not need the caller's descriptor after it returns.
+ */
+static void sendFile() {
+    constexpr size_t fileSize = 1 << 20, offset = 1000, length = 512 * 1024;
+    FILE *file = patternFile(fileSize);
+    string content(length, '\0');
+    for (size_t i = 0; i < length; ++i)
+        content[i] = static_cast<char>((offset + i) % 251);
+
+    // Blocking output: the file is sent before sendFile() returns, a reader thread empties the socket.
+    {
+        auto [writer, reader] = socketPair();
+        writer->openStream();
+        string received{};
+        thread peer{[&, fd = reader->fd()] {
+            char buffer[16384];
+            ssize_t n;
+            while ((n = ::recv(fd, buffer, sizeof(buffer), 0)) > 0)
+                received.append(buffer, n);
+        }};
+        writer->iostrm() << "head\n";
+        int r = writer->sendFile(fileno(file), offset, length);
+        writer->iostrm() << "tail\n" << flush;
+        writer->close();
+        peer.join();
+        check(r == 0 && received == "head\n" + content + "tail\n",
+              "blocking sendFile() sends the file range between the writes around it");
+    }
+
+    // Non-blocking output: what the socket will not take is queued and sent by poll_ready().
+    Server<EPollServerPolicy<unique_ptr<Socket>>> server{};
+    auto [writer, reader] = socketPair();
+    int small = 4096;
+    ::setsockopt(writer->fd(), SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    auto sock = server.push_front(std::move(writer));
+    (*sock)->setWriteQueue(64 * 1024);
+    (*sock)->openStream();
+    (*sock)->selectClients = SC_Read;
+
+    auto &io = (*sock)->iostrm();
+    io << "head\n";
+    int r = (*sock)->sendFile(fileno(file), offset, length);
+    fclose(file);
+    io << "tail\n" << flush;
+    check(r == 0 && io.good(), "non-blocking sendFile() succeeds");
+    check((*sock)->outputQueued(), "the part of the file the socket would not take is queued");
+
+    string received{};
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+    while ((*sock)->outputQueued() && chrono::steady_clock::now() < deadline) {
+        readAll(*reader, received);
+        server.select(chrono::milliseconds(10));
+        server.poll_ready([](auto &, SelectClients) {});
+    }
+    readAll(*reader, received);
+    check(!(*sock)->outputQueued(), "poll_ready() sent the rest of the file");
+    check(received == "head\n" + content + "tail\n",
+          "the peer received the " + to_string(received.size()) + " bytes in order after the caller closed the file");
+}
+
+/**
+ * @brief A SpliceProxy forwards both ways, stops reading while a pipe is full, passes on a half-close and
+ * closes both sockets when both directions have finished.
+ */
+static void spliceProxy() {
+    Server<EPollServerPolicy<unique_ptr<Socket>>> server{};
+    auto [clientApp, clientEnd] = socketPair();
+    auto [upstreamEnd, upstreamApp] = socketPair();
+    int small = 4096;
+    ::setsockopt(upstreamEnd->fd(), SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+    auto client = server.push_front(std::move(clientEnd));
+    auto upstream = server.push_front(std::move(upstreamEnd));
+    auto proxy = SpliceProxy::join(**client, **upstream, 4096);
+    clientApp->socketFlags(true, O_NONBLOCK);
+
+    auto loop = [&](const function<bool()> &done) {
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+        while (!done() && chrono::steady_clock::now() < deadline) {
+            server.select(chrono::milliseconds(10));
+            server.poll_ready([](auto &, SelectClients) { check(false, "the proxy sockets bypass the handler"); });
+        }
+        return done();
+    };
+
+    string request{"request\n"}, response{"response\n"}, up{}, down{};
+    clientApp->write(as_bytes(span{request}));
+    upstreamApp->write(as_bytes(span{response}));
+    loop([&] {
+        readAll(*upstreamApp, up);
+        readAll(*clientApp, down);
+        return up == request && down == response;
+    });
+    check(up == request, "the client's bytes reach the upstream");
+    check(down == response, "the upstream's bytes reach the client");
+
+    // The upstream stops reading: the socket buffers and the pipe fill and the proxy stops reading the client.
+    size_t sent = 0, received = 0;
+    bool stalled = loop([&] {
+        writePattern(*clientApp, sent, 4096);
+        return !((*client)->selectClients & SC_Read);
+    });
+    check(stalled && ((*upstream)->selectClients & SC_Write), "a full pipe stops reading the client after " +
+                                                               to_string(sent) + " bytes and waits to write upstream");
+    bool ordered = true;
+    loop([&] {
+        ordered = readPattern(*upstreamApp, received) && ordered;
+        return received == sent;
+    });
+    check(ordered && received == sent, "the upstream received all " + to_string(received) + " bytes in order");
+    check(((*client)->selectClients & SC_Read) != 0, "the client is read again once the pipe drains");
+
+    // The client shuts down its writes, the upstream sees end of file and can still answer.
+    ::shutdown(clientApp->fd(), 1);
+    array<byte, 16> buffer{};
+    io_result r{};
+    loop([&] { return (r = upstreamApp->read(buffer, MSG_DONTWAIT)).status == IoEof; });
+    check(r.status == IoEof, "the client's half-close reaches the upstream");
+    string late{"after half-close\n"};
+    down.clear();
+    upstreamApp->write(as_bytes(span{late}));
+    loop([&] {
+        readAll(*clientApp, down);
+        return down == late;
+    });
+    check(down == late, "the upstream still reaches the client after the half-close");
+    check(!proxy->closed(), "the proxy is open while one direction is");
+
+    ::shutdown(upstreamApp->fd(), 1);
+    loop([&] { return proxy->closed(); });
+    check(proxy->closed() && (*client)->fd() < 0 && (*upstream)->fd() < 0,
+          "both sockets are closed when both directions have finished");
+    r = clientApp->read(buffer, MSG_DONTWAIT);
+    check(r.status == IoEof, "the client sees end of file");
+}
+
+using TaskServer = Server<EPollServerPolicy<unique_ptr<Socket>>>;
+
+/**
+ * @brief Sets a flag when destroyed, to see a coroutine frame freed.
+ */
+struct FrameGuard {
+    bool &destroyed;    ///< Set by the destructor
+
+    ~FrameGuard() { destroyed = true; }
+};
+
+/**
+ * @brief Echo what a client sends, each chunk after a short sleep, until it shuts down.
+ */
+static Task echoTask(TaskServer *server, Socket *client, size_t *echoed) {
+    array<byte, 64> buffer{};
+    for (ssize_t n; (n = co_await client->readAsync(buffer)) > 0;) {
+        co_await server->sleepFor(chrono::milliseconds(5));
+        if (co_await client->writeAsync(span{buffer}.first(static_cast<size_t>(n))) != n)
+            break;
+        *echoed += static_cast<size_t>(n);
+    }
+    client->close();
+}
+
+/**
+ * @brief Accept one connection and echo on it.
+ */
+static Task acceptTask(TaskServer *server, unique_ptr<Socket> *listener, size_t *echoed) {
+    if (Socket *client = co_await server->acceptAsync(*listener))
+        echoTask(server, client, echoed);
+}
+
+/**
+ * @brief Wait for data, recording the result and errno.
+ */
+static Task readTask(Socket *sock, ssize_t *result, int *error) {
+    array<byte, 16> buffer{};
+    *result = co_await sock->readAsync(buffer);
+    *error = errno;
+}
+
+/**
+ * @brief Wait for data that never comes, the frame is destroyed with the socket.
+ */
+static Task abandonedTask(Socket *sock, bool *destroyed, bool *resumed) {
+    FrameGuard guard{*destroyed};
+    array<byte, 16> buffer{};
+    co_await sock->readAsync(buffer);
+    *resumed = true;
+}
+
+/**
+ * @brief Coroutines accept, read, sleep and write on the Server's loop, a close() resumes a suspended
+ * operation with ECANCELED, and destroying a socket frees the frame suspended on it.
+ */
+static void coroutines() {
+    TaskServer server{};
+    auto listener = server.push_front(make_unique<Socket>("", "0"));
+    if ((*listener)->listen(16, AF_INET6) < 0) {
+        check(false, "listen");
+        return;
+    }
+    size_t echoed = 0;
+    acceptTask(&server, &*listener, &echoed);
+
+    Socket client{"localhost", localPort(**listener)};
+    client.connect(AF_INET6, AF_INET);
+    string sent{"a coroutine echoes this\n"}, received{};
+    client.write(as_bytes(span{sent}));
+    auto start = chrono::steady_clock::now(), deadline = start + chrono::seconds(5);
+    auto loop = [&](const function<bool()> &done) {
+        while (!done() && chrono::steady_clock::now() < deadline) {
+            server.select(chrono::milliseconds(10));
+            server.poll_ready([](auto &, SelectClients) { check(false, "coroutine sockets bypass the handler"); });
+        }
+        return done();
+    };
+    loop([&] {
+        readAll(client, received);
+        return received == sent;
+    });
+    check(received == sent && echoed == sent.size(), "the echo task sent back what it read");
+    check(chrono::steady_clock::now() - start >= chrono::milliseconds(5), "the echo slept before writing");
+
+    ::shutdown(client.fd(), 1);
+    array<byte, 16> buffer{};
+    io_result r{};
+    loop([&] { return (r = client.read(buffer, MSG_DONTWAIT)).status == IoEof; });
+    check(r.status == IoEof, "the echo task closed its socket when the client shut down");
+
+    auto [reader, peer] = socketPair();
+    ssize_t result = 0;
+    int error = 0;
+    readTask(reader.get(), &result, &error);
+    reader->close();
+    check(result == -1 && error == ECANCELED, "close() resumes a suspended read with ECANCELED");
+
+    auto [abandoned, other] = socketPair();
+    bool destroyed = false, resumed = false;
+    abandonedTask(abandoned.get(), &destroyed, &resumed);
+    check(!destroyed, "the task is suspended on its socket");
+    abandoned.reset();
+    check(destroyed && !resumed, "destroying the socket destroys the suspended frame without resuming it");
+}
+
+int main(int argc, char **argv) {
+    map<string, function<void()>> checks{
+            {"echo", echo},
+            {"echo_uring", echoURing},
+            {"uring_rearm", uringRearm},
+            {"uring_feed", uringFeed},
+            {"write_queue", writeQueue},
+            {"resolver", resolver},
+            {"connect_async", connectAsync},
+            {"happy_eyeballs", happyEyeballs},
+            {"connection_pool", connectionPool},
+            {"timer_wheel", timerWheel},
+            {"read_write", readWrite},
+            {"read_ahead", readAhead},
+            {"flush_list", flushList},
+            {"socket_reuse", socketReuse},
+            {"handoff_queue", handoffQueue},
+            {"send_file", sendFile},
+            {"splice_proxy", spliceProxy},
+            {"coroutines", coroutines},
+    };
+
+    for (auto &[name, run]: checks) {
+        if (argc > 1 && name != argv[1])
+            continue;
+        cout << name << endl;
+        run();
+    }
+
+    if (failures)
+        cout << failures << " checks failed" << endl;
+    else if (skips)
+        cout << skips << " checks skipped" << endl;
+    else
+        cout << "all checks passed" << endl;
+    return failures ? 1 : skips ? skipped_exit : 0;
+}
@@ -6,13 +6,136 @@
 #define EZNETWORK_SOCKET_BUFFER_H
 
 #include <iostream>
+#include <string>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include "buffer_pool.h"
+#include "basic_socket.h"
 
 using namespace std;
 
 namespace async_net {
+
+    class socket_streambuf;
+
+    /**
+     * @brief The stream buffers whose flushes have been deferred, see socket_streambuf::setFlushList().
+     * @details A Server flushes its list once per loop iteration, before it waits, so everything written to
+     * a connection in one iteration is sent together.
+     */
+    class FlushList {
+    public:
+        FlushList() : buffers{} {}
+
+        FlushList(const FlushList &) = delete;
+
+        FlushList &operator=(const FlushList &) = delete;
+
+        inline ~FlushList();
+
+        /**
+         * @brief Send the output of every listed stream buffer and empty the list
+         * @return the number of stream buffers flushed
+         */
+        inline size_t flush();
+
+        /**
+         * @brief Get the number of stream buffers waiting to be flushed
+         * @return the number of stream buffers
+         */
+        size_t size() const { return buffers.size(); }
+
+    protected:
+        friend class socket_streambuf;
+
+        vector<socket_streambuf *> buffers;     ///< The stream buffers waiting to be flushed
+    };
+
+
+    /**
+     * @brief An I/O engine that receives into and sends from a socket_streambuf, see socket_streambuf::setFeed().
+     * @details The engine delivers the input it receives with socket_streambuf::deliver() and sends the output
+     * of deferred flushes itself. While a send is in flight the output it covers must not move, so the stream
+     * buffer settles it before changing that output or sending directly.
+     */
+    class StreamFeed {
+    public:
+        /**
+         * @brief Deliver the input that has arrived for a stream buffer
+         * @param fd The socket
+         * @param stream The stream buffer
+         * @param block Wait until input, end of file or an error has been delivered
+         */
+        virtual void receive(int fd, socket_streambuf &stream, bool block) = 0;
+
+        /**
+         * @brief Queue a send of the stream buffer's output, submitted with the engine's next wait
+         * @param fd The socket
+         * @param stream The stream buffer
+         */
+        virtual void send(int fd, socket_streambuf &stream) = 0;
+
+        /**
+         * @brief Finish or cancel the send in flight for a stream buffer, returning when it has completed
+         * @param fd The socket
+         * @param stream The stream buffer
+         */
+        virtual void settle(int fd, socket_streambuf &stream) = 0;
+
+        /**
+         * @brief Stop feeding a stream buffer that is being reset or destroyed
+         * @param fd The socket
+         * @param stream The stream buffer
+         */
+        virtual void detach(int fd, socket_streambuf &stream) = 0;
+
+    protected:
+        ~StreamFeed() = default;
+    };
+
+
 /**
  * @brief A streambuf which abstracts the socket file descriptor allowing the use of
  * standard iostreams.
+ * @details The output buffer is a ring. Characters that could not be sent stay where they are and new
+ * output wraps around to the start of the buffer, so both parts are sent together with one sendmsg(2)
+ * and nothing is ever moved.
+ *
+ * By default output is sent with blocking calls. setWriteQueue() selects non-blocking output: output that
+ * can not be sent without blocking is queued, and when the ring is full its contents are moved to a
+ * queue of spilled chunks, until the amount queued reaches a high-water mark. At the high-water mark
+ * output fails, so a slow peer stalls only its own stream.
+ *
+ * sendFile() queues part of a file behind the output already written; it is sent by sendfile(2) straight
+ * from the page cache when the output ahead of it has been sent.
+ *
+ * setFlushList() defers flushing: a flush of the stream only puts the buffer on a FlushList and its
+ * output is sent when the list is flushed, so several flushes in one event loop iteration cost one
+ * sendmsg(2). flushNow() still sends at once.
+ *
+ * By default each underflow blocks for a single recv(2). setReadAhead() selects non-blocking input for
+ * edge-triggered readiness: every read from the socket repeats until it would block, growing the input
+ * buffer as needed, and never discards characters already buffered. inputState() tells a reader that has
+ * run out of input whether more may arrive or the peer has closed.
+ *
+ * setFeed() hands the socket to an I/O engine such as URing_Set, which receives for the stream and delivers
+ * the input, so the stream never reads the socket itself, and sends the output of deferred flushes.
+ *
+ * The input and output buffers are checked out of the BufferPool of the calling thread when they are first
+ * needed. The output buffer is returned as soon as all output has been sent and trim() returns any empty
+ * buffer, so an idle connection holds no buffer memory.
  */
     class socket_streambuf : public std::streambuf {
     public:
@@ -23,6 +146,7 @@ namespace async_net {
 
         constexpr static size_t buffer_size = BUFSIZ;       ///< System specified size of buffers
         constexpr static size_t pushback_size = 8;          ///< The minimum number of characters that may be pushed back
+        constexpr static size_t iov_count = 16;             ///< The maximum number of parts sent by one sendmsg(2)
 
         socket_streambuf() = delete;
 
@@ -30,99 +154,932 @@ namespace async_net {
          * @brief Create a socket stream buffer interfaced to a Socket object file descriptor.
          * @param sock
          */
-        explicit socket_streambuf(int sock) : sockfd(sock), obuf{}, ibuf{} {
-            this->setp(obuf, obuf + buffer_size);
-            this->setg(ibuf, ibuf + pushback_size, ibuf + pushback_size);
+        explicit socket_streambuf(int sock) : sockfd(sock), obuf{nullptr}, ibuf{nullptr}, o_head{nullptr},
+                                              o_wrap{nullptr}, o_spill{}, o_spillHead{0}, o_spillBytes{0},
+                                              o_fileBytes{0}, high_water{0}, i_size{0}, read_ahead{0},
+                                              i_state{IoOk}, flush_list{nullptr}, flush_listed{false},
+                                              flush_cork{false}, output_notify{}, feed{nullptr}, o_msg{},
+                                              o_iov{}, o_sending{false}, i_backlog{}, i_backlogBytes{0},
+                                              i_end{IoOk}, i_endError{0} {
+            this->setp(nullptr, nullptr);
+            this->setg(nullptr, nullptr, nullptr);
+        }
+
+        socket_streambuf(const socket_streambuf &) = delete;
+
+        socket_streambuf &operator=(const socket_streambuf &) = delete;
+
+        ~socket_streambuf() override {
+            unlist();
+            if (feed)
+                feed->detach(sockfd, *this);
+            BufferPool::release(obuf, buffer_size);
+            BufferPool::release(ibuf, i_size);
+        }
+
+
+        /**
+         * @brief Return empty buffers to the pool.
+         * @details Call when the connection goes idle. The output buffer is returned if all of it has been
+         * sent and the input buffer if all of it has been read; characters already read can then no longer
+         * be put back.
+         */
+        void trim() {
+            if (!o_wrap && pptr() == o_head)
+                releaseOutput();
+            if (gptr() == egptr() && i_backlog.empty())
+                releaseInput();
+        }
+
+
+        /**
+         * @brief Empty the stream buffer and attach it to another socket, as if newly constructed.
+         * @param sock The socket file descriptor
+         * @details Unsent output is discarded and the buffers are returned to the pool.
+         */
+        void reset(int sock) {
+            unlist();
+            if (feed)
+                feed->detach(sockfd, *this);
+            i_backlog.clear();
+            i_backlogBytes = 0;
+            i_end = IoOk;
+            i_endError = 0;
+            flush_list = nullptr;
+            flush_cork = false;
+            BufferPool::release(obuf, buffer_size);
+            BufferPool::release(ibuf, i_size);
+            obuf = ibuf = o_head = o_wrap = nullptr;
+            i_size = 0;
+            o_spill.clear();
+            o_spillHead = o_spillBytes = o_fileBytes = 0;
+            high_water = read_ahead = 0;
+            i_state = IoOk;
+            sockfd = sock;
+            this->setp(nullptr, nullptr);
+            this->setg(nullptr, nullptr, nullptr);
+        }
+
+
+        /**
+         * @brief Select blocking or non-blocking, queued, output.
+         * @param highWater When 0 output blocks until it is sent. Otherwise output is sent without blocking and
+         * what can not be sent is queued until the amount queued reaches highWater.
+         */
+        void setWriteQueue(size_t highWater) { high_water = highWater; }
+
+
+        /**
+         * @brief Set a function called when non-blocking output may have become queued or finished sending
+         * @param notify the function, or nullptr
+         * @details A Socket uses it to have its Server select it for write only while output is queued.
+         */
+        void setOutputNotify(function<void()> notify) { output_notify = std::move(notify); }
+
+
+        /**
+         * @brief Defer flushes of the stream to a FlushList, or flush at once.
+         * @param list The list, or nullptr to flush at once; output already deferred is flushed first
+         * @param cork Set TCP_CORK while flushing output that includes part of a file, so the characters
+         * before and after it share packets with the file
+         */
+        void setFlushList(FlushList *list, bool cork = false) {
+            if (list != flush_list)
+                flushDeferred();
+            flush_list = list;
+            flush_cork = cork;
+        }
+
+
+        /**
+         * @brief Send the output now, whether or not flushes are deferred
+         * @return 0 on success, -1 on failure.
+         */
+        int flushNow() {
+            if (!flush_cork || o_fileBytes == 0 || sockfd < 0)
+                return sendOutput();
+
+            int on = 1;
+            ::setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+            int result = sendOutput();
+            int err = errno;
+            on = 0;
+            ::setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+            errno = err;
+            return result;
+        }
+
+
+        /**
+         * @brief Send the output if a flush has been deferred
+         * @return 0 on success or if no flush was deferred, -1 on failure.
+         */
+        int flushDeferred() {
+            if (!flush_listed)
+                return 0;
+            unlist();
+            return flushNow();
+        }
+
+
+        /**
+         * @brief Select blocking input, or non-blocking input that reads ahead.
+         * @param limit When 0 each underflow blocks for a single recv(2). Otherwise input never blocks and each
+         * read from the socket repeats until it would block, the peer closes, or limit characters are
+         * buffered, growing the input buffer up to BufferPool::max_size as needed.
+         * @details With edge-triggered readiness a reader must consume the input until inputState() is not
+         * IoOk, since stopping at the limit leaves input the readiness engine will not report again.
+         */
+        void setReadAhead(size_t limit) { read_ahead = min(limit, BufferPool::max_size - pushback_size); }
+
+
+        /**
+         * @brief Read everything the socket has without blocking, after the input already buffered.
+         * @return the number of characters read with IoWouldBlock when the socket has no more, IoEof when the
+         * peer has closed, IoError, or IoOk when reading stopped at the read-ahead limit
+         */
+        io_result fill() {
+            if (sockfd < 0)
+                return io_result{0, IoError, EBADF};
+            return readInput(MSG_DONTWAIT);
+        }
+
+
+        /**
+         * @brief Get the outcome of the last read from the socket
+         * @return IoWouldBlock or IoEof after a read that found no input, IoError after a failure, otherwise IoOk
+         */
+        IoStatus inputState() const { return i_state; }
+
+
+        /**
+         * @brief Send part of a file after the output already written to the stream.
+         * @param fd The file, it is duplicated so the caller may close it
+         * @param offset The offset of the first byte to send
+         * @param length The number of bytes to send
+         * @details With blocking output the file is sent before returning. With non-blocking output what can
+         * not be sent is queued and sent as the socket becomes writable; queued file bytes do not count
+         * towards the high-water mark.
+         * @return 0 on success, -1 on failure.
+         */
+        int sendFile(int fd, off_t offset, size_t length) {
+            if (sockfd < 0)
+                return -1;
+            if (length == 0)
+                return sync();
+
+            int file = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+            if (file < 0)
+                return -1;
+
+            if (buffered() > o_spillBytes)
+                spill();
+            o_spill.emplace_back(file, offset, length);
+            o_fileBytes += length;
+            notifyOutput();
+            return sync();
+        }
+
+
+        /**
+         * @brief Drop the unsent output, such as after sending it has failed.
+         * @details The stream is taken off the flush list and the owner told the output is no longer queued.
+         */
+        void discardOutput() {
+            settle();
+            bool wasQueued = queued();
+            unlist();
+            o_spill.clear();
+            o_spillHead = o_spillBytes = o_fileBytes = 0;
+            if (obuf)
+                releaseOutput();
+            if (wasQueued && output_notify)
+                output_notify();
+        }
+
+
+        /**
+         * @brief Get the number of output characters that have not been sent.
+         * @return the number of characters, including queued file bytes
+         */
+        size_t pending() const { return buffered() + o_fileBytes; }
+
+
+        /**
+         * @brief Determine if output is queued waiting for the socket to become writable.
+         * @return true if output is non-blocking and there is unsent output that is not being sent by the feed
+         */
+        bool queued() const { return high_water && pending() && !o_sending; }
+
+
+        /**
+         * @brief Determine if more output will be accepted.
+         * @return false if output is non-blocking and the amount queued has reached the high-water mark
+         */
+        bool writable() const { return !high_water || buffered() < high_water; }
+
+
+        /**
+         * @brief Hand the socket to an I/O engine, or take it back
+         * @param engine The engine, or nullptr; the engine calls this, after settling any send in flight
+         * @details While fed the stream never reads the socket: input is what the engine has delivered, a
+         * non-blocking read asks the engine for what has arrived and a blocking one waits on the engine. Do
+         * not also read the socket directly, input would be taken out of order.
+         */
+        void setFeed(StreamFeed *engine) {
+            feed = engine;
+            o_sending = false;
+        }
+
+
+        /**
+         * @brief Add input received by the engine after the input already buffered
+         * @param data The characters
+         * @param n The number of characters
+         * @details What does not fit in the largest input buffer is kept in order until it is read.
+         */
+        void deliver(const char_type *data, size_t n) {
+            while (n && i_backlog.empty()) {
+                reserveInput();
+                size_t take = min(static_cast<size_t>(ibuf + i_size - egptr()), n);
+                if (take == 0)
+                    break;
+                memcpy(egptr(), data, take);
+                this->setg(eback(), gptr(), egptr() + take);
+                data += take;
+                n -= take;
+            }
+            if (n) {
+                i_backlog.emplace_back(data, n);
+                i_backlogBytes += n;
+            }
+        }
+
+
+        /**
+         * @brief Record that the engine received end of file or an error, after the input delivered so far
+         * @param state IoEof or IoError
+         * @param error The error for IoError
+         */
+        void deliverEnd(IoStatus state, int error) {
+            i_end = state;
+            i_endError = error;
+        }
+
+
+        /**
+         * @brief Determine if the engine should receive more input for the stream
+         * @return false at end of file, after an error, or while the unread input is at the read-ahead limit
+         */
+        bool wantsInput() const {
+            return i_end == IoOk && unread() < (read_ahead ? read_ahead : buffer_size - pushback_size);
+        }
+
+
+        /**
+         * @brief Determine if a read of the stream will not wait on the engine
+         * @return true if delivered input is unread, or the end of the input has been delivered
+         */
+        bool inputReady() const { return unread() > 0 || i_end != IoOk; }
+
+
+        /**
+         * @brief Describe the unsent output for the engine to send, marking it in flight
+         * @return the message, valid until endSend(), or nullptr if there is nothing the engine can send
+         * because a send is in flight, nothing is unsent or the output starts with part of a file
+         */
+        const struct msghdr *beginSend() {
+            if (o_sending || sockfd < 0)
+                return nullptr;
+            size_t n = gather(o_iov);
+            if (n == 0)
+                return nullptr;
+            o_msg = msghdr{};
+            o_msg.msg_iov = o_iov;
+            o_msg.msg_iovlen = n;
+            o_sending = true;
+            return &o_msg;
+        }
+
+
+        /**
+         * @brief Account for the completion of a send started by beginSend()
+         * @param result The number of characters sent, or a negative errno
+         * @return true if output is blocking and some is left to send, which the engine sends next; output left
+         * starting with part of a file is sent at once instead
+         * @details Non-blocking output left unsent is queued, so the owner selects the socket for write.
+         */
+        bool endSend(ssize_t result) {
+            o_sending = false;
+            if (result > 0)
+                consume(static_cast<size_t>(result));
+            if (queued() && output_notify)
+                output_notify();
+            if (result <= 0 || high_water || !pending())
+                return false;
+            if (!o_spill.empty() && o_spill.front().file >= 0) {
+                flushNow();
+                return false;
+            }
+            return true;
+        }
+
+        bool sending() const { return o_sending; }      ///< True while the engine has a send in flight
+
+        int sendFlags() const {     ///< The sendmsg(2) flags for the engine's sends
+            return (high_water ? MSG_DONTWAIT : 0) | MSG_NOSIGNAL;
         }
 
     protected:
         int sockfd;                           ///< The Socket object this buffer interfaces with
-        char_type obuf[buffer_size];                    ///< The output stream buffer
-        char_type ibuf[buffer_size + pushback_size];    ///< The input stream buffer and pushback space
+        char_type *obuf;        ///< The output stream ring buffer, nullptr while it is in the pool
+        char_type *ibuf;        ///< The input stream buffer and pushback space, nullptr while it is in the pool
+
+        char_type *o_head;      ///< The oldest unsent output character
+        char_type *o_wrap;      ///< The end of the older unsent output when the output wraps, otherwise nullptr
+
+        /**
+         * @brief A queued part of the output, either spilled characters or part of a file.
+         */
+        struct spill_chunk {
+            string data;        ///< The spilled characters
+            int file;           ///< The file to send from, or -1 for spilled characters
+            off_t offset;       ///< The offset of the next file byte to send
+            size_t length;      ///< The number of file bytes left to send
+
+            explicit spill_chunk(string &&chars) : data{std::move(chars)}, file{-1}, offset{0}, length{0} {}
+
+            spill_chunk(int fd, off_t off, size_t len) : data{}, file{fd}, offset{off}, length{len} {}
+
+            spill_chunk(spill_chunk &&other) noexcept :
+                    data{std::move(other.data)}, file{other.file}, offset{other.offset}, length{other.length} {
+                other.file = -1;
+            }
+
+            spill_chunk &operator=(spill_chunk &&) = delete;
+
+            ~spill_chunk() {
+                if (file >= 0)
+                    ::close(file);
+            }
+        };
+
+        deque<spill_chunk> o_spill; ///< Queued output older than the contents of the ring
+        size_t o_spillHead;     ///< The number of characters of the first spilled chunk already sent
+        size_t o_spillBytes;    ///< The number of unsent spilled characters
+        size_t o_fileBytes;     ///< The number of unsent queued file bytes
+        size_t high_water;      ///< The high-water mark of queued output, 0 for blocking output
+
+        size_t i_size;          ///< The size of the input buffer
+        size_t read_ahead;      ///< The most input to buffer ahead, 0 for blocking input
+        IoStatus i_state;       ///< The outcome of the last read from the socket
+
+        FlushList *flush_list;  ///< Where flushes are deferred, or nullptr to flush at once
+        bool flush_listed;      ///< True while on the flush list
+        bool flush_cork;        ///< Cork the socket while flushing output that includes part of a file
+        function<void()> output_notify;     ///< Called when queued() may have changed
+
+        StreamFeed *feed;       ///< The engine receiving and sending for the stream, or nullptr
+        struct msghdr o_msg;    ///< The message of the send in flight
+        struct iovec o_iov[iov_count];  ///< The parts of the send in flight
+        bool o_sending;         ///< True while the engine has a send in flight
+        deque<string> i_backlog;    ///< Delivered input that did not fit in the input buffer
+        size_t i_backlogBytes;  ///< The number of characters in the backlog
+        IoStatus i_end;         ///< IoEof or IoError once the engine has delivered the end of the input
+        int i_endError;         ///< The error of IoError
+
+        friend class FlushList;
+
+        /**
+         * @brief Get the number of delivered characters not yet read
+         * @return the characters in the get area and the backlog
+         */
+        size_t unread() const { return (egptr() - gptr()) + i_backlogBytes; }
+
+        /**
+         * @brief Wait for, or cancel, a send the engine has in flight so the output may change
+         */
+        void settle() {
+            if (o_sending && feed)
+                feed->settle(sockfd, *this);
+        }
+
+        /**
+         * @brief Send the output of a deferred flush, through the engine if the stream is fed
+         */
+        void flushBatched() {
+            if (feed && o_sending)
+                return;     // The send in flight is followed up when it completes.
+            bool fileFirst = !o_spill.empty() && o_spill.front().file >= 0;
+            if (!feed || sockfd < 0 || fileFirst || (flush_cork && o_fileBytes)) {
+                flushNow();
+                return;
+            }
+            bool wasQueued = queued();
+            feed->send(sockfd, *this);
+            if (queued() != wasQueued && output_notify)
+                output_notify();
+        }
+
+        /**
+         * @brief Take the stream buffer off the flush list without sending its output
+         */
+        void unlist() {
+            if (!flush_listed)
+                return;
+            flush_listed = false;
+            auto &buffers = flush_list->buffers;
+            auto self = find(buffers.begin(), buffers.end(), this);
+            if (self != buffers.end()) {
+                *self = buffers.back();
+                buffers.pop_back();
+            }
+        }
+
+        constexpr static size_t sendfile_max = 0x7ffff000;  ///< The most sendfile(2) will send in one call
+
+        /**
+         * @brief Get the number of unsent characters held in memory
+         * @return the number of characters in the ring and the spilled chunks
+         */
+        size_t buffered() const {
+            size_t ring = o_wrap ? (o_wrap - o_head) + (pptr() - obuf) : pptr() - o_head;
+            return o_spillBytes + ring;
+        }
+
+        /**
+         * @brief Send from the file chunk at the front of the queue, removing it when it has all been sent.
+         * @details With non-blocking output the socket is made non-blocking around the call since sendfile(2)
+         * has no flag to ask for it. SIGPIPE is blocked around the call for the same reason, so a peer that has
+         * reset the connection fails the send with EPIPE.
+         * @return the number of bytes sent, 0 if the socket would block, -1 on failure
+         */
+        ssize_t sendFront() {
+            spill_chunk &chunk = o_spill.front();
+            int flags = 0;
+            if (high_water) {
+                flags = ::fcntl(sockfd, F_GETFL);
+                ::fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+            }
+
+            ssize_t sent;
+            {
+                SigPipeGuard noSignal{};
+                do {
+                    sent = ::sendfile(sockfd, chunk.file, &chunk.offset, min(chunk.length, sendfile_max));
+                } while (sent < 0 && errno == EINTR);
+            }
+
+            if (high_water) {
+                int err = errno;
+                ::fcntl(sockfd, F_SETFL, flags);
+                errno = err;
+            }
+
+            if (sent < 0) {
+                return high_water && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+            }
+
+            if (sent == 0) {
+                // The file is shorter than the length asked for; the peer can not be sent what it expects.
+                o_fileBytes -= chunk.length;
+                o_spill.pop_front();
+                errno = EIO;
+                return -1;
+            }
+
+            chunk.length -= sent;
+            o_fileBytes -= sent;
+            if (chunk.length == 0)
+                o_spill.pop_front();
+            return sent;
+        }
+
+        /**
+         * @brief Set the put area without moving the put pointer
+         * @param begin The start of the put area
+         * @param end The end of the put area
+         * @param next The put pointer
+         */
+        void setPut(char_type *begin, char_type *end, char_type *next) {
+            this->setp(begin, end);
+            this->pbump(static_cast<int>(next - begin));
+        }
+
+        /**
+         * @brief Check the output ring out of the pool and make it the put area
+         */
+        void acquireOutput() {
+            obuf = BufferPool::acquire(buffer_size);
+            o_head = obuf;
+            o_wrap = nullptr;
+            this->setp(obuf, obuf + buffer_size);
+            notifyOutput();
+        }
+
+        /**
+         * @brief Return the output ring to the pool, the ring must be empty
+         */
+        void releaseOutput() {
+            BufferPool::release(obuf, buffer_size);
+            obuf = o_head = o_wrap = nullptr;
+            this->setp(nullptr, nullptr);
+        }
+
+        /**
+         * @brief Check the input buffer out of the pool
+         */
+        void acquireInput() {
+            ibuf = BufferPool::acquire(buffer_size);
+            i_size = buffer_size;
+            this->setg(ibuf, ibuf + pushback_size, ibuf + pushback_size);
+        }
+
+        /**
+         * @brief Return the input buffer to the pool, all of its characters must have been read
+         */
+        void releaseInput() {
+            BufferPool::release(ibuf, i_size);
+            ibuf = nullptr;
+            i_size = 0;
+            this->setg(nullptr, nullptr, nullptr);
+        }
+
+        /**
+         * @brief Make free space at the end of the get area when it reaches the end of the input buffer
+         * @details The unread characters, and up to pushback_size characters before them, are moved to the
+         * start of the buffer. If they fill most of it the buffer is first replaced by one twice the size.
+         */
+        void reserveInput() {
+            if (!ibuf) {
+                acquireInput();
+                return;
+            }
+            if (egptr() < ibuf + i_size)
+                return;
+
+            size_t keep = min(pushback_size, static_cast<size_t>(gptr() - eback()));
+            size_t unread = egptr() - gptr();
+            size_t size = i_size;
+            if (keep + unread > i_size / 4 * 3 && i_size < BufferPool::max_size)
+                size = i_size * 2;
+
+            char_type *buf = size == i_size ? ibuf : BufferPool::acquire(size);
+            memmove(buf, gptr() - keep, keep + unread);
+            if (buf != ibuf) {
+                BufferPool::release(ibuf, i_size);
+                ibuf = buf;
+                i_size = size;
+            }
+            this->setg(ibuf, ibuf + keep, ibuf + keep + unread);
+        }
+
+        /**
+         * @brief Read from the socket to the end of the get area
+         * @param flags recv(2) flags; with MSG_DONTWAIT reading repeats until the socket would block,
+         * otherwise a single read is made
+         * @return the number of characters read and the outcome, which is also kept for inputState()
+         */
+        io_result readInput(int flags) {
+            if (feed)
+                return readFed(flags);
+
+            size_t limit = read_ahead ? read_ahead : buffer_size - pushback_size;
+            io_result result{0, IoOk, 0};
+
+            for (;;) {
+                size_t unread = egptr() - gptr();
+                if (unread >= limit)
+                    break;
+                reserveInput();
+                size_t room = min(static_cast<size_t>(ibuf + i_size - egptr()), limit - unread);
+                if (room == 0)
+                    break;
+
+                ssize_t n = ::recv(sockfd, egptr(), room, flags);
+                if (n > 0) {
+                    this->setg(eback(), gptr(), egptr() + n);
+                    result.bytes += n;
+                    if (!(flags & MSG_DONTWAIT))
+                        break;
+                } else if (n == 0) {
+                    result.status = IoEof;
+                    break;
+                } else if (errno != EINTR) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        result.status = IoWouldBlock;
+                    } else {
+                        result.status = IoError;
+                        result.error = errno;
+                    }
+                    break;
+                }
+            }
+
+            i_state = result.status;
+            return result;
+        }
 
         /**
-         * @brief Flush the contents of the output buffer to the Socket
+         * @brief Move delivered input that did not fit in the input buffer into it, as far as it fits
+         */
+        void takeBacklog() {
+            while (!i_backlog.empty()) {
+                reserveInput();
+                string &front = i_backlog.front();
+                size_t take = min(static_cast<size_t>(ibuf + i_size - egptr()), front.size());
+                if (take == 0)
+                    return;
+                memcpy(egptr(), front.data(), take);
+                this->setg(eback(), gptr(), egptr() + take);
+                i_backlogBytes -= take;
+                if (take == front.size())
+                    i_backlog.pop_front();
+                else
+                    front.erase(0, take);
+            }
+        }
+
+        /**
+         * @brief Take the input the engine has delivered in place of reading the socket
+         * @param flags MSG_DONTWAIT to take what has arrived, otherwise wait for the engine to deliver some
+         * @return as readInput()
+         */
+        io_result readFed(int flags) {
+            size_t limit = read_ahead ? read_ahead : buffer_size - pushback_size;
+            size_t before = egptr() - gptr();
+            takeBacklog();
+            feed->receive(sockfd, *this, false);
+            while (!(flags & MSG_DONTWAIT) && gptr() == egptr() && i_end == IoOk && feed) {
+                feed->receive(sockfd, *this, true);
+                takeBacklog();
+            }
+            takeBacklog();
+
+            size_t now = egptr() - gptr();
+            io_result result{now - before, IoOk, 0};
+            if ((now > 0 && !(flags & MSG_DONTWAIT)) || unread() >= limit)
+                result.status = IoOk;
+            else if (i_end != IoOk)
+                result = io_result{now - before, i_end, i_endError};
+            else
+                result.status = IoWouldBlock;
+            i_state = result.status;
+            return result;
+        }
+
+        /**
+         * @brief Remove characters that have been sent from the spilled chunks and then the output ring
+         * @param n The number of characters sent
+         */
+        void consume(size_t n) {
+            while (n && !o_spill.empty()) {
+                size_t avail = o_spill.front().data.size() - o_spillHead;
+                if (n < avail) {
+                    o_spillHead += n;
+                    o_spillBytes -= n;
+                    return;
+                }
+                n -= avail;
+                o_spillBytes -= avail;
+                o_spill.pop_front();
+                o_spillHead = 0;
+            }
+
+            if (o_wrap && n >= static_cast<size_t>(o_wrap - o_head)) {
+                n -= o_wrap - o_head;
+                o_head = obuf;
+                o_wrap = nullptr;
+            }
+            o_head += n;
+
+            if (!o_wrap && o_head == pptr()) {
+                releaseOutput();
+            } else if (o_wrap) {
+                setPut(obuf, o_head, pptr());
+            } else {
+                setPut(o_head, obuf + buffer_size, pptr());
+            }
+        }
+
+        /**
+         * @brief Move the contents of the output ring to the end of the spilled chunks and empty the ring
+         */
+        void spill() {
+            settle();
+            string chunk{};
+            if (o_wrap) {
+                chunk.reserve((o_wrap - o_head) + (pptr() - obuf));
+                chunk.append(o_head, o_wrap);
+                chunk.append(obuf, pptr());
+            } else {
+                chunk.assign(o_head, pptr());
+            }
+            o_spillBytes += chunk.size();
+            o_spill.emplace_back(std::move(chunk));
+
+            o_head = obuf;
+            o_wrap = nullptr;
+            this->setp(obuf, obuf + buffer_size);
+        }
+
+        /**
+         * @brief Flush the stream, or defer the flush to the flush list
          * @return 0 on success, -1 on failure.
          */
         int sync() override {
-            if (sockfd >= 0) {
-                ssize_t n = ::send(sockfd, obuf, pptr() - obuf, 0);
+            if (!flush_list)
+                return flushNow();
+            if (!flush_listed) {
+                flush_list->buffers.push_back(this);
+                flush_listed = true;
+            }
+            return sockfd < 0 ? -1 : 0;
+        }
+
+        /**
+         * @brief Tell the owner that non-blocking output may have been queued
+         */
+        void notifyOutput() {
+            if (high_water && output_notify)
+                output_notify();
+        }
+
+        /**
+         * @brief Send the contents of the output buffer to the Socket, telling the owner if the output
+         * becomes, or stops being, queued.
+         * @return 0 on success, -1 on failure.
+         */
+        int sendOutput() {
+            bool wasQueued = queued();
+            int result = transmit();
+            if (queued() != wasQueued && output_notify)
+                output_notify();
+            return result;
+        }
 
-                if (n < 0) {
+        /**
+         * @brief Send the unsent output to the Socket
+         * @details The unsent output, the spilled chunks then the one or two parts of the ring, is sent with
+         * sendmsg(2) until it is all sent. Queued file chunks are sent in their place with sendfile(2). With
+         * non-blocking output sending stops without error when the socket would block and the rest stays
+         * queued. SIGPIPE is never raised, a reset connection fails with EPIPE.
+         * @return 0 on success, -1 on failure.
+         */
+        int transmit() {
+            if (sockfd < 0)
+                return -1;
+            settle();
+
+            for (;;) {
+                if (!o_spill.empty() && o_spill.front().file >= 0) {
+                    ssize_t sent = sendFront();
+                    if (sent <= 0)
+                        return static_cast<int>(sent);
+                    continue;
+                }
+
+                struct iovec iov[iov_count];
+                struct msghdr msg{};
+                size_t n = gather(iov);
+                if (n == 0)
+                    return 0;
+
+                msg.msg_iov = iov;
+                msg.msg_iovlen = n;
+                ssize_t sent = ::sendmsg(sockfd, &msg, sendFlags());
+
+                if (sent < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    if (high_water && (errno == EAGAIN || errno == EWOULDBLOCK))
+                        return 0;
                     return -1;
-                } else if (n == (pptr() - obuf)) {
-                    setp(obuf, obuf + buffer_size);
-                } else {
-                    for (ssize_t cp = n; cp < (buffer_size - n); ++cp) {
-                        obuf[cp - n] = obuf[cp];
-                    }
-                    setp(obuf, obuf + buffer_size);
-                    pbump(static_cast<int>(buffer_size - n));
                 }
-                return 0;
+                consume(static_cast<size_t>(sent));
             }
-            return -1;
+        }
+
+        /**
+         * @brief Describe the unsent characters ahead of any queued file, the spilled chunks then the one or
+         * two parts of the ring
+         * @param iov Set to the parts, iov_count of them at most
+         * @return the number of parts, 0 if there are none or a file is first
+         */
+        size_t gather(struct iovec *iov) {
+            size_t n = 0;
+            for (auto chunk = o_spill.begin();
+                 chunk != o_spill.end() && chunk->file < 0 && n < iov_count - 2; ++chunk, ++n) {
+                size_t skip = n ? 0 : o_spillHead;
+                iov[n].iov_base = &chunk->data[skip];
+                iov[n].iov_len = chunk->data.size() - skip;
+            }
+
+            if (n == o_spill.size()) {
+                if (o_wrap) {
+                    iov[n].iov_base = o_head;
+                    iov[n++].iov_len = o_wrap - o_head;
+                    iov[n].iov_base = obuf;
+                    iov[n++].iov_len = pptr() - obuf;
+                } else if (pptr() > o_head) {
+                    iov[n].iov_base = o_head;
+                    iov[n++].iov_len = pptr() - o_head;
+                }
+            }
+            return n;
         }
 
         /**
          * @brief Called when output data won't fit in the output buffer
-         * @details The output buffer is flushed to the Socket. The overflow character is placed in the clean
-         * buffer.
+         * @details If there is free space at the start of the ring the output wraps around to it, otherwise
+         * the output buffer is flushed to the Socket. With non-blocking output, if the socket would block
+         * the ring is spilled unless the high-water mark has been reached. The overflow character is placed
+         * in the free space. The output ring is checked out of the pool if the stream has none.
          * @param c The character that caused the overflow
-         * @return the input character
+         * @return the input character, or EOF on failure or at the high-water mark
          */
         int_type overflow(int_type c) override {
-            if (sync() < 0)
-                return traits_type::eof();
+            bool flushed = false;
+            while (pptr() == epptr()) {
+                if (!obuf) {
+                    acquireOutput();
+                } else if (!o_wrap && o_head > obuf) {
+                    o_wrap = pptr();
+                    this->setp(obuf, o_head);
+                } else if (flushed) {
+                    if (!writable())
+                        return traits_type::eof();
+                    spill();
+                } else if (sendOutput() < 0) {
+                    return traits_type::eof();
+                } else {
+                    flushed = true;
+                }
+            }
 
-            if (traits_type::not_eof(c)) {
-                char_type cc = traits_type::to_char_type(c);
-                this->xsputn(&cc, 1);
+            if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                *pptr() = traits_type::to_char_type(c);
+                this->pbump(1);
             }
 
-            return c;
+            return traits_type::not_eof(c);
         }
 
         /**
          * @brief Called when there is not enough data in the input buffer to satisfy an request
-         * @details More data is read from the underlying Socket. If none is available return EOF,
-         * otherwise return the first new character.
+         * @details More data is read from the underlying Socket, keeping the last characters read for
+         * putback. With read-ahead the read does not block and EOF is returned if there is nothing to read
+         * yet; inputState() is then IoWouldBlock rather than IoEof.
          * @return The next available character or EOF
          */
         int_type underflow() override {
-            if (sockfd >= 0) {
-                ssize_t n = ::recv(sockfd, ibuf + pushback_size, buffer_size - pushback_size, 0);
+            if (gptr() < egptr())
+                return traits_type::to_int_type(*gptr());
+            if (sockfd < 0)
+                return traits_type::eof();
 
-                if (n < 0) {
-                    return traits_type::eof();
-                }
-                this->setg(ibuf, ibuf + pushback_size, ibuf + pushback_size + n);
-                if (n) {
-                    return traits_type::to_int_type(*(ibuf + pushback_size));
-                }
-            }
-            return traits_type::eof();
+            readInput(read_ahead ? MSG_DONTWAIT : 0);
+            return gptr() < egptr() ? traits_type::to_int_type(*gptr()) : traits_type::eof();
         }
 
 
         /**
          * @brief Try to determine how many characters are availalbe in the input stream without blocking.
+         * @details Characters already buffered are counted first; the socket is only read, without blocking
+         * and after the buffered characters, when there are none.
          * @return >0 the number of characters know to be available, 0 no information, -1 sequence unavailable
          */
         streamsize showmanyc() override {
-            ssize_t n = ::recv(sockfd, ibuf + pushback_size, buffer_size - pushback_size, MSG_DONTWAIT);
+            if (gptr() < egptr())
+                return egptr() - gptr();
+            if (sockfd < 0)
+                return -1;
 
-            if (n < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    n = 0;
-                } else {
-                    return -1;
-                }
-            }
-            this->setg(ibuf, ibuf + pushback_size, ibuf + pushback_size + n);
-            return n;
+            io_result result = readInput(MSG_DONTWAIT);
+            if (gptr() < egptr())
+                return egptr() - gptr();
+            return result.status == IoEof || result.status == IoError ? -1 : 0;
         }
     };
+
+
+    FlushList::~FlushList() {
+        for (auto buffer: buffers) {
+            buffer->flush_listed = false;
+            buffer->flush_list = nullptr;
+        }
+    }
+
+
+    size_t FlushList::flush() {
+        size_t flushed = buffers.size();
+        for (auto buffer: buffers) {
+            buffer->flush_listed = false;
+            buffer->flushBatched();
+        }
+        buffers.clear();
+        return flushed;
+    }
 }
 
 #endif //EZNETWORK_SOCKET_BUFFER_H
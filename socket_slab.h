@@ -0,0 +1,232 @@
+//
+// Created by richard on 16/10/26.
+//
+
+#ifndef EZNETWORK_SOCKET_SLAB_H
+#define EZNETWORK_SOCKET_SLAB_H
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace async_net {
+
+    /**
+     * @brief A container of socket pointers held in slots of fixed size pages, a replacement for std::list
+     * in a server policy.
+     * @details Elements are iterated in slot order through contiguous pages, skipping empty slots, with no
+     * node to chase. Insert and erase are O(1): an erased element leaves its slot empty and the slot goes
+     * on a free list for the next push_back() or splice(). Pages are never moved or freed until the slab is
+     * destroyed, so a reference to an element, and an iterator, which is a slot index, stay valid until the
+     * element is erased whatever else is inserted.
+     *
+     * push_front() always takes a new slot past the current end, so an element added while the slab is
+     * being iterated, for instance by a poll_ready() handler, is not visited by that iteration. The slab is
+     * unordered, push_back() and splice() fill the most recently freed slot first.
+     * @tparam T The socket pointer type, it must be default constructible and test false when empty
+     */
+    template <class T>
+    class SocketSlab {
+    public:
+        constexpr static size_t page_shift = 6;                     ///< log2 of the slots in a page
+        constexpr static size_t page_size = size_t{1} << page_shift;    ///< The slots in a page
+
+        using value_type = T;
+        using size_type = size_t;
+        using reference = T &;
+
+        /**
+         * @brief A bidirectional iterator over the occupied slots.
+         */
+        class iterator {
+        public:
+            using iterator_category = bidirectional_iterator_tag;
+            using value_type = T;
+            using difference_type = ptrdiff_t;
+            using pointer = T *;
+            using reference = T &;
+
+            iterator() : slab{nullptr}, index{0} {}
+
+            T &operator*() const { return slab->slot(index); }
+
+            T *operator->() const { return &slab->slot(index); }
+
+            iterator &operator++() {
+                index = slab->following(index);
+                return *this;
+            }
+
+            iterator operator++(int) {
+                iterator old{*this};
+                ++*this;
+                return old;
+            }
+
+            iterator &operator--() {
+                index = slab->preceding(index);
+                return *this;
+            }
+
+            iterator operator--(int) {
+                iterator old{*this};
+                --*this;
+                return old;
+            }
+
+            bool operator==(const iterator &other) const { return index == other.index && slab == other.slab; }
+
+            bool operator!=(const iterator &other) const { return !(*this == other); }
+
+            /**
+             * @brief Get the slot the iterator selects, a handle that is stable for the life of the element
+             * @return the slot index
+             */
+            size_t slotIndex() const { return index; }
+
+        protected:
+            friend class SocketSlab;
+
+            iterator(SocketSlab *s, size_t i) : slab{s}, index{i} {}
+
+            SocketSlab *slab;       ///< The slab
+            size_t index;           ///< The slot
+        };
+
+        using reverse_iterator = std::reverse_iterator<iterator>;
+
+        SocketSlab() : pages{}, free_slots{}, used{0}, count{0} {}
+
+        SocketSlab(const SocketSlab &) = delete;
+
+        SocketSlab &operator=(const SocketSlab &) = delete;
+
+        iterator begin() { return iterator{this, following(static_cast<size_t>(-1))}; }
+
+        iterator end() { return iterator{this, used}; }
+
+        reverse_iterator rbegin() { return reverse_iterator{end()}; }
+
+        reverse_iterator rend() { return reverse_iterator{begin()}; }
+
+        size_t size() const { return count; }
+
+        bool empty() const { return count == 0; }
+
+
+        /**
+         * @brief Add an element, in a free slot if there is one
+         * @param value the element
+         * @return an iterator selecting the element
+         */
+        iterator push_back(T value) {
+            while (!free_slots.empty()) {
+                size_t index = free_slots.back();
+                free_slots.pop_back();
+                if (index < used && !slot(index)) {
+                    slot(index) = std::move(value);
+                    ++count;
+                    return iterator{this, index};
+                }
+            }
+            return push_front(std::move(value));
+        }
+
+
+        /**
+         * @brief Add an element in a new slot past the end
+         * @param value the element
+         * @return an iterator selecting the element
+         */
+        iterator push_front(T value) {
+            if ((used >> page_shift) == pages.size())
+                pages.push_back(make_unique<T[]>(page_size));
+            size_t index = used++;
+            slot(index) = std::move(value);
+            ++count;
+            return iterator{this, index};
+        }
+
+
+        /**
+         * @brief Erase an element, destroying it and freeing its slot
+         * @param itr an iterator selecting the element
+         * @return the next iterator or end()
+         * @details Erasing the last element gives back its slot and any empty slots before it, so taking
+         * elements from the back never leaves empty slots to skip.
+         */
+        iterator erase(iterator itr) {
+            slot(itr.index) = T{};
+            --count;
+            if (itr.index + 1 == used) {
+                while (used && !slot(used - 1))
+                    --used;
+                if (used == 0)
+                    free_slots.clear();
+                return end();
+            }
+            free_slots.push_back(itr.index);
+            return ++itr;
+        }
+
+
+        /**
+         * @brief Move every element of another slab into this one
+         * @param other the other slab, it is left empty
+         * @details Provided for compatibility with std::list, the slab is unordered so there is no position.
+         */
+        void splice(iterator, SocketSlab &other) {
+            for (auto itr = other.begin(); itr != other.end(); ++itr)
+                push_back(std::move(*itr));
+            other.clear();
+        }
+
+
+        /**
+         * @brief Erase every element, keeping the pages
+         */
+        void clear() {
+            for (size_t index = 0; index < used; ++index)
+                slot(index) = T{};
+            free_slots.clear();
+            used = 0;
+            count = 0;
+        }
+
+    protected:
+        vector<unique_ptr<T[]>> pages;      ///< The pages of slots, never moved
+        vector<size_t> free_slots;          ///< Freed slots, most recently freed last, those since given back or reused are skipped
+        size_t used;                        ///< The slots in use or freed, the index of end()
+        size_t count;                       ///< The number of elements
+
+        T &slot(size_t index) { return pages[index >> page_shift][index & (page_size - 1)]; }
+
+        /**
+         * @brief Find the next occupied slot
+         * @param index the slot to start after, -1 to start at the first
+         * @return the slot or used
+         */
+        size_t following(size_t index) {
+            while (++index < used)
+                if (slot(index))
+                    break;
+            return index < used ? index : used;
+        }
+
+        /**
+         * @brief Find the previous occupied slot, there must be one
+         * @param index the slot to start before
+         * @return the slot
+         */
+        size_t preceding(size_t index) {
+            while (!slot(--index));
+            return index;
+        }
+    };
+}
+
+#endif //EZNETWORK_SOCKET_SLAB_H
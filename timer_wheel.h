@@ -0,0 +1,287 @@
+//
+// Created by richard on 16/10/26.
+//
+
+#ifndef EZNETWORK_TIMER_WHEEL_H
+#define EZNETWORK_TIMER_WHEEL_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+
+using namespace std;
+
+namespace async_net {
+
+    class TimerWheel;
+
+    /**
+     * @brief A timer that can be scheduled on a TimerWheel.
+     * @details The timer is linked into the wheel, nothing is allocated to schedule or cancel it. Destroying
+     * a scheduled timer cancels it, so a timer that is a member of the object it acts on can not fire after
+     * the object is gone. A timer can not be copied or moved.
+     */
+    class Timer {
+    public:
+        using callback_t = function<void()>;    ///< Called when the timer expires
+
+        Timer() = default;
+
+        Timer(const Timer &) = delete;
+
+        Timer &operator=(const Timer &) = delete;
+
+        ~Timer() {
+            cancel();
+        }
+
+        /**
+         * @brief Determine if the timer is scheduled
+         * @return true if scheduled and not yet expired
+         */
+        bool active() const { return wheel != nullptr; }
+
+        /**
+         * @brief Cancel the timer if it is scheduled
+         */
+        inline void cancel();
+
+    protected:
+        friend class TimerWheel;
+
+        Timer *next{nullptr};           ///< The next timer in the same slot
+        Timer **pprev{nullptr};         ///< The link pointing to this timer
+        TimerWheel *wheel{nullptr};     ///< The wheel the timer is scheduled on, or nullptr
+        uint64_t expires{0};            ///< The tick the timer expires at
+        unsigned level{0};              ///< The level of the slot holding the timer
+        unsigned slot{0};               ///< The slot holding the timer
+        callback_t callback{};          ///< Called when the timer expires
+    };
+
+
+    /**
+     * @brief A hierarchical timing wheel with millisecond ticks.
+     * @details There are four levels of 64 slots. A timer is placed in the lowest level whose span covers
+     * it, and is moved down a level each time the level below completes a turn, so scheduling, cancelling
+     * and expiring a timer are O(1) however many timers there are. Timers more than 2^24 ticks, about 4.6
+     * hours, away wait in the last level and are placed again as it turns. nextExpiry() is never later than
+     * the next timer to expire and is found from a bitmap of occupied slots for each level.
+     */
+    class TimerWheel {
+    public:
+        using clock = chrono::steady_clock;
+
+        constexpr static unsigned level_bits = 6;                   ///< log2 of the slots in a level
+        constexpr static unsigned levels = 4;                       ///< The number of levels
+        constexpr static unsigned slots = 1u << level_bits;         ///< The slots in a level
+        constexpr static uint64_t span = uint64_t{1} << (level_bits * levels);  ///< Ticks covered by the wheel
+
+        /**
+         * @brief (constructor)
+         * @param start The time of tick 0
+         */
+        explicit TimerWheel(clock::time_point start = clock::now()) :
+                epoch{start}, current{0}, count{0}, heads{}, occupied{} {}
+
+        TimerWheel(const TimerWheel &) = delete;
+
+        TimerWheel &operator=(const TimerWheel &) = delete;
+
+        ~TimerWheel() {
+            for (auto &level: heads)
+                for (auto &head: level)
+                    while (head)
+                        unlink(*head);
+        }
+
+
+        /**
+         * @brief Schedule a timer, replacing its previous schedule if it is active.
+         * @tparam Duration A std::chrono duration
+         * @param timer The timer
+         * @param after How long until it expires, rounded up to whole ticks
+         * @param callback Called once when it expires, from advance()
+         */
+        template <typename Duration>
+        void schedule(Timer &timer, Duration after, Timer::callback_t callback) {
+            timer.cancel();
+            timer.callback = std::move(callback);
+            timer.expires = std::max(current + 1, toTick(clock::now() + after));
+            insert(timer);
+            ++count;
+        }
+
+
+        /**
+         * @brief Expire the timers that are due, calling their callbacks.
+         * @param now The time to advance to
+         * @return the number of timers expired
+         * @details Callbacks may schedule and cancel timers, including the one that expired.
+         */
+        size_t advance(clock::time_point now = clock::now()) {
+            uint64_t target = now <= epoch ? 0 : static_cast<uint64_t>(
+                    chrono::duration_cast<chrono::milliseconds>(now - epoch).count());
+            size_t fired = 0;
+
+            while (current < target) {
+                uint64_t due = count ? nextTick() : numeric_limits<uint64_t>::max();
+                if (due > target) {
+                    current = target;
+                    break;
+                }
+                current = due - 1;
+                fired += step();
+            }
+            return fired;
+        }
+
+
+        /**
+         * @brief Get a time no later than the expiry of the next timer
+         * @return the time, or clock::time_point::max() if no timer is scheduled
+         */
+        clock::time_point nextExpiry() const {
+            if (count == 0)
+                return clock::time_point::max();
+            return epoch + chrono::milliseconds(nextTick());
+        }
+
+
+        /**
+         * @brief Get the number of scheduled timers
+         * @return the number of timers
+         */
+        size_t size() const { return count; }
+
+    protected:
+        friend class Timer;
+
+        clock::time_point epoch;                ///< The time of tick 0
+        uint64_t current;                       ///< The last tick processed
+        size_t count;                           ///< The number of scheduled timers
+        Timer *heads[levels][slots];            ///< The timers in each slot
+        uint64_t occupied[levels];              ///< A bit for each slot with timers
+
+        /**
+         * @brief Convert a time to a tick, rounding up
+         * @param when the time
+         * @return the tick
+         */
+        uint64_t toTick(clock::time_point when) const {
+            if (when <= epoch)
+                return 0;
+            auto ms = chrono::duration_cast<chrono::milliseconds>(when - epoch);
+            return static_cast<uint64_t>(ms.count()) + (epoch + ms < when ? 1 : 0);
+        }
+
+        /**
+         * @brief Link a timer into the slot for its expiry
+         * @param timer the timer
+         */
+        void insert(Timer &timer) {
+            uint64_t delta = timer.expires - current;
+            uint64_t when = delta < span ? timer.expires : current + span - 1;
+
+            unsigned level = 0;
+            while (level < levels - 1 && delta >= (uint64_t{1} << (level_bits * (level + 1))))
+                ++level;
+            unsigned slot = static_cast<unsigned>(when >> (level_bits * level)) & (slots - 1);
+
+            Timer *&head = heads[level][slot];
+            timer.next = head;
+            if (head)
+                head->pprev = &timer.next;
+            head = &timer;
+            timer.pprev = &head;
+            timer.wheel = this;
+            timer.level = level;
+            timer.slot = slot;
+            occupied[level] |= uint64_t{1} << slot;
+        }
+
+        /**
+         * @brief Unlink a timer from its slot
+         * @param timer the timer
+         */
+        void unlink(Timer &timer) {
+            *timer.pprev = timer.next;
+            if (timer.next)
+                timer.next->pprev = timer.pprev;
+            if (!heads[timer.level][timer.slot])
+                occupied[timer.level] &= ~(uint64_t{1} << timer.slot);
+            timer.next = nullptr;
+            timer.pprev = nullptr;
+            timer.wheel = nullptr;
+        }
+
+        /**
+         * @brief Cancel a scheduled timer
+         * @param timer the timer
+         */
+        void remove(Timer &timer) {
+            unlink(timer);
+            timer.callback = nullptr;
+            --count;
+        }
+
+        /**
+         * @brief Advance one tick, moving timers down from higher levels and expiring the timers due
+         * @return the number of timers expired
+         */
+        size_t step() {
+            ++current;
+
+            for (unsigned level = 1; level < levels; ++level) {
+                if (current & ((uint64_t{1} << (level_bits * level)) - 1))
+                    break;
+                unsigned slot = static_cast<unsigned>(current >> (level_bits * level)) & (slots - 1);
+                while (Timer *timer = heads[level][slot]) {
+                    unlink(*timer);
+                    insert(*timer);
+                }
+            }
+
+            size_t fired = 0;
+            unsigned slot = static_cast<unsigned>(current) & (slots - 1);
+            while (Timer *timer = heads[0][slot]) {
+                Timer::callback_t callback = std::move(timer->callback);
+                remove(*timer);
+                ++fired;
+                if (callback)
+                    callback();
+            }
+            return fired;
+        }
+
+        /**
+         * @brief Get the next tick at which a timer expires or a non-empty slot moves down a level
+         * @return the tick, never earlier than current + 1
+         */
+        uint64_t nextTick() const {
+            uint64_t next = numeric_limits<uint64_t>::max();
+            for (unsigned level = 0; level < levels; ++level) {
+                if (!occupied[level])
+                    continue;
+                unsigned shift = level_bits * level;
+                uint64_t base = (current >> shift) + 1;         // The next block of this level to start
+                unsigned rotate = static_cast<unsigned>(base) & (slots - 1);
+                uint64_t bits = occupied[level];
+                uint64_t rotated = rotate ? (bits >> rotate) | (bits << (slots - rotate)) : bits;
+                uint64_t k = static_cast<uint64_t>(__builtin_ctzll(rotated));
+                uint64_t tick = (base + k) << shift;
+                if (tick < next)
+                    next = tick;
+            }
+            return next;
+        }
+    };
+
+
+    void Timer::cancel() {
+        if (wheel)
+            wheel->remove(*this);
+    }
+}
+
+#endif //EZNETWORK_TIMER_WHEEL_H
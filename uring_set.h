@@ -0,0 +1,892 @@
+//
+// Created by richard on 16/10/26.
+//
+
+#ifndef EZNETWORK_URING_SET_H
+#define EZNETWORK_URING_SET_H
+
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <stdexcept>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/io_uring.h>
+#include "socket.h"
+
+using namespace std;
+
+namespace eznet {
+
+    /**
+     * @brief A readiness engine using io_uring(7) with the same interface as FD_Set and EPoll_Set.
+     * @details Listen sockets are served by a multishot accept so connections are accepted by the kernel
+     * as they arrive and Server::accept() only collects them. Other sockets are selected with poll requests
+     * that are re-armed in the same submission that waits for completions, so each call to select() is a
+     * single io_uring_enter(2) that replaces the select(2) and accept4(2) calls of the other engines.
+     *
+     * Accepted sockets with a stream buffer are fed by the engine (see socket_streambuf::setFeed()): a multishot
+     * recv into a ring of provided buffers receives their input, which is copied into the stream buffer as it
+     * completes, so no recv(2) is made. The recv is cancelled while the stream holds its read-ahead limit and
+     * armed again when the stream is read. A socket is reported readable while its stream has unread input.
+     * Deferred flushes are sent by a sendmsg request queued by the FlushList and submitted with the next
+     * wait, so the output of one loop iteration costs no system call of its own. Do not read such a socket
+     * directly; a socket awaited by a coroutine is not fed.
+     *
+     * io_uring holds a reference to a file while a request is in flight so a closed socket is not released
+     * by the kernel until its requests are cancelled by release(), which the Server calls for every closed
+     * socket before erasing it.
+     *
+     * Requires Linux 5.19 or later; streams are fed on Linux 6.0 or later, which has multishot recv, and
+     * otherwise read and write the socket themselves.
+     * @tparam SocketContainer The container type holding the sockets
+     * @tparam SocketPtr The pointer type stored in the container
+     */
+    template <class SocketContainer, class SocketPtr>
+    class URing_Set : public StreamFeed {
+    protected:
+        /**
+         * @brief The state of the requests for a file descriptor
+         */
+        struct Registration {
+            uint32_t generation{0};     ///< Changes for each new owner so stale completions are ignored
+            uint32_t events{0};         ///< The poll events of the armed poll request
+            bool armed{false};          ///< A poll request is in flight
+            bool accepting{false};      ///< A multishot accept request is in flight
+            bool watched{false};        ///< The file descriptor is not a socket and is selected for read
+            bool listed{false};         ///< The file descriptor is in the listeners list
+            SocketPtr *slot{nullptr};   ///< The container element holding the socket
+            vector<int> accepted{};     ///< Connections accepted by the kernel and not yet collected
+            socket_streambuf *fed{nullptr};     ///< The stream buffer the engine receives and sends for
+            uint32_t feedGeneration{0};         ///< Changes for each stream fed so stale receives are ignored
+            bool receiving{false};      ///< A multishot recv request is in flight
+            bool pausing{false};        ///< The recv request has been cancelled for backpressure
+        };
+
+        static constexpr uint64_t PollRequest = 0;          ///< user_data kind of a poll request
+        static constexpr uint64_t AcceptRequest = 1;        ///< user_data kind of an accept request
+        static constexpr uint64_t RecvRequest = 2;          ///< user_data kind of a recv request
+        static constexpr uint64_t SendRequest = 3;          ///< user_data kind of a send request
+        static constexpr uint64_t IgnoreRequest = 7;        ///< user_data kind of a cancel request
+        static constexpr uint32_t generation_mask = 0x1fffffff;    ///< The generation bits kept in user_data
+
+        static constexpr unsigned recv_buffers = 128;       ///< The number of provided buffers, a power of 2
+        static constexpr size_t recv_size = socket_streambuf::buffer_size;     ///< The size of each
+        static constexpr uint16_t recv_group = 0;           ///< The provided buffer group id
+
+        int ring_fd;                    ///< The io_uring file descriptor
+        struct io_uring_params params;  ///< The ring parameters returned by the kernel
+
+        void *sq_ptr;                   ///< The mapped submission queue ring
+        void *cq_ptr;                   ///< The mapped completion queue ring
+        size_t sq_len, cq_len;          ///< The length of each mapping
+        struct io_uring_sqe *sqes;      ///< The mapped submission queue entries
+        unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+        unsigned *cq_head, *cq_tail, *cq_mask;
+        struct io_uring_cqe *cqes;
+        unsigned sqTail;                ///< The local submission queue tail
+
+        vector<Registration> regs;      ///< Request state indexed by file descriptor
+        vector<uint32_t> ready;         ///< The events from the last wait indexed by file descriptor
+        vector<int> readyFds;           ///< The file descriptors set in ready by the last wait
+        vector<int> listeners;          ///< File descriptors with a multishot accept
+        vector<int> failed;             ///< File descriptors whose request ended with an error, re-armed by clear()
+
+        struct io_uring_buf_ring *bufRing;  ///< The provided buffer ring, nullptr if streams are not fed
+        char *bufData;                  ///< The provided buffers
+        uint16_t bufTail;               ///< The local provided buffer ring tail
+        int settling;                   ///< The file descriptor whose send is being settled, or -1
+
+        static uint64_t userData(uint64_t kind, uint32_t generation, int fd) {
+            return (kind << 61) | (static_cast<uint64_t>(generation & generation_mask) << 32) |
+                   static_cast<uint32_t>(fd);
+        }
+
+        static uint32_t pollEvents(SelectClients selectClients) {
+            uint32_t e = 0;
+            if (selectClients & SC_Read)
+                e |= POLLIN;
+            if (selectClients & SC_Write)
+                e |= POLLOUT;
+            if (selectClients & SC_Except)
+                e |= POLLPRI;
+            return e;
+        }
+
+        Registration &reg(int fd) {
+            if (static_cast<size_t>(fd) >= regs.size())
+                regs.resize(fd + 1);
+            return regs[fd];
+        }
+
+        uint32_t readyEvents(int fd) const {
+            return (fd >= 0 && static_cast<size_t>(fd) < ready.size()) ? ready[fd] : 0;
+        }
+
+        void markReady(int fd, uint32_t events) {
+            if (static_cast<size_t>(fd) >= ready.size())
+                ready.resize(fd + 1, 0);
+            if (ready[fd] == 0)
+                readyFds.push_back(fd);
+            ready[fd] |= events;
+        }
+
+        /**
+         * @brief Submit the queued entries and optionally wait for completions
+         * @param wait The minimum number of completions to wait for
+         * @param ts An optional timeout for the wait
+         * @return the value returned by io_uring_enter(2)
+         */
+        int enter(unsigned wait, struct __kernel_timespec *ts) {
+            __atomic_store_n(sq_tail, sqTail, __ATOMIC_RELEASE);
+            unsigned submit = sqTail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+            unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+
+            struct io_uring_getevents_arg arg{};
+            arg.sigmask_sz = _NSIG / 8;
+            arg.ts = reinterpret_cast<uint64_t>(ts);
+            if (ts)
+                flags |= IORING_ENTER_EXT_ARG;
+
+            return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, submit, wait, flags,
+                                              ts ? &arg : nullptr, ts ? sizeof(arg) : 0));
+        }
+
+        /**
+         * @brief Get a cleared submission queue entry, submitting the queue if it is full
+         * @return the entry
+         */
+        struct io_uring_sqe *getSqe() {
+            if (sqTail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= params.sq_entries)
+                enter(0, nullptr);
+            unsigned index = sqTail & *sq_mask;
+            sq_array[index] = index;
+            ++sqTail;
+            struct io_uring_sqe *sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            return sqe;
+        }
+
+        void armPoll(int fd, Registration &r, uint32_t events) {
+            auto sqe = getSqe();
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = fd;
+            sqe->poll32_events = events;
+            sqe->user_data = userData(PollRequest, r.generation, fd);
+            r.events = events;
+            r.armed = true;
+        }
+
+        void armRecv(int fd, Registration &r) {
+            auto sqe = getSqe();
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = fd;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = recv_group;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->user_data = userData(RecvRequest, r.feedGeneration, fd);
+            r.receiving = true;
+        }
+
+        /**
+         * @brief Return a provided buffer to the ring
+         * @param bid the buffer id
+         */
+        void provide(unsigned bid) {
+            // The ring is indexed directly: in C++ the header's bufs flexible array follows an empty struct.
+            struct io_uring_buf &buf = reinterpret_cast<struct io_uring_buf *>(bufRing)[bufTail & (recv_buffers - 1)];
+            buf.addr = reinterpret_cast<uint64_t>(bufData + bid * recv_size);
+            buf.len = recv_size;
+            buf.bid = static_cast<uint16_t>(bid);
+            __atomic_store_n(&bufRing->tail, ++bufTail, __ATOMIC_RELEASE);
+        }
+
+        /**
+         * @brief Map and register the provided buffer ring if the kernel has multishot recv
+         */
+        void provideBuffers() {
+            struct utsname name{};
+            unsigned major = 0;
+            if (::uname(&name) || sscanf(name.release, "%u", &major) != 1 || major < 6)
+                return;
+
+            size_t ringLen = recv_buffers * sizeof(struct io_uring_buf);
+            void *ring = ::mmap(nullptr, ringLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            void *data = ::mmap(nullptr, recv_buffers * recv_size, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            struct io_uring_buf_reg reg{};
+            reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+            reg.ring_entries = recv_buffers;
+            reg.bgid = recv_group;
+            if (ring == MAP_FAILED || data == MAP_FAILED ||
+                ::syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+                if (ring != MAP_FAILED)
+                    ::munmap(ring, ringLen);
+                if (data != MAP_FAILED)
+                    ::munmap(data, recv_buffers * recv_size);
+                return;
+            }
+
+            bufRing = static_cast<struct io_uring_buf_ring *>(ring);
+            bufData = static_cast<char *>(data);
+            for (unsigned bid = 0; bid < recv_buffers; ++bid)
+                provide(bid);
+        }
+
+        void armAccept(int fd, Registration &r) {
+            auto sqe = getSqe();
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = fd;
+            sqe->accept_flags = SOCK_CLOEXEC;
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->user_data = userData(AcceptRequest, r.generation, fd);
+            r.accepting = true;
+            if (!r.listed) {
+                r.listed = true;
+                listeners.push_back(fd);
+            }
+        }
+
+        /**
+         * @brief Unmap the rings that have been mapped and close the ring file descriptor
+         */
+        void unmap() {
+            if (sqes)
+                ::munmap(sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+            if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+                ::munmap(cq_ptr, cq_len);
+            if (sq_ptr != MAP_FAILED)
+                ::munmap(sq_ptr, sq_len);
+            ::close(ring_fd);
+            if (bufRing) {
+                ::munmap(bufRing, recv_buffers * sizeof(struct io_uring_buf));
+                ::munmap(bufData, recv_buffers * recv_size);
+            }
+            bufRing = nullptr;
+            bufData = nullptr;
+            sqes = nullptr;
+            sq_ptr = cq_ptr = MAP_FAILED;
+            ring_fd = -1;
+        }
+
+        void cancel(uint64_t kind, int fd, Registration &r) {
+            auto sqe = getSqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            bool feeding = kind == RecvRequest || kind == SendRequest;
+            sqe->addr = userData(kind, feeding ? r.feedGeneration : r.generation, fd);
+            sqe->user_data = userData(IgnoreRequest, 0, 0);
+        }
+
+        /**
+         * @brief Submit the queued entries, wait for a completion and process the completions
+         * @return false if the wait failed
+         */
+        bool await() {
+            if (enter(1, nullptr) < 0 && errno != EINTR && errno != EBUSY)
+                return false;
+            reap();
+            return true;
+        }
+
+        /**
+         * @brief Start feeding the stream buffer of a socket
+         * @param r the registration of the socket
+         * @param stream the stream buffer
+         */
+        void attach(Registration &r, socket_streambuf &stream) {
+            ++r.feedGeneration;
+            r.fed = &stream;
+            stream.setFeed(this);
+        }
+
+        /**
+         * @brief Stop feeding the stream buffer of a socket, after the send in flight has completed and the
+         * input the recv request had received has been delivered
+         * @param fd the file descriptor
+         * @param r its registration
+         */
+        void unfeed(int fd, Registration &r) {
+            settle(fd, *r.fed);
+            if (r.receiving && !r.pausing) {
+                cancel(RecvRequest, fd, r);
+                r.pausing = true;
+            }
+            while (r.receiving && await())
+                ;
+            r.receiving = r.pausing = false;
+            ++r.feedGeneration;
+            r.fed->setFeed(nullptr);
+            r.fed = nullptr;
+        }
+
+        /**
+         * @brief Get the stream buffer the engine should feed for a socket
+         * @param sock the socket
+         * @return the stream buffer of an accepted socket not awaited by a coroutine, otherwise nullptr
+         */
+        socket_streambuf *feedable(SocketPtr &sock) const {
+            if (!bufRing || sock->socketType() != SockAccept || sock->awaiter)
+                return nullptr;
+            return sock->streamBuffer();
+        }
+
+        /**
+         * @brief Arm the requests of a socket that are not in flight
+         * @param fd the file descriptor
+         * @param r its registration
+         * @param selection the selection of the socket
+         */
+        void arm(int fd, Registration &r, SelectClients selection) {
+            uint32_t want = pollEvents(selection);
+            if (r.fed)
+                want &= ~POLLIN;
+            if (want && !r.armed)
+                armPoll(fd, r, want);
+            if (r.fed && (selection & SC_Read) && !r.receiving && r.fed->wantsInput())
+                armRecv(fd, r);
+        }
+
+        /**
+         * @brief Cancel all requests for a file descriptor and forget its owner
+         * @param fd the file descriptor
+         * @param r its registration
+         */
+        void reset(int fd, Registration &r) {
+            if (r.fed)
+                unfeed(fd, r);
+            if (r.armed)
+                cancel(PollRequest, fd, r);
+            if (r.accepting)
+                cancel(AcceptRequest, fd, r);
+            for (auto a: r.accepted)
+                ::close(a);
+            r.accepted.clear();
+            r.armed = r.accepting = r.watched = false;
+            r.slot = nullptr;
+            ++r.generation;
+        }
+
+        /**
+         * @brief Process a completion
+         * @param cqe the completion
+         */
+        void complete(const struct io_uring_cqe &cqe) {
+            uint64_t kind = cqe.user_data >> 61;
+            if (kind == IgnoreRequest)
+                return;
+
+            int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+            auto generation = static_cast<uint32_t>((cqe.user_data >> 32) & generation_mask);
+            Registration &r = reg(fd);
+            bool current = (r.generation & generation_mask) == generation;
+            bool fedNow = r.fed && (r.feedGeneration & generation_mask) == generation;
+
+            if (kind == RecvRequest) {
+                received(cqe, fd, r, fedNow);
+            } else if (kind == SendRequest) {
+                if (fedNow && r.fed->endSend(cqe.res) && settling != fd)
+                    send(fd, *r.fed);
+            } else if (kind == AcceptRequest) {
+                if (!current) {
+                    if (cqe.res >= 0)
+                        ::close(cqe.res);
+                    return;
+                }
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                    r.accepting = false;
+                if (cqe.res >= 0) {
+                    r.accepted.push_back(cqe.res);
+                    markReady(fd, POLLIN);
+                } else if (!r.accepting) {
+                    // An error such as EMFILE ends the multishot accept, try again as epoll would.
+                    failed.push_back(fd);
+                }
+            } else if (current) {
+                r.armed = false;
+                if (cqe.res > 0)
+                    markReady(fd, static_cast<uint32_t>(cqe.res));
+                else
+                    failed.push_back(fd);
+            }
+        }
+
+        /**
+         * @brief Process a completion of the multishot recv of a fed stream
+         * @param cqe the completion
+         * @param fd the file descriptor
+         * @param r its registration
+         * @param current true if the completion is for the stream fed now
+         */
+        void received(const struct io_uring_cqe &cqe, int fd, Registration &r, bool current) {
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                if (current && cqe.res > 0)
+                    r.fed->deliver(bufData + bid * recv_size, static_cast<size_t>(cqe.res));
+                provide(bid);
+            }
+            if (!current)
+                return;
+
+            bool more = cqe.flags & IORING_CQE_F_MORE;
+            if (!more)
+                r.receiving = r.pausing = false;
+
+            if (cqe.res > 0) {
+                markReady(fd, POLLIN);
+                if (more && !r.pausing && !r.fed->wantsInput()) {
+                    // The stream holds its read-ahead limit, leave the rest to the kernel until it is read.
+                    // The cancel is submitted at once, the recv would otherwise fill every provided buffer.
+                    cancel(RecvRequest, fd, r);
+                    r.pausing = true;
+                    enter(0, nullptr);
+                }
+            } else if (cqe.res == 0) {
+                r.fed->deliverEnd(IoEof, 0);
+                markReady(fd, POLLIN);
+            } else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+                r.fed->deliverEnd(IoError, -cqe.res);
+                markReady(fd, POLLIN | POLLERR);
+            }
+
+            // A recv that ended early, ran out of provided buffers or was paused by a stream that has since
+            // been read is armed again by clear().
+            if (!more && r.fed->wantsInput())
+                failed.push_back(fd);
+        }
+
+        /**
+         * @brief Process the completions the kernel has posted
+         * @details The head is advanced before each completion is processed, so a completion that sends or
+         * settles, and processes completions itself, never sees one twice.
+         */
+        void reap() {
+            unsigned head = *cq_head;
+            while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+                struct io_uring_cqe cqe = cqes[head & *cq_mask];
+                __atomic_store_n(cq_head, ++head, __ATOMIC_RELEASE);
+                complete(cqe);
+            }
+        }
+
+        /**
+         * @brief Re-arm the requests for a file descriptor whose requests have completed
+         * @param fd the file descriptor
+         */
+        void rearm(int fd) {
+            Registration &r = regs[fd];
+            if (r.watched) {
+                if (!r.armed)
+                    armPoll(fd, r, POLLIN);
+            } else if (r.slot && (*r.slot)->fd() == fd && (*r.slot)->interest != SC_None) {
+                if ((*r.slot)->socketType() != SockListen)
+                    arm(fd, r, (*r.slot)->interest);
+                else if (!r.accepting && ((*r.slot)->interest & SC_Read))
+                    armAccept(fd, r);
+            }
+        }
+
+        /**
+         * @brief Determine if the stream of a socket selected for read has input a read will not wait for
+         * @param fd the file descriptor
+         * @return true if the socket stays readable
+         */
+        bool stillReadable(int fd) const {
+            const Registration &r = regs[fd];
+            return r.fed && r.slot && ((*r.slot)->interest & SC_Read) && r.fed->inputReady();
+        }
+
+    public:
+        URing_Set() : ring_fd{-1}, params{}, sq_ptr{MAP_FAILED}, cq_ptr{MAP_FAILED}, sq_len{0}, cq_len{0},
+                      sqes{nullptr}, sqTail{0}, regs{}, ready{}, readyFds{}, listeners{}, failed{},
+                      bufRing{nullptr}, bufData{nullptr}, bufTail{0}, settling{-1} {
+            params.flags = IORING_SETUP_CQSIZE;
+            params.cq_entries = 4096;
+            ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, 256, &params));
+            if (ring_fd < 0)
+                throw runtime_error(string{"io_uring_setup error: "} + strerror(errno));
+            if (!(params.features & IORING_FEAT_EXT_ARG)) {
+                unmap();
+                throw runtime_error("io_uring does not support IORING_FEAT_EXT_ARG");
+            }
+
+            sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+                sq_len = cq_len = max(sq_len, cq_len);
+
+            sq_ptr = ::mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                            IORING_OFF_SQ_RING);
+            cq_ptr = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ptr :
+                     ::mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                            IORING_OFF_CQ_RING);
+            void *sqe_ptr = ::mmap(nullptr, params.sq_entries * sizeof(struct io_uring_sqe),
+                                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+            if (sqe_ptr != MAP_FAILED)
+                sqes = static_cast<struct io_uring_sqe *>(sqe_ptr);
+            if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqe_ptr == MAP_FAILED) {
+                int err = errno;
+                unmap();
+                throw runtime_error(string{"io_uring mmap error: "} + strerror(err));
+            }
+
+            auto sq = static_cast<char *>(sq_ptr);
+            sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+            sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+            sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+            sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+            sqTail = *sq_tail;
+
+            auto cq = static_cast<char *>(cq_ptr);
+            cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+            cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+            cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+            provideBuffers();
+        }
+
+        URing_Set(const URing_Set &) = delete;
+
+        URing_Set &operator=(const URing_Set &) = delete;
+
+        ~URing_Set() {
+            for (size_t fd = 0; fd < regs.size(); ++fd)
+                if (regs[fd].fed)
+                    unfeed(static_cast<int>(fd), regs[fd]);
+            for (auto &r: regs)
+                for (auto a: r.accepted)
+                    ::close(a);
+            unmap();
+        }
+
+
+        /**
+         * @brief Forget the results of the last wait and re-arm the requests it completed, including those
+         * that ended with an error. Sockets whose stream still has input a read will not wait for stay ready.
+         */
+        void clear() {
+            size_t kept = 0;
+            for (auto fd: readyFds) {
+                ready[fd] = 0;
+                rearm(fd);
+                if (stillReadable(fd))
+                    readyFds[kept++] = fd;
+            }
+            readyFds.resize(kept);
+            for (auto fd: readyFds)
+                ready[fd] = POLLIN;
+            for (auto fd: failed)
+                rearm(fd);
+            failed.clear();
+        }
+
+
+        /**
+         * @brief Given a socket container iterator, set the socket selection criteria
+         * @param sock the iterator
+         */
+        void set(const typename SocketContainer::iterator sock) {
+            set(*sock);
+        }
+
+
+        /**
+         * @brief Given a socket pointer, queue the requests that match the socket selection criteria
+         * @param sock the pointer
+         * @details Requests are only queued when the socket is new, its selection() has changed,
+         * or a multishot accept has ended. They are submitted by the next select().
+         */
+        void set(SocketPtr &sock) {
+            int fd = sock->fd();
+            if (sock->interestFd >= 0 && sock->interestFd != fd)
+                release(sock);
+            if (fd < 0)
+                return;
+
+            Registration &r = reg(fd);
+            if (sock->interestFd != fd || r.slot != &sock) {
+                if (sock->interestFd != fd)
+                    reset(fd, r);
+                r.slot = &sock;
+                sock->interestFd = fd;
+                sock->interest = SC_None;
+            }
+
+            socket_streambuf *stream = feedable(sock);
+            if (r.fed != stream) {
+                if (r.fed)
+                    unfeed(fd, r);
+                if (stream)
+                    attach(r, *stream);
+            }
+
+            SelectClients selection = sock->selection();
+            if (sock->socketType() == SockListen) {
+                if ((selection & SC_Read) && !r.accepting) {
+                    armAccept(fd, r);
+                } else if (!(selection & SC_Read) && r.accepting) {
+                    cancel(AcceptRequest, fd, r);
+                    r.accepting = false;
+                    ++r.generation;
+                }
+            } else {
+                uint32_t want = pollEvents(selection) & (r.fed ? ~static_cast<uint32_t>(POLLIN) : ~0u);
+                if (r.armed && r.events != want) {
+                    cancel(PollRequest, fd, r);
+                    r.armed = false;
+                    ++r.generation;
+                }
+                arm(fd, r, selection);
+            }
+
+            sock->interest = selection;
+        }
+
+
+        /**
+         * @brief Cancel the requests for a socket that is being removed from the container.
+         * @param sock the pointer
+         */
+        void release(SocketPtr &sock) {
+            int fd = sock->interestFd;
+            if (fd >= 0 && static_cast<size_t>(fd) < regs.size() && regs[fd].slot == &sock)
+                reset(fd, regs[fd]);
+            sock->interestFd = -1;
+            sock->interest = SC_None;
+        }
+
+
+        /**
+         * @brief Collect a connection accepted by the multishot accept of a listen socket.
+         * @param listener the listen socket
+         * @param addr storage for the peer address
+         * @param len the size of the storage, set to the size of the address
+         * @param flags accept4(2) flags, SOCK_NONBLOCK is applied to the connection
+         * @return the connection file descriptor or -1 with errno set to EAGAIN if there is none
+         */
+        int acceptFd(SocketPtr &listener, struct sockaddr *addr, socklen_t *len, int flags) {
+            int fd = listener->fd();
+            if (fd < 0 || static_cast<size_t>(fd) >= regs.size() || regs[fd].accepted.empty()) {
+                errno = EAGAIN;
+                return -1;
+            }
+
+            auto &accepted = regs[fd].accepted;
+            int clientfd = accepted.front();
+            accepted.erase(accepted.begin());
+
+            ::getpeername(clientfd, addr, len);
+            if (flags & SOCK_NONBLOCK)
+                ::fcntl(clientfd, F_SETFL, ::fcntl(clientfd, F_GETFL) | O_NONBLOCK);
+            return clientfd;
+        }
+
+
+        /**
+         * @brief Register a file descriptor that is not a socket for read
+         * @param fd the file descriptor
+         */
+        void watch(int fd) {
+            Registration &r = reg(fd);
+            reset(fd, r);
+            r.watched = true;
+            armPoll(fd, r, POLLIN);
+        }
+
+
+        /**
+         * @brief Cancel the requests of a watched file descriptor
+         * @param fd the file descriptor
+         */
+        void unwatch(int fd) {
+            if (fd >= 0 && static_cast<size_t>(fd) < regs.size() && regs[fd].watched)
+                reset(fd, regs[fd]);
+        }
+
+
+        /**
+         * @brief Test a watched file descriptor for read selection
+         * @param fd the file descriptor
+         * @return true if selected
+         */
+        bool isReady(int fd) { return (readyEvents(fd) & POLLIN) != 0; }
+
+
+        /**
+         * @brief Submit queued requests and wait for completions
+         * @param timeout An optional timeout value
+         * @return The number of file descriptors selected.
+         */
+        int select(struct timeval *timeout = nullptr) {
+            // Listeners with connections left from the last wait are ready without waiting.
+            size_t l = 0;
+            for (auto fd: listeners) {
+                Registration &r = regs[fd];
+                if (r.accepting || !r.accepted.empty()) {
+                    listeners[l++] = fd;
+                    if (!r.accepted.empty())
+                        markReady(fd, POLLIN);
+                } else {
+                    r.listed = false;
+                }
+            }
+            listeners.resize(l);
+
+            struct __kernel_timespec ts{};
+            struct __kernel_timespec *tsp = nullptr;
+            if (timeout) {
+                ts.tv_sec = timeout->tv_sec;
+                ts.tv_nsec = timeout->tv_usec * 1000;
+                tsp = &ts;
+            }
+            if (!readyFds.empty()) {
+                ts = {};
+                tsp = &ts;
+            }
+
+            int r = enter(1, tsp);
+            if (r < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+                return -1;
+
+            reap();
+            return static_cast<int>(readyFds.size());
+        }
+
+
+        /**
+         * @brief Deliver the input received for a fed stream buffer, re-arming its recv if it was paused
+         * @param fd The socket
+         * @param stream The stream buffer
+         * @param block Wait until input, end of file or an error has been delivered
+         */
+        void receive(int fd, socket_streambuf &stream, bool block) override {
+            if (fd < 0 || static_cast<size_t>(fd) >= regs.size() || regs[fd].fed != &stream)
+                return;
+            Registration &r = regs[fd];
+            if (!r.receiving && stream.wantsInput())
+                armRecv(fd, r);
+            if (block) {
+                if (!stream.inputReady() && !await())
+                    stream.deliverEnd(IoError, errno);
+            } else {
+                if (sqTail != *sq_tail)
+                    enter(0, nullptr);
+                reap();
+            }
+        }
+
+
+        /**
+         * @brief Queue a sendmsg request for the unsent output of a fed stream buffer
+         * @param fd The socket
+         * @param stream The stream buffer
+         */
+        void send(int fd, socket_streambuf &stream) override {
+            if (fd < 0 || static_cast<size_t>(fd) >= regs.size() || regs[fd].fed != &stream)
+                return;
+            const struct msghdr *msg = stream.beginSend();
+            if (!msg)
+                return;
+            auto sqe = getSqe();
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uint64_t>(msg);
+            sqe->len = 1;
+            sqe->msg_flags = static_cast<uint32_t>(stream.sendFlags());
+            sqe->user_data = userData(SendRequest, regs[fd].feedGeneration, fd);
+        }
+
+
+        /**
+         * @brief Cancel the sendmsg request of a fed stream buffer and wait for it to complete
+         * @param fd The socket
+         * @param stream The stream buffer
+         * @details The part sent before the cancel took effect is accounted for, the rest stays unsent.
+         */
+        void settle(int fd, socket_streambuf &stream) override {
+            if (!stream.sending() || fd < 0 || static_cast<size_t>(fd) >= regs.size() || regs[fd].fed != &stream)
+                return;
+            cancel(SendRequest, fd, regs[fd]);
+            int was = exchange(settling, fd);
+            while (stream.sending() && await())
+                ;
+            settling = was;
+            if (stream.sending())
+                stream.endSend(-ECANCELED);
+        }
+
+
+        /**
+         * @brief Stop feeding a stream buffer that is being reset or destroyed
+         * @param fd The socket
+         * @param stream The stream buffer
+         */
+        void detach(int fd, socket_streambuf &stream) override {
+            if (fd >= 0 && static_cast<size_t>(fd) < regs.size() && regs[fd].fed == &stream)
+                unfeed(fd, regs[fd]);
+            else
+                stream.setFeed(nullptr);
+        }
+
+        bool isRead(SocketPtr &s) {         ///< Test for read selection, hang up and error are reported as readable
+            return (s->interest & SC_Read) && (readyEvents(s->fd()) & (POLLIN | POLLHUP | POLLERR));
+        }
+
+        bool isWrite(SocketPtr &s) {        ///< Test for write selection
+            return (s->interest & SC_Write) && (readyEvents(s->fd()) & (POLLOUT | POLLERR));
+        }
+
+        bool isExcept(SocketPtr &s) {       ///< Test for exception selection
+            return (s->interest & SC_Except) && (readyEvents(s->fd()) & POLLPRI);
+        }
+
+        bool isSelected(SocketPtr &s) { return isRead(s) || isWrite(s) || isExcept(s); }    ///< Test for any selection
+
+
+        /**
+         * @brief Get all the selections for a socket
+         * @param s the socket pointer
+         * @return a mask of the SelectClients values selected
+         */
+        SelectClients selected(SocketPtr &s) {
+            return static_cast<SelectClients>((isRead(s) ? SC_Read : SC_None) |
+                                              (isWrite(s) ? SC_Write : SC_None) |
+                                              (isExcept(s) ? SC_Except : SC_None));
+        }
+
+
+        /**
+         * @brief Call a handler for each socket selected by the last wait
+         * @details Only the file descriptors with completions are visited. Sockets closed by an earlier
+         * call to the handler are skipped.
+         * @tparam Handler a callable with the signature void(SocketPtr &, SelectClients)
+         * @param sockets The socket container, unused
+         * @param handler The handler
+         * @return the number of sockets passed to the handler
+         */
+        template <class Handler>
+        int forEachReady(SocketContainer &, Handler &&handler) {
+            int count = 0;
+            for (size_t i = 0; i < readyFds.size(); ++i) {
+                int fd = readyFds[i];
+                SocketPtr *slot = regs[fd].slot;
+                if (slot && (*slot)->fd() == fd) {
+                    SelectClients s = selected(*slot);
+                    if (s != SC_None) {
+                        ++count;
+                        handler(*slot, s);
+                    }
+                }
+            }
+            return count;
+        }
+    };
+}
+
+#endif //EZNETWORK_URING_SET_H